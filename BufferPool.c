@@ -0,0 +1,82 @@
+/** @file BufferPool.c
+ *
+ *  Fixed memory budget for the network buffers of the OPC UA server
+ */
+
+#include <stdlib.h>
+
+#include "BufferPool.h"
+#include "Diagnostics.h"
+
+static UA_Byte *arena = NULL;           // all buffers in one block
+static UA_UInt32 bufferSize = 0;
+static UA_UInt32 bufferCount = 0;
+static UA_UInt32 *freeList = NULL;      // stack of the indices of the free buffers
+static UA_UInt32 freeCount = 0;
+static UA_UInt32 maxInUse = 0;
+
+int BufferPoolInit(UA_UInt32 memory, UA_UInt32 size) {
+    if (size == 0 || memory / size < 2*BUFFERPOOL_RESERVE)
+        return -1;
+    bufferCount = memory / size;
+    arena = malloc((size_t)bufferCount * size);
+    freeList = malloc(bufferCount * sizeof(UA_UInt32));
+    if (arena == NULL || freeList == NULL) {
+        BufferPoolExit();
+        return -1;
+    }
+    bufferSize = size;
+    for (UA_UInt32 i=0; i<bufferCount; i++)
+        freeList[i] = bufferCount-1-i;
+    freeCount = bufferCount;
+    maxInUse = 0;
+    return 0;
+}
+
+void BufferPoolExit() {
+    free(arena);
+    free(freeList);
+    arena = NULL;
+    freeList = NULL;
+    bufferCount = freeCount = 0;
+}
+
+int BufferPoolEnabled() {
+    return arena != NULL;
+}
+
+UA_StatusCode BufferPoolAlloc(UA_ByteString *buf, size_t length, int reserve) {
+    if (length > bufferSize)
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    if (freeCount <= (reserve ? BUFFERPOOL_RESERVE : 0)) {
+        DiagCount(DIAG_BUFFERPOOLEXHAUSTED);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    UA_UInt32 index = freeList[--freeCount];
+    if (bufferCount - freeCount > maxInUse)
+        maxInUse = bufferCount - freeCount;
+    buf->data = arena + (size_t)index * bufferSize;
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
+}
+
+void BufferPoolRelease(UA_ByteString *buf) {
+    if (arena != NULL && buf->data >= arena && buf->data < arena + (size_t)bufferCount * bufferSize) {
+        freeList[freeCount++] = (buf->data - arena) / bufferSize;
+        buf->data = NULL;
+        buf->length = 0;
+    } else
+        UA_ByteString_deleteMembers(buf);
+}
+
+UA_UInt32 BufferPoolCount() {
+    return bufferCount;
+}
+
+UA_UInt32 BufferPoolInUse() {
+    return bufferCount - freeCount;
+}
+
+UA_UInt32 BufferPoolMaxInUse() {
+    return maxInUse;
+}
@@ -0,0 +1,62 @@
+/** @file BufferPool.h
+ *
+ *  Fixed memory budget for the network buffers of the OPC UA server
+ *
+ *  Every message received and every response encoded by the library needs
+ *  a buffer of the negotiated chunk size (64 kB by default). Allocated from
+ *  the heap for every message, these buffers fragment the small memory
+ *  of the supply over long uptimes with changing numbers of sessions.
+ *  Instead, the epoll network layer takes them from a pool allocated
+ *  once at startup: memory / size buffers of size bytes in one block.
+ *
+ *  The chunk size of the connections (receive, send and maximum message size
+ *  in the Hello/Acknowledge exchange) is set to the buffer size,
+ *  so no request or response can be larger than one buffer.
+ *  BUFFERPOOL_RESERVE buffers are kept for encoding responses, a connection
+ *  is not read while the pool has no other buffer free (the rest is read
+ *  in the next iteration of the server loop, after the buffers were released).
+ *  New connections are refused while the pool is exhausted and when every
+ *  buffer beyond the reserve is already assigned to a connection,
+ *  so the number of clients cannot outgrow the budget.
+ *
+ *  Messages split across several receptions are still reassembled
+ *  on the heap by the library.
+ *
+ *  Configured by <opcua network="epoll" buffermemory="1048576" buffersize="16384"/>
+ *  [bytes], the buffer size is optional (default 65536).
+ *  The pool is only used by the OPC UA server thread, there is no locking.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "open62541.h"
+
+#define BUFFERPOOL_DEFAULTSIZE 65536    // default buffer size (the chunk size of the library)
+#define BUFFERPOOL_MINSIZE 8192         // smallest chunk size allowed by the OPC UA specification
+#define BUFFERPOOL_RESERVE 2            // buffers kept for encoding responses
+
+// allocate memory / size buffers of size bytes
+// return 0 on success, -1 if fewer than 2*BUFFERPOOL_RESERVE buffers can be allocated
+int BufferPoolInit(UA_UInt32 memory, UA_UInt32 size);
+
+// free the pool (only when the server has stopped)
+void BufferPoolExit();
+
+// check whether the pool has been allocated
+int BufferPoolEnabled();
+
+// take a buffer of the given length (at most the buffer size)
+// with reserve set, the last BUFFERPOOL_RESERVE buffers are not given out
+// return UA_STATUSCODE_BADOUTOFMEMORY if no buffer is free
+UA_StatusCode BufferPoolAlloc(UA_ByteString *buf, size_t length, int reserve);
+
+// return a buffer to the pool (buffers not taken from the pool are freed)
+void BufferPoolRelease(UA_ByteString *buf);
+
+// the number of buffers, the number in use and the largest number in use so far
+UA_UInt32 BufferPoolCount();
+UA_UInt32 BufferPoolInUse();
+UA_UInt32 BufferPoolMaxInUse();
+
+#endif
@@ -0,0 +1,235 @@
+/** @file Capture.c
+ *
+ *  Waveform capture of the current and voltage readbacks
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "Capture.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+
+static pthread_t captureThread;
+static volatile int captureRunning = 0;
+
+// configuration
+static int64_t capturePeriod;           // [ns] (long has only 32 bit on the target)
+static UA_UInt32 captureDepth = 0;
+static int captureMode;
+static int captureSource;
+static UA_UInt32 capturePost;
+
+// the ring buffer, protected by captureLock
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t armedCond = PTHREAD_COND_INITIALIZER;    // signalled by CaptureArm()
+static UA_Double *ringCurrent = NULL;
+static UA_Double *ringVoltage = NULL;
+static UA_DateTime *ringTime = NULL;
+static UA_UInt32 ringNext = 0;          // index of the next sample written
+static UA_UInt32 ringCount = 0;         // number of valid samples
+static UA_UInt32 state = CAPTURE_ARMED;
+static UA_UInt32 remaining = 0;         // samples still to be recorded after the trigger
+static UA_DateTime triggerTime = 0;
+static UA_UInt64 overruns = 0;
+
+// store one sample (capture thread)
+static void storeSample(UA_Double current, UA_Double voltage, UA_DateTime time) {
+    pthread_mutex_lock(&captureLock);
+    if (state != CAPTURE_FROZEN) {
+        ringCurrent[ringNext] = current;
+        ringVoltage[ringNext] = voltage;
+        ringTime[ringNext] = time;
+        ringNext = (ringNext+1) % captureDepth;
+        if (ringCount < captureDepth)
+            ringCount++;
+        if (state == CAPTURE_RUNNING && --remaining == 0)
+            state = CAPTURE_FROZEN;
+    }
+    pthread_mutex_unlock(&captureLock);
+}
+
+// wait while the capture is frozen (capture thread)
+// return 1 if the capture has been re-armed
+static int waitArmed() {
+    int waited = 0;
+    pthread_mutex_lock(&captureLock);
+    while (state == CAPTURE_FROZEN && captureRunning) {
+        // the timeout lets the thread check for termination
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 200000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&armedCond, &captureLock, &deadline);
+        waited = 1;
+    }
+    pthread_mutex_unlock(&captureLock);
+    return waited;
+}
+
+static void *captureLoop(void *arg) {
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (captureRunning) {
+        // a frozen capture does not use the device link, the schedule restarts when re-armed
+        if (waitArmed())
+            clock_gettime(CLOCK_MONOTONIC, &next);
+        DeviceRequest *request = DeviceRequestNew(&captureQueue);
+        if (request != NULL) {
+            TcpQueueAdd(&request->batch, "MRI\r\n");
+            TcpQueueAdd(&request->batch, "MRV\r\n");
+            DeviceRequestPost(&captureQueue, request);
+            double current, voltage;
+            // a request not completed within the timeout is not evaluated,
+            // its slot is only reused after the I/O thread has finished it
+            if (DeviceRequestWait(&captureQueue, request, DEVICE_TIMEOUT) && !request->failed
+                    && FastPsParseDouble(request->batch.reply[0], "#MRI:", &current)
+                    && FastPsParseDouble(request->batch.reply[1], "#MRV:", &voltage))
+                storeSample(current, voltage, UA_DateTime_now());
+        }
+        // the next tick on a fixed schedule, ticks already passed are skipped
+        int64_t nsec = next.tv_nsec + capturePeriod;
+        next.tv_sec += nsec / 1000000000;
+        next.tv_nsec = nsec % 1000000000;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t late = (int64_t)(now.tv_sec-next.tv_sec)*1000000000 + (now.tv_nsec-next.tv_nsec);
+        if (late > 0) {
+            __atomic_fetch_add(&overruns, late/capturePeriod + 1, __ATOMIC_RELAXED);
+            next = now;
+            continue;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+int CaptureStart(UA_Double rate, UA_UInt32 depth, int mode, int trigger, UA_UInt32 posttrigger) {
+    if (!(rate >= CAPTURE_MINRATE) || depth == 0 || depth > CAPTURE_MAXDEPTH)
+        return -1;
+    capturePeriod = (int64_t)(1e9/rate);
+    captureDepth = depth;
+    captureMode = mode;
+    captureSource = trigger;
+    capturePost = (posttrigger == 0 || posttrigger > depth) ? depth : posttrigger;
+    ringCurrent = malloc(depth*sizeof(UA_Double));
+    ringVoltage = malloc(depth*sizeof(UA_Double));
+    ringTime = malloc(depth*sizeof(UA_DateTime));
+    if (ringCurrent == NULL || ringVoltage == NULL || ringTime == NULL)
+        return -1;
+    captureRunning = 1;
+    if (pthread_create(&captureThread, NULL, captureLoop, NULL) != 0) {
+        captureRunning = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void CaptureStop() {
+    if (!captureRunning)
+        return;
+    captureRunning = 0;
+    pthread_join(captureThread, NULL);
+}
+
+void CaptureTrigger() {
+    pthread_mutex_lock(&captureLock);
+    if (captureMode == CAPTURE_TRIGGERED && state == CAPTURE_ARMED) {
+        state = CAPTURE_RUNNING;
+        remaining = capturePost;
+        triggerTime = UA_DateTime_now();
+    }
+    pthread_mutex_unlock(&captureLock);
+}
+
+void CaptureSetpointChanged() {
+    if (captureDepth != 0 && captureSource == CAPTURE_TRIGGER_SETPOINT)
+        CaptureTrigger();
+}
+
+void CaptureArm() {
+    pthread_mutex_lock(&captureLock);
+    ringNext = 0;
+    ringCount = 0;
+    state = CAPTURE_ARMED;
+    pthread_cond_signal(&armedCond);
+    pthread_mutex_unlock(&captureLock);
+}
+
+UA_UInt32 CaptureCount() {
+    pthread_mutex_lock(&captureLock);
+    UA_UInt32 count = ringCount;
+    pthread_mutex_unlock(&captureLock);
+    return count;
+}
+
+UA_UInt32 CaptureState() {
+    pthread_mutex_lock(&captureLock);
+    UA_UInt32 s = state;
+    pthread_mutex_unlock(&captureLock);
+    return s;
+}
+
+UA_DateTime CaptureTriggerTime() {
+    pthread_mutex_lock(&captureLock);
+    UA_DateTime t = triggerTime;
+    pthread_mutex_unlock(&captureLock);
+    return t;
+}
+
+UA_UInt64 CaptureOverruns() {
+    return __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+}
+
+UA_StatusCode CaptureRange(const UA_NumericRange *range, size_t length, size_t *first, size_t *count) {
+    if (range == NULL) {
+        *first = 0;
+        *count = length;
+        return UA_STATUSCODE_GOOD;
+    }
+    if (range->dimensionsSize != 1 || range->dimensions[0].min > range->dimensions[0].max)
+        return UA_STATUSCODE_BADINDEXRANGEINVALID;
+    if (range->dimensions[0].min >= length)
+        return UA_STATUSCODE_BADINDEXRANGENODATA;
+    size_t last = range->dimensions[0].max < length ? range->dimensions[0].max : length-1;
+    *first = range->dimensions[0].min;
+    *count = last - *first + 1;
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode CaptureRead(int signal, const UA_NumericRange *range, UA_Variant *value) {
+    const UA_DataType *type = &UA_TYPES[signal == CAPTURE_TIME ? UA_TYPES_DATETIME : UA_TYPES_DOUBLE];
+    const void *ring = signal == CAPTURE_CURRENT ? (void *)ringCurrent
+                     : signal == CAPTURE_VOLTAGE ? (void *)ringVoltage : (void *)ringTime;
+    size_t first, count;
+    pthread_mutex_lock(&captureLock);
+    UA_StatusCode retval = CaptureRange(range, ringCount, &first, &count);
+    if (retval != UA_STATUSCODE_GOOD) {
+        pthread_mutex_unlock(&captureLock);
+        return retval;
+    }
+    void *data = UA_Array_new(count, type);
+    if (data == NULL) {
+        pthread_mutex_unlock(&captureLock);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    if (count > 0) {
+        // the oldest sample is at ringNext once the ring is full
+        size_t start = (ringNext + captureDepth - ringCount + first) % captureDepth;
+        size_t part = count < captureDepth-start ? count : captureDepth-start;
+        memcpy(data, (const char *)ring + start*type->memSize, part*type->memSize);
+        memcpy((char *)data + part*type->memSize, ring, (count-part)*type->memSize);
+    }
+    pthread_mutex_unlock(&captureLock);
+    UA_Variant_setArray(value, data, count, type);
+    return UA_STATUSCODE_GOOD;
+}
@@ -0,0 +1,97 @@
+/** @file Capture.h
+ *
+ *  Waveform capture of the current and voltage readbacks
+ *
+ *  A capture thread samples MRI and MRV at a fixed rate through its own
+ *  request queue to the device I/O thread and stores the values with their
+ *  timestamps in a ring buffer. The buffer is allocated once at startup,
+ *  its depth and the sample rate are set in the configuration file.
+ *  The achievable rate is limited by the round-trip time of the device;
+ *  ticks missed because the device had not yet answered are counted as overruns.
+ *
+ *  In continuous mode the ring always holds the newest samples.
+ *  In triggered mode the capture is frozen a configured number of samples
+ *  after a trigger, so the buffer holds the history before and after the event.
+ *  No samples are requested from the device while the capture is frozen.
+ *  The trigger is either given by a client (Capture/Trigger) or by every
+ *  setpoint acknowledged by the device. Re-arming clears the buffer.
+ *
+ *  The samples are exposed as arrays in chronological order (oldest first).
+ *  Reads with a numeric range only copy the selected slice out of the ring.
+ *  The buffer is shared by the capture and the OPC UA threads,
+ *  all functions take care of the locking.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "open62541.h"
+
+#define CAPTURE_MAXDEPTH 1000000    // maximum number of samples in the ring buffer
+#define CAPTURE_MINRATE 0.001       // minimum sample rate [samples/s]
+
+enum {
+    CAPTURE_CONTINUOUS,
+    CAPTURE_TRIGGERED
+};
+
+// the trigger sources in triggered mode
+enum {
+    CAPTURE_TRIGGER_MANUAL,     // only Capture/Trigger
+    CAPTURE_TRIGGER_SETPOINT    // also every acknowledged setpoint
+};
+
+// the state of the capture
+enum {
+    CAPTURE_ARMED,              // recording, waiting for a trigger
+    CAPTURE_RUNNING,            // recording the samples after the trigger
+    CAPTURE_FROZEN              // stopped, the buffer is complete
+};
+
+// the signals stored in the ring buffer
+enum {
+    CAPTURE_CURRENT,
+    CAPTURE_VOLTAGE,
+    CAPTURE_TIME,
+    CAPTURE_SIGNALS
+};
+
+// allocate the buffer and start the capture thread
+// rate [samples/s], depth [samples], posttrigger [samples] (only used in triggered mode)
+// return 0 on success, -1 also for a rate below CAPTURE_MINRATE
+int CaptureStart(UA_Double rate, UA_UInt32 depth, int mode, int trigger, UA_UInt32 posttrigger);
+
+// stop the capture thread
+void CaptureStop();
+
+// trigger the capture (ignored unless armed in triggered mode)
+void CaptureTrigger();
+
+// a setpoint was acknowledged by the device (triggers if selected as source)
+void CaptureSetpointChanged();
+
+// clear the buffer and start recording again
+void CaptureArm();
+
+// the number of valid samples
+UA_UInt32 CaptureCount();
+
+// the state of the capture (CAPTURE_ARMED, ...)
+UA_UInt32 CaptureState();
+
+// the time of the last trigger, 0 if never
+UA_DateTime CaptureTriggerTime();
+
+// the number of samples missed because the device was too slow
+UA_UInt64 CaptureOverruns();
+
+// the slice [first, first+count) of an array of the given length selected by a numeric range
+// range may be NULL (the whole array)
+// return UA_STATUSCODE_BADINDEXRANGEINVALID for multi-dimensional or inverted ranges,
+// UA_STATUSCODE_BADINDEXRANGENODATA if the range starts behind the end of the array
+UA_StatusCode CaptureRange(const UA_NumericRange *range, size_t length, size_t *first, size_t *count);
+
+// copy the selected slice of a signal into a new variant (a Double or DateTime array)
+UA_StatusCode CaptureRead(int signal, const UA_NumericRange *range, UA_Variant *value);
+
+#endif
@@ -0,0 +1,497 @@
+/** @file DeviceLink.c
+ *
+ *  TCP/IP communication with the device server of the FAST-PS (port 10001)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "DeviceLink.h"
+#include "Diagnostics.h"
+#include "Trace.h"
+#include "FastPsProtocol.h"
+
+int sock = -1;
+struct sockaddr_in tcpserver;
+
+char command[BUFSIZE];			// command string buffer
+char response[BUFSIZE];			// receive buffer
+
+DeviceQueue uaQueue;
+DeviceQueue udpQueue;
+DeviceQueue captureQueue;
+DeviceQueue rampQueue;
+DeviceQueue publishQueue;
+DeviceQueue streamQueue;
+DeviceQueue scheduleQueue;
+
+// all queues served by the I/O thread in turn (the scheduleQueue is served by time)
+static DeviceQueue *queues[] = { &uaQueue, &udpQueue, &captureQueue, &rampQueue, &publishQueue, &streamQueue };
+#define NQUEUES (sizeof(queues)/sizeof(queues[0]))
+
+static pthread_t ioThread;
+static volatile int ioRunning = 0;
+// posted by the clients for every posted request
+static sem_t requestSem;
+
+// state of the connection, only modified by the I/O thread
+static volatile int linkUp = 0;
+static unsigned int retryDelay = DEVICE_RETRY_MIN;     // delay before the next attempt [ms]
+static struct timespec nextRetry;                       // time of the next attempt (monotonic clock)
+
+/***********************************/
+/* line-framed receive stream      */
+/***********************************/
+
+// The device answers every command with one line terminated by \r\n.
+// TCP is a stream protocol, so a single recv() may return a partial line
+// or several lines at once. All received bytes are collected in a ring buffer,
+// complete lines are handed out one by one and a partial tail is kept
+// until the rest of it arrives with a later recv().
+// The indices are free-running counters, the buffer position is taken modulo RXSIZE.
+
+#define RXSIZE 1024                     // size of the receive ring buffer (must be a power of 2)
+#define RXPOS(i) ((i) & (RXSIZE-1))
+static char rxring[RXSIZE];
+static unsigned int rxhead = 0;         // first byte not yet consumed
+static unsigned int rxtail = 0;         // behind the last received byte
+static unsigned int rxscan = 0;         // bytes after rxhead already known to contain no line end
+
+// get the next line from the receive stream into line[BUFSIZE]
+// the termination is removed, overlong lines are truncated to BUFSIZE-1 characters
+// blocks until a complete line is available
+// return the length of the line, -1 if the connection has failed
+static int TcpReadLine(char *line) {
+    while (1) {
+        unsigned int count = rxtail - rxhead;
+        for (; rxscan+1 < count; rxscan++)
+            if (rxring[RXPOS(rxhead+rxscan)]=='\r' && rxring[RXPOS(rxhead+rxscan+1)]=='\n') {
+                // copy the line out of the ring (in two pieces if it wraps around)
+                unsigned int len = rxscan < BUFSIZE-1 ? rxscan : BUFSIZE-1;
+                unsigned int start = RXPOS(rxhead);
+                unsigned int first = len < RXSIZE-start ? len : RXSIZE-start;
+                memcpy(line, rxring+start, first);
+                memcpy(line+first, rxring, len-first);
+                line[len] = '\0';
+                rxhead += rxscan+2;
+                rxscan = 0;
+                return len;
+            }
+        // a full buffer without line end cannot be framed - discard it
+        if (count == RXSIZE) {
+            rxhead = rxtail;
+            rxscan = 0;
+            count = 0;
+        }
+        // receive into the contiguous free space at the tail of the ring
+        unsigned int start = RXPOS(rxtail);
+        unsigned int space = RXSIZE - count;
+        if (space > RXSIZE-start)
+            space = RXSIZE-start;
+        int reclen = recv(sock, rxring+start, space, 0);
+        if (reclen <= 0)
+            return -1;
+        rxtail += reclen;
+    }
+}
+
+/***********************************/
+/* pipelined command batches       */
+/***********************************/
+
+void TcpQueueInit(TcpQueue *queue) {
+    queue->length = 0;
+}
+
+int TcpQueueAdd(TcpQueue *queue, const char *cmd) {
+    if (queue->length >= MAXQUEUE)
+        return -1;
+    strncpy(queue->command[queue->length], cmd, BUFSIZE-1);
+    queue->command[queue->length][BUFSIZE-1] = '\0';
+    queue->reply[queue->length][0] = '\0';
+    return queue->length++;
+}
+
+// send all queued commands in one go and collect the replies (I/O thread only)
+// the time when the commands have been handed to the kernel is stored in sent
+// return 0 if the connection has failed
+static int TcpQueueExecute(TcpQueue *queue, UA_DateTime *sent) {
+    // concatenate all commands and write them in a single send()
+    char txbuf[MAXQUEUE*BUFSIZE];
+    unsigned int txlen = 0;
+    for (unsigned int i=0; i<queue->length; i++) {
+        unsigned int len = strlen(queue->command[i]);
+        memcpy(txbuf+txlen, queue->command[i], len);
+        txlen += len;
+    }
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    unsigned int done = 0;
+    while (done < txlen) {
+        // a connection closed by the device must not raise SIGPIPE
+        int n = send(sock, txbuf+done, txlen-done, MSG_NOSIGNAL);
+        if (n <= 0)
+            return 0;
+        done += n;
+    }
+    *sent = UA_DateTime_now();
+    // the device answers every command with exactly one line
+    // in the order the commands were received
+    // the latency of a command is the time from the send() to the arrival of its answer
+    for (unsigned int i=0; i<queue->length; i++) {
+        if (TcpReadLine(queue->reply[i]) < 0)
+            return 0;
+        int nak = FastPsIsNak(queue->reply[i]);
+        DiagRecordStatus(DiagCommandType(queue->command[i]), start,
+            nak ? UA_STATUSCODE_BADDEVICEFAILURE : UA_STATUSCODE_GOOD, queue->length);
+        if (nak)
+            DiagCount(DIAG_NAKREPLIES);
+    }
+    return 1;
+}
+
+/***********************************/
+/* connection management           */
+/***********************************/
+
+// The connection is established by the I/O thread. If it cannot be
+// established or fails later, it is retried with an exponentially growing
+// delay from DEVICE_RETRY_MIN up to DEVICE_RETRY_MAX. After a failure of an
+// established connection the first attempt is made immediately.
+// While the link is down all requests complete at once without replies
+// and are marked as failed.
+
+static void addMilliseconds(struct timespec *t, unsigned int ms) {
+    t->tv_sec += ms/1000;
+    t->tv_nsec += (ms%1000)*1000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+static int connectDevice() {
+    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return 0;
+    if (connect(sock, (struct sockaddr *) &tcpserver, sizeof(tcpserver)) < 0) {
+        close(sock);
+        sock = -1;
+        return 0;
+    }
+    // a device that stops answering is treated like a lost connection
+    struct timeval timeout = { DEVICE_RXTIMEOUT/1000, (DEVICE_RXTIMEOUT%1000)*1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    // nothing received on an earlier connection belongs to the new one
+    rxhead = rxtail = rxscan = 0;
+    return 1;
+}
+
+static void linkFailed() {
+    close(sock);
+    sock = -1;
+    linkUp = 0;
+    retryDelay = DEVICE_RETRY_MIN;
+    clock_gettime(CLOCK_MONOTONIC, &nextRetry);
+    printf("DeviceLink : lost connection to TCP/IP server\n");
+    fflush(stdout);
+}
+
+// try to connect if the link is down and the retry time has come
+// return the time [ms] until the next attempt, 0 if the link is up
+static unsigned int maintainLink() {
+    if (linkUp)
+        return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long wait = (nextRetry.tv_sec-now.tv_sec)*1000L + (nextRetry.tv_nsec-now.tv_nsec)/1000000L;
+    if (wait > 0)
+        return wait;
+    if (connectDevice()) {
+        linkUp = 1;
+        printf("DeviceLink : connected to TCP/IP server\n");
+        fflush(stdout);
+        return 0;
+    }
+    nextRetry = now;
+    addMilliseconds(&nextRetry, retryDelay);
+    wait = retryDelay;
+    retryDelay *= 2;
+    if (retryDelay > DEVICE_RETRY_MAX)
+        retryDelay = DEVICE_RETRY_MAX;
+    return wait;
+}
+
+int DeviceConnected() {
+    return linkUp;
+}
+
+/***********************************/
+/* request queues                  */
+/***********************************/
+
+// The head and tail counters of a queue are free-running. Each of them is
+// written by one thread only and read by the other one. They are accessed
+// with acquire/release semantics, so the contents of a request slot are
+// visible to the I/O thread when it sees the new head, and the replies
+// are visible to the client when it sees the new tail.
+
+DeviceRequest *DeviceRequestNew(DeviceQueue *queue) {
+    unsigned int head = queue->head;
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= DEVQUEUE_SIZE)
+        return NULL;
+    DeviceRequest *request = queue->slot + head%DEVQUEUE_SIZE;
+    TcpQueueInit(&request->batch);
+    request->done = NULL;
+    request->data = NULL;
+    request->result = 0;
+    request->failed = 0;
+    request->time = 0;
+    request->sent = 0;
+    request->sequence = head;
+    return request;
+}
+
+void DeviceRequestPost(DeviceQueue *queue, DeviceRequest *request) {
+    unsigned int depth = request->sequence+1 - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (depth > __atomic_load_n(&queue->maxDepth, __ATOMIC_RELAXED))
+        __atomic_store_n(&queue->maxDepth, depth, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue->head, request->sequence+1, __ATOMIC_RELEASE);
+    sem_post(&requestSem);
+}
+
+unsigned int DeviceQueueDepth(DeviceQueue *queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+unsigned int DeviceQueueMaxDepth(DeviceQueue *queue) {
+    return __atomic_load_n(&queue->maxDepth, __ATOMIC_RELAXED);
+}
+
+int DeviceRequestDone(DeviceQueue *queue, const DeviceRequest *request) {
+    return (int)(__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - request->sequence) > 0;
+}
+
+int DeviceRequestWait(DeviceQueue *queue, const DeviceRequest *request, unsigned int timeout) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    addMilliseconds(&deadline, timeout);
+    // the semaphore counts the completions of all requests of the queue
+    while (!DeviceRequestDone(queue, request))
+        if (sem_timedwait(&queue->completed, &deadline) != 0 && errno == ETIMEDOUT)
+            return DeviceRequestDone(queue, request);
+    return 1;
+}
+
+int DeviceQueueFlush(DeviceQueue *queue, unsigned int timeout) {
+    if (queue->head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+        return 1;
+    // the requests are completed in order
+    return DeviceRequestWait(queue, queue->slot + (queue->head-1)%DEVQUEUE_SIZE, timeout);
+}
+
+// execute the oldest request of a queue if there is one
+static int serveQueue(DeviceQueue *queue) {
+    unsigned int tail = queue->tail;
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail)
+        return 0;
+    DeviceRequest *request = queue->slot + tail%DEVQUEUE_SIZE;
+    if (!linkUp)
+        request->failed = 1;
+    else if (!TcpQueueExecute(&request->batch, &request->sent)) {
+        request->failed = 1;
+        linkFailed();
+    }
+    if (request->failed)
+        DiagCount(DIAG_FAILEDREQUESTS);
+    if (request->done != NULL)
+        request->done(request);
+    __atomic_store_n(&queue->tail, tail+1, __ATOMIC_RELEASE);
+    sem_post(&queue->completed);
+    return 1;
+}
+
+/***********************************/
+/* scheduled requests              */
+/***********************************/
+
+// the time [ms] until the guard interval before the next scheduled request begins,
+// 0 if it has begun, -1 if there is no scheduled request
+static long scheduleDue() {
+    unsigned int tail = scheduleQueue.tail;
+    if (__atomic_load_n(&scheduleQueue.head, __ATOMIC_ACQUIRE) == tail)
+        return -1;
+    UA_DateTime time = scheduleQueue.slot[tail%DEVQUEUE_SIZE].time;
+    long wait = (time - UA_DateTime_now()) / UA_MSEC_TO_DATETIME - DEVICE_SCHEDULE_GUARD;
+    return wait > 0 ? wait : 0;
+}
+
+// wait until a time of the UA_DateTime_now() clock
+// the wakeup latency of the timer is absorbed by spinning for the last DEVICE_SCHEDULE_SPIN
+static void waitUntil(UA_DateTime time) {
+    UA_DateTime wake = time - DEVICE_SCHEDULE_SPIN*UA_USEC_TO_DATETIME - UA_DATETIME_UNIX_EPOCH;
+    if (UA_DateTime_now() - UA_DATETIME_UNIX_EPOCH < wake) {
+        struct timespec t = { wake/UA_SEC_TO_DATETIME, (wake%UA_SEC_TO_DATETIME)*100 };
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &t, NULL) == EINTR)
+            ;
+    }
+    while (UA_DateTime_now() < time)
+        ;
+}
+
+// send the next scheduled request at its time
+static void serveScheduled() {
+    waitUntil(scheduleQueue.slot[scheduleQueue.tail%DEVQUEUE_SIZE].time);
+    serveQueue(&scheduleQueue);
+}
+
+static void *deviceThread(void *arg) {
+    TraceThread("device");
+    unsigned int next = 0;
+    clock_gettime(CLOCK_MONOTONIC, &nextRetry);
+    while (ioRunning) {
+        unsigned int wait = maintainLink();
+        // every posted request is counted by the semaphore
+        // the timeout lets the thread check for termination and retry the connection
+        if (linkUp || wait > 200)
+            wait = 200;
+        // the thread wakes up in time for the next scheduled request
+        long due = scheduleDue();
+        if (due == 0) {
+            serveScheduled();
+            continue;
+        }
+        if (due > 0 && (unsigned long)due < wait)
+            wait = due;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        addMilliseconds(&deadline, wait);
+        if (sem_timedwait(&requestSem, &deadline) != 0)
+            continue;
+        if (scheduleDue() == 0)
+            serveScheduled();
+        // the queues are served round-robin, one request per posting
+        for (unsigned int i=0; i<NQUEUES; i++, next++)
+            if (serveQueue(queues[next%NQUEUES])) {
+                next++;
+                break;
+            }
+    }
+    return NULL;
+}
+
+int DeviceStart() {
+    sem_init(&requestSem, 0, 0);
+    for (unsigned int i=0; i<NQUEUES; i++) {
+        queues[i]->head = 0;
+        queues[i]->tail = 0;
+        queues[i]->maxDepth = 0;
+        sem_init(&queues[i]->completed, 0, 0);
+    }
+    scheduleQueue.head = 0;
+    scheduleQueue.tail = 0;
+    scheduleQueue.maxDepth = 0;
+    sem_init(&scheduleQueue.completed, 0, 0);
+    ioRunning = 1;
+    if (pthread_create(&ioThread, NULL, deviceThread, NULL) != 0) {
+        ioRunning = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void DeviceStop() {
+    if (!ioRunning)
+        return;
+    ioRunning = 0;
+    pthread_join(ioThread, NULL);
+    if (sock >= 0)
+        close(sock);
+}
+
+/***********************************/
+/* command blocks                  */
+/***********************************/
+
+// copy the replies of a completed batch
+static unsigned int collect(const DeviceRequest *request, char (*replies)[BUFSIZE]) {
+    if (request->failed)
+        return 0;
+    for (unsigned int i=0; i<request->batch.length; i++)
+        strcpy(replies[i], request->batch.reply[i]);
+    return request->batch.length;
+}
+
+unsigned int DeviceExchange(DeviceQueue *queue, char (*commands)[BUFSIZE], char (*replies)[BUFSIZE], unsigned int count) {
+    // the batches in flight, oldest first
+    DeviceRequest *posted[DEVQUEUE_SIZE];
+    unsigned int first[DEVQUEUE_SIZE];
+    unsigned int nposted = 0, oldest = 0;
+    unsigned int answered = 0;
+    int timedOut = 0;
+    for (unsigned int i=0; i<count; i++)
+        replies[i][0] = '\0';
+    for (unsigned int next = 0; next < count && !timedOut; ) {
+        DeviceRequest *request = DeviceRequestNew(queue);
+        if (request == NULL) {
+            // the queue is full - the oldest batch has to complete first
+            if (oldest == nposted)
+                break;
+            DeviceRequest *r = posted[oldest%DEVQUEUE_SIZE];
+            if (!DeviceRequestWait(queue, r, DEVICE_TIMEOUT))
+                timedOut = 1;
+            else
+                answered += collect(r, replies+first[oldest%DEVQUEUE_SIZE]);
+            oldest++;
+            continue;
+        }
+        posted[nposted%DEVQUEUE_SIZE] = request;
+        first[nposted%DEVQUEUE_SIZE] = next;
+        nposted++;
+        while (next < count && TcpQueueAdd(&request->batch, commands[next]) >= 0)
+            next++;
+        DeviceRequestPost(queue, request);
+    }
+    for (; oldest < nposted && !timedOut; oldest++) {
+        DeviceRequest *r = posted[oldest%DEVQUEUE_SIZE];
+        if (!DeviceRequestWait(queue, r, DEVICE_TIMEOUT))
+            timedOut = 1;
+        else
+            answered += collect(r, replies+first[oldest%DEVQUEUE_SIZE]);
+    }
+    return answered;
+}
+
+/***********************************/
+/* single commands                 */
+/***********************************/
+
+unsigned int TcpSendReceive() {
+    response[0] = '\0';
+    DeviceRequest *request = DeviceRequestNew(&uaQueue);
+    if (request == NULL)
+        return 0;
+    TcpQueueAdd(&request->batch, command);
+    DeviceRequestPost(&uaQueue, request);
+    if (!DeviceRequestWait(&uaQueue, request, DEVICE_TIMEOUT))
+        return 0;
+    strcpy(response, request->batch.reply[0]);
+    return strlen(response);
+}
+
+int TcpSendAsync(DeviceCallback done) {
+    DeviceRequest *request = DeviceRequestNew(&uaQueue);
+    if (request == NULL)
+        return 0;
+    TcpQueueAdd(&request->batch, command);
+    request->done = done;
+    DeviceRequestPost(&uaQueue, request);
+    return 1;
+}
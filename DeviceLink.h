@@ -0,0 +1,163 @@
+/** @file DeviceLink.h
+ *
+ *  TCP/IP communication with the device server of the FAST-PS (port 10001)
+ *
+ *  The socket is owned by a dedicated device I/O thread. Other threads
+ *  never block in send()/recv() but hand their requests to the I/O thread.
+ *  Every client thread (OPC UA server, UDP server, capture, ramp playback) has its own
+ *  DeviceQueue, a lock-free single-producer/single-consumer ring of requests.
+ *  The client thread fills a request in place and posts it, the I/O thread
+ *  executes it and marks it complete. The client can either wait for the
+ *  completion (with a timeout) or leave the evaluation of the replies
+ *  to a callback run by the I/O thread.
+ *
+ *  A request is a batch of commands (TcpQueue). The commands are written to
+ *  the device back-to-back, the answers are then read from the stream line by line
+ *  and assigned to the commands in the order they were queued.
+ *  This way a complete set of readbacks costs about one round-trip time
+ *  instead of one round-trip per command.
+ *
+ *  The I/O thread also establishes the connection. When it cannot be established
+ *  or is lost later, it is retried with an exponential backoff. While the link is
+ *  down the requests are completed at once without replies and marked as failed.
+ *
+ *  All answers are framed on the \r\n line termination. Bytes received
+ *  beyond the end of a line are kept for the next answer, so replies that
+ *  are split or coalesced by TCP are still assigned correctly.
+ *
+ *  Requests for a given time (UA_DateTime_now() clock) are posted to the scheduleQueue,
+ *  the times must not decrease within the queue. The I/O thread does not start
+ *  any other request within DEVICE_SCHEDULE_GUARD before the time of the next one,
+ *  sleeps until shortly before the time (absolute timer of the realtime clock),
+ *  spins for the last DEVICE_SCHEDULE_SPIN and sends the commands.
+ *  The time of the send() is recorded with every request.
+ *
+ *  For the callbacks of the OPC UA server single commands can be exchanged
+ *  with TcpSendReceive() and TcpSendAsync() using the global command/response buffers.
+ */
+
+#ifndef DEVICELINK_H
+#define DEVICELINK_H
+
+#include <netinet/in.h>
+#include <semaphore.h>
+
+#include "open62541.h"
+
+#define BUFSIZE 80              // maximum length of a command or a reply line
+#define MAXQUEUE 32             // maximum number of commands executed in one batch
+#define DEVQUEUE_SIZE 16        // number of requests a client thread can have outstanding
+#define DEVICE_TIMEOUT 1000     // maximum time [ms] a client waits for a reply
+#define DEVICE_RXTIMEOUT 3000   // the connection is dropped if the device does not answer within [ms]
+#define DEVICE_RETRY_MIN 50     // first delay [ms] between connection attempts
+#define DEVICE_RETRY_MAX 5000   // maximum delay [ms] between connection attempts
+#define DEVICE_SCHEDULE_GUARD 20    // no other request is started within [ms] before a scheduled one
+#define DEVICE_SCHEDULE_SPIN 200    // the last [us] before a scheduled request are spent spinning
+
+extern int sock;
+extern struct sockaddr_in tcpserver;
+
+extern char command[BUFSIZE];   // command string buffer
+extern char response[BUFSIZE];  // receive buffer
+
+// error handler provided by the main program
+void Die(char *mess);
+
+// a batch of commands to be executed together
+typedef struct {
+    unsigned int length;                // number of queued commands
+    char command[MAXQUEUE][BUFSIZE];    // command strings including the \r\n termination
+    char reply[MAXQUEUE][BUFSIZE];      // answer lines with the \r\n termination removed
+} TcpQueue;
+
+// remove all commands from the queue
+void TcpQueueInit(TcpQueue *queue);
+
+// append a command string (including the \r\n termination) to the queue
+// return the index of the command in the queue, -1 if the queue is full
+int TcpQueueAdd(TcpQueue *queue, const char *cmd);
+
+typedef struct DeviceRequest DeviceRequest;
+
+// evaluation of the replies, run by the I/O thread after the exchange
+typedef void (*DeviceCallback)(DeviceRequest *request);
+
+struct DeviceRequest {
+    TcpQueue batch;             // the commands and their replies
+    DeviceCallback done;        // called after the exchange, may be NULL
+    void *data;                 // free for use by the callback
+    int result;                 // free for use by the callback
+    int failed;                 // set if the request could not be exchanged with the device
+    UA_DateTime time;           // the time to send the commands (scheduleQueue only)
+    UA_DateTime sent;           // the time the commands were sent, set by the I/O thread
+    unsigned int sequence;      // position in the queue (used for the completion)
+};
+
+// a request queue between one client thread and the I/O thread
+typedef struct {
+    DeviceRequest slot[DEVQUEUE_SIZE];
+    unsigned int head;          // number of posted requests (written by the client only)
+    unsigned int tail;          // number of completed requests (written by the I/O thread only)
+    sem_t completed;            // posted by the I/O thread for every completed request
+    unsigned int maxDepth;      // largest number of outstanding requests seen (written by the client only)
+} DeviceQueue;
+
+extern DeviceQueue uaQueue;     // requests of the OPC UA server thread
+extern DeviceQueue udpQueue;    // requests of the UDP server thread
+extern DeviceQueue captureQueue;    // requests of the waveform capture thread
+extern DeviceQueue rampQueue;       // requests of the ramp playback thread
+extern DeviceQueue publishQueue;    // requests of the multicast publisher thread
+extern DeviceQueue streamQueue;     // requests of the UDP streaming thread
+extern DeviceQueue scheduleQueue;   // requests of the OPC UA server thread for a given time
+
+// start the device I/O thread which connects to the address in tcpserver
+// return 0 on success
+int DeviceStart();
+
+// stop the device I/O thread and close the connection
+void DeviceStop();
+
+// check whether the connection to the device is established
+int DeviceConnected();
+
+// get the next free request of a queue (with an empty batch and no callback)
+// return NULL if the queue is full
+DeviceRequest *DeviceRequestNew(DeviceQueue *queue);
+
+// hand the request obtained last from DeviceRequestNew() to the I/O thread
+void DeviceRequestPost(DeviceQueue *queue, DeviceRequest *request);
+
+// the number of requests posted but not yet executed
+unsigned int DeviceQueueDepth(DeviceQueue *queue);
+
+// the largest number of outstanding requests since the start
+unsigned int DeviceQueueMaxDepth(DeviceQueue *queue);
+
+// check whether a posted request has been executed
+int DeviceRequestDone(DeviceQueue *queue, const DeviceRequest *request);
+
+// wait until a posted request has been executed, at most timeout [ms]
+// return 1 if the request is complete, 0 on timeout
+int DeviceRequestWait(DeviceQueue *queue, const DeviceRequest *request, unsigned int timeout);
+
+// wait until all requests posted to a queue are completed
+// return 0 on timeout
+int DeviceQueueFlush(DeviceQueue *queue, unsigned int timeout);
+
+// exchange any number of commands with the device, pipelined in batches of up to MAXQUEUE
+// (the queue must belong to the calling thread)
+// replies[i] receives the answer to commands[i], an empty string if there was none
+// return the number of commands answered
+unsigned int DeviceExchange(DeviceQueue *queue, char (*commands)[BUFSIZE], char (*replies)[BUFSIZE], unsigned int count);
+
+// send the string in command to the device (OPC UA thread only)
+// wait for the answer line in response (the \r\n termination is removed)
+// return the number of characters in the answer, 0 if there was no answer within DEVICE_TIMEOUT
+unsigned int TcpSendReceive();
+
+// send the string in command to the device without waiting for the answer (OPC UA thread only)
+// the answer can be evaluated by the callback (may be NULL)
+// return 0 if the request could not be queued
+int TcpSendAsync(DeviceCallback done);
+
+#endif
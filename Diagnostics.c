@@ -0,0 +1,121 @@
+/** @file Diagnostics.c
+ *
+ *  Latency histograms and event counters of the server
+ */
+
+#include <string.h>
+
+#include "Diagnostics.h"
+#include "Trace.h"
+
+DiagHistogram diagHistograms[DIAG_HISTOGRAMS] = {
+    [DIAG_MRI]        = { "MRI" },
+    [DIAG_MRV]        = { "MRV" },
+    [DIAG_MST]        = { "MST" },
+    [DIAG_MWI]        = { "MWI" },
+    [DIAG_MWV]        = { "MWV" },
+    [DIAG_MRG]        = { "MRG" },
+    [DIAG_MWG]        = { "MWG" },
+    [DIAG_OTHER]      = { "OtherCommands" },
+    [DIAG_DATASOURCE] = { "DataSourceRead" },
+    [DIAG_UDPREPLY]   = { "UdpReply" },
+    [DIAG_UALOOP]     = { "ServerIteration" }
+};
+
+UA_UInt64 diagCounters[DIAG_COUNTERS];
+
+const char *diagCounterNames[DIAG_COUNTERS] = {
+    [DIAG_NAKREPLIES]       = "NakReplies",
+    [DIAG_MALFORMEDREPLIES] = "MalformedReplies",
+    [DIAG_FAILEDREQUESTS]   = "FailedRequests",
+    [DIAG_CACHEHITS]        = "CacheHits",
+    [DIAG_CACHEMISSES]      = "CacheMisses",
+    [DIAG_HEAPALLOCS]       = "HeapAllocations",
+    [DIAG_POOLALLOCS]       = "PoolAllocations",
+    [DIAG_POOLEXHAUSTED]    = "PoolExhausted",
+    [DIAG_PUBLISHEDFRAMES]  = "PublishedFrames",
+    [DIAG_STREAMEDFRAMES]   = "StreamedFrames",
+    [DIAG_BUFFERPOOLEXHAUSTED] = "BufferPoolExhausted",
+    [DIAG_REFUSEDCONNECTIONS]  = "RefusedConnections"
+};
+
+int DiagCommandType(const char *cmd) {
+    // the first difference is always within the first three characters
+    static const struct { const char *prefix; int type; } types[] = {
+        { "MRI", DIAG_MRI }, { "MRV", DIAG_MRV }, { "MST", DIAG_MST },
+        { "MWI", DIAG_MWI }, { "MWV", DIAG_MWV }, { "MRG", DIAG_MRG }, { "MWG", DIAG_MWG } };
+    for (unsigned int i=0; i<sizeof(types)/sizeof(types[0]); i++)
+        if (!strncmp(cmd, types[i].prefix, 3))
+            return types[i].type;
+    return DIAG_OTHER;
+}
+
+void DiagRecord(int histogram, UA_UInt64 duration) {
+    DiagHistogram *h = diagHistograms+histogram;
+    int k = 0;
+    while (k < DIAG_BUCKETS-1 && (duration >> (k+1)) != 0)
+        k++;
+    __atomic_fetch_add(&h->bucket[k], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, duration, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    UA_UInt64 max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (duration > max)
+        if (__atomic_compare_exchange_n(&h->max, &max, duration, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+}
+
+void DiagRecordSince(int histogram, UA_DateTime start) {
+    DiagRecordStatus(histogram, start, UA_STATUSCODE_GOOD, 0);
+}
+
+void DiagRecordStatus(int histogram, UA_DateTime start, UA_UInt32 status, UA_UInt32 arg) {
+    // the event of the trace belonging to a histogram
+    static const int events[DIAG_HISTOGRAMS] = {
+        [DIAG_MRI]        = TRACE_DEVICE,
+        [DIAG_MRV]        = TRACE_DEVICE,
+        [DIAG_MST]        = TRACE_DEVICE,
+        [DIAG_MWI]        = TRACE_DEVICE,
+        [DIAG_MWV]        = TRACE_DEVICE,
+        [DIAG_MRG]        = TRACE_DEVICE,
+        [DIAG_MWG]        = TRACE_DEVICE,
+        [DIAG_OTHER]      = TRACE_DEVICE,
+        [DIAG_DATASOURCE] = TRACE_DATASOURCE,
+        [DIAG_UDPREPLY]   = TRACE_UDP,
+        [DIAG_UALOOP]     = TRACE_UALOOP };
+    UA_DateTime now = UA_DateTime_nowMonotonic();
+    DiagRecord(histogram, now > start ? (now-start)/UA_USEC_TO_DATETIME : 0);
+    TraceEvent(events[histogram], events[histogram] == TRACE_DEVICE ? histogram : 0, start, now, status, arg);
+}
+
+void DiagCount(int counter) {
+    __atomic_fetch_add(&diagCounters[counter], 1, __ATOMIC_RELAXED);
+}
+
+UA_UInt64 DiagCounter(int counter) {
+    return __atomic_load_n(&diagCounters[counter], __ATOMIC_RELAXED);
+}
+
+void DiagHistogramGet(const DiagHistogram *h, DiagHistogram *copy) {
+    copy->name = h->name;
+    copy->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    copy->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    copy->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    for (int k=0; k<DIAG_BUCKETS; k++)
+        copy->bucket[k] = __atomic_load_n(&h->bucket[k], __ATOMIC_RELAXED);
+}
+
+UA_Double DiagPercentile(const DiagHistogram *h, UA_Double fraction) {
+    UA_UInt64 total = 0;
+    for (int k=0; k<DIAG_BUCKETS; k++)
+        total += h->bucket[k];
+    if (total == 0)
+        return 0.0;
+    UA_UInt64 sum = 0;
+    for (int k=0; k<DIAG_BUCKETS-1; k++) {
+        sum += h->bucket[k];
+        if (sum >= fraction*total)
+            return (UA_Double)((2ULL << k) < h->max ? (2ULL << k) : h->max);
+    }
+    // beyond the last bucket only the maximum is known
+    return (UA_Double)h->max;
+}
@@ -0,0 +1,96 @@
+/** @file Diagnostics.h
+ *
+ *  Latency histograms and event counters of the server
+ *
+ *  The timing of the hot paths is recorded in histograms with logarithmic
+ *  buckets: bucket 0 counts durations below 2 us, bucket k (k>0) durations
+ *  from 2^k to 2^(k+1) us, the last bucket all longer durations.
+ *  - one histogram per device command type, measured by the I/O thread
+ *    from sending a batch to the arrival of the reply line
+ *  - the DataSource read callbacks of the OPC UA server
+ *  - the UDP server, from the reception of a batch of packets to the replies
+ *  - one iteration of the OPC UA server loop (without the time waiting for the network)
+ *
+ *  Every recorded duration is also appended to the event trace (see Trace.h).
+ *
+ *  All values are updated with atomic operations, so they can be recorded by
+ *  any thread without locking. They are published in the Diagnostics folder
+ *  of the OPC UA server.
+ */
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "open62541.h"
+
+#define DIAG_BUCKETS 24
+
+typedef struct {
+    char *name;                         // name of the OPC UA folder
+    UA_UInt64 count;                    // number of recorded durations
+    UA_UInt64 sum;                      // sum of all durations [us]
+    UA_UInt64 max;                      // longest duration [us]
+    UA_UInt64 bucket[DIAG_BUCKETS];     // number of durations per bucket
+} DiagHistogram;
+
+enum {
+    DIAG_MRI,
+    DIAG_MRV,
+    DIAG_MST,
+    DIAG_MWI,
+    DIAG_MWV,
+    DIAG_MRG,
+    DIAG_MWG,
+    DIAG_OTHER,             // any other device command
+    DIAG_DATASOURCE,
+    DIAG_UDPREPLY,
+    DIAG_UALOOP,
+    DIAG_HISTOGRAMS
+};
+
+enum {
+    DIAG_NAKREPLIES,        // the device answered #NAK
+    DIAG_MALFORMEDREPLIES,  // an answer could not be interpreted
+    DIAG_FAILEDREQUESTS,    // requests not exchanged because the link was down
+    DIAG_CACHEHITS,         // reads served from the cache
+    DIAG_CACHEMISSES,       // UDP requests that needed a device poll
+    DIAG_HEAPALLOCS,        // heap allocations of the OPC UA library
+    DIAG_POOLALLOCS,        // read values served from the scalar pool
+    DIAG_POOLEXHAUSTED,     // read values allocated from the heap because the pool was empty
+    DIAG_PUBLISHEDFRAMES,   // frames sent to the multicast group
+    DIAG_STREAMEDFRAMES,    // frames sent to UDP subscribers
+    DIAG_BUFFERPOOLEXHAUSTED,   // network buffers not available from the pool
+    DIAG_REFUSEDCONNECTIONS,    // OPC UA clients refused by the epoll network layer
+    DIAG_COUNTERS
+};
+
+extern DiagHistogram diagHistograms[DIAG_HISTOGRAMS];
+extern UA_UInt64 diagCounters[DIAG_COUNTERS];
+extern const char *diagCounterNames[DIAG_COUNTERS];
+
+// the histogram of a device command, e.g. "MRG:43\r\n" gives DIAG_MRG
+int DiagCommandType(const char *cmd);
+
+// record a duration [us]
+void DiagRecord(int histogram, UA_UInt64 duration);
+
+// record the time passed since start (obtained from UA_DateTime_nowMonotonic())
+// the duration is also appended to the event trace (see Trace.h)
+void DiagRecordSince(int histogram, UA_DateTime start);
+
+// the same with the status code and the argument of the trace record
+void DiagRecordStatus(int histogram, UA_DateTime start, UA_UInt32 status, UA_UInt32 arg);
+
+// increment a counter
+void DiagCount(int counter);
+
+// read a counter
+UA_UInt64 DiagCounter(int counter);
+
+// a consistent enough copy of a histogram for publishing
+void DiagHistogramGet(const DiagHistogram *h, DiagHistogram *copy);
+
+// the upper bound [us] of the bucket containing the given fraction of all durations
+UA_Double DiagPercentile(const DiagHistogram *h, UA_Double fraction);
+
+#endif
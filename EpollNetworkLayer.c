@@ -0,0 +1,397 @@
+/** @file EpollNetworkLayer.c
+ *
+ *  OPC UA server network layer based on epoll (Linux only)
+ */
+
+#define _GNU_SOURCE             // for accept4()
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "EpollNetworkLayer.h"
+#include "BufferPool.h"
+#include "Diagnostics.h"
+
+#define LISTEN_ID UINT32_MAX    // epoll data of the listening socket
+#define MAXBACKLOG 100
+#define SEND_TIMEOUT 1000       // [ms] a client not accepting data for this time is disconnected
+
+// the connection has to be the first member, the library only knows the connection
+typedef struct {
+    UA_Connection connection;
+    int used;                   // reserved until the server has released the connection
+    int detached;               // the socket is closed, waiting for the release
+    int ready;                  // in the list of connections to be read
+} Slot;
+
+typedef struct {
+    UA_ConnectionConfig conf;
+    UA_UInt16 port;
+    UA_Logger logger;           // set during start
+    int serversockfd;
+    int epfd;
+    unsigned int maxConnections;
+    unsigned int open;          // number of connections with an open socket
+    Slot *slots;
+    // the slots which may have data waiting (reported by epoll or not read completely)
+    unsigned int *ready;
+    unsigned int readyCount;
+    struct epoll_event events[EPOLL_EVENTS];
+} EpollLayer;
+
+// queue a slot for reading in this or the next getJobs()
+static void markReady(EpollLayer *layer, unsigned int index) {
+    if (layer->slots[index].ready || layer->slots[index].detached)
+        return;
+    layer->slots[index].ready = 1;
+    layer->ready[layer->readyCount++] = index;
+}
+
+/***********************************/
+/* connection callbacks            */
+/***********************************/
+
+// the buffers are taken from the pool if one has been allocated
+static UA_StatusCode allocBuffer(UA_ByteString *buf, size_t length, int reserve) {
+    if (BufferPoolEnabled())
+        return BufferPoolAlloc(buf, length, reserve);
+    return UA_ByteString_allocBuffer(buf, length);
+}
+
+static void freeBuffer(UA_ByteString *buf) {
+    if (BufferPoolEnabled())
+        BufferPoolRelease(buf);
+    else
+        UA_ByteString_deleteMembers(buf);
+}
+
+// the responses may use the buffers reserved in the pool
+static UA_StatusCode getSendBuffer(UA_Connection *connection, size_t length, UA_ByteString *buf) {
+    if (length > connection->remoteConf.recvBufferSize)
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    return allocBuffer(buf, length, 0);
+}
+
+static void releaseBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    freeBuffer(buf);
+}
+
+// called by the server, the socket is only shut down here
+// so the next read sees the connection closed and the slot is detached in getJobs()
+static void closeConnection(UA_Connection *connection) {
+    if (connection->state == UA_CONNECTION_CLOSED)
+        return;
+    connection->state = UA_CONNECTION_CLOSED;
+    EpollLayer *layer = connection->handle;
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK, "Closing the Connection %i",
+                connection->sockfd);
+    shutdown(connection->sockfd, SHUT_RDWR);
+    markReady(layer, (Slot *)connection - layer->slots);
+}
+
+// send a complete buffer, waiting for the socket to accept more data if necessary
+// the buffer is always released
+static UA_StatusCode sendBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    size_t written = 0;
+    while (written < buf->length) {
+        if (connection->state == UA_CONNECTION_CLOSED) {
+            freeBuffer(buf);
+            return UA_STATUSCODE_BADCONNECTIONCLOSED;
+        }
+        ssize_t n = send(connection->sockfd, buf->data+written, buf->length-written, MSG_NOSIGNAL);
+        if (n >= 0) {
+            written += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd pfd = { connection->sockfd, POLLOUT, 0 };
+            if (poll(&pfd, 1, SEND_TIMEOUT) > 0)
+                continue;
+        }
+        connection->close(connection);
+        freeBuffer(buf);
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+    }
+    freeBuffer(buf);
+    return UA_STATUSCODE_GOOD;
+}
+
+// run by the server when it has released the connection
+static void releaseSlot(UA_Server *server, void *ptr) {
+    UA_Connection_deleteMembers((UA_Connection *)ptr);
+    ((Slot *)ptr)->used = 0;
+}
+
+/***********************************/
+/* connection handling             */
+/***********************************/
+
+// accept all waiting clients (the listening socket is edge-triggered too)
+static void acceptConnections(EpollLayer *layer) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept4(layer->serversockfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+        unsigned int index = 0;
+        while (index < layer->maxConnections && layer->slots[index].used)
+            index++;
+        if (index == layer->maxConnections) {
+            UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                           "Refused a connection from %s:%d, all %u connection slots are in use",
+                           inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), layer->maxConnections);
+            DiagCount(DIAG_REFUSEDCONNECTIONS);
+            close(fd);
+            continue;
+        }
+        // every connection must be able to get a buffer besides the reserve
+        if (BufferPoolEnabled() && (layer->open + BUFFERPOOL_RESERVE >= BufferPoolCount()
+                || BufferPoolInUse() + BUFFERPOOL_RESERVE >= BufferPoolCount())) {
+            UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK,
+                           "Refused a connection from %s:%d, the buffer pool is exhausted",
+                           inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+            DiagCount(DIAG_REFUSEDCONNECTIONS);
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct epoll_event ev = { EPOLLIN|EPOLLRDHUP|EPOLLET, { .u32 = index } };
+        if (epoll_ctl(layer->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK, "Failed to register the Connection %i", fd);
+            close(fd);
+            continue;
+        }
+        UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK, "New Connection %i over TCP from %s:%d",
+                    fd, inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+        Slot *s = layer->slots+index;
+        UA_Connection *c = &s->connection;
+        UA_Connection_init(c);
+        c->sockfd = fd;
+        c->handle = layer;
+        c->localConf = layer->conf;
+        c->remoteConf = layer->conf;
+        c->send = sendBuffer;
+        c->close = closeConnection;
+        c->getSendBuffer = getSendBuffer;
+        c->releaseSendBuffer = releaseBuffer;
+        c->releaseRecvBuffer = releaseBuffer;
+        c->state = UA_CONNECTION_OPENING;
+        s->used = 1;
+        s->detached = 0;
+        s->ready = 0;
+        layer->open++;
+        // the client may have sent its hello before the registration
+        markReady(layer, index);
+    }
+}
+
+// close the socket and hand the connection back to the server (2 jobs)
+static size_t detachConnection(EpollLayer *layer, Slot *s, UA_Job *js) {
+    UA_Connection *c = &s->connection;
+    c->state = UA_CONNECTION_CLOSED;
+    epoll_ctl(layer->epfd, EPOLL_CTL_DEL, c->sockfd, NULL);
+    close(c->sockfd);
+    s->detached = 1;
+    layer->open--;
+    js[0].type = UA_JOBTYPE_DETACHCONNECTION;
+    js[0].job.closeConnection = c;
+    js[1].type = UA_JOBTYPE_METHODCALL_DELAYED;
+    js[1].job.methodCall.method = releaseSlot;
+    js[1].job.methodCall.data = c;
+    return 2;
+}
+
+// read up to EPOLL_READS_PER_CALL messages from a connection
+// at most EPOLL_READS_PER_CALL+1 jobs are created
+// return 1 if the socket has not been read until it was empty
+static int readConnection(EpollLayer *layer, Slot *s, UA_Job *js, size_t *count) {
+    UA_Connection *c = &s->connection;
+    for (int k=0; k<EPOLL_READS_PER_CALL; k++) {
+        // without a free buffer the connection is read in the next iteration
+        UA_ByteString buf;
+        if (allocBuffer(&buf, layer->conf.recvBufferSize, 1) != UA_STATUSCODE_GOOD)
+            return 1;
+        ssize_t n;
+        do
+            n = recv(c->sockfd, buf.data, buf.length, 0);
+        while (n < 0 && errno == EINTR);
+        if (n > 0) {
+            buf.length = n;
+            js[*count].type = UA_JOBTYPE_BINARYMESSAGE_NETWORKLAYER;
+            js[*count].job.binaryMessage.connection = c;
+            js[*count].job.binaryMessage.message = buf;
+            (*count)++;
+            continue;
+        }
+        freeBuffer(&buf);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        // closed by the client, by the server (after shutdown) or failed
+        *count += detachConnection(layer, s, js+*count);
+        return 0;
+    }
+    return 1;
+}
+
+/***********************************/
+/* network layer interface         */
+/***********************************/
+
+static UA_StatusCode EpollNetworkLayer_start(UA_ServerNetworkLayer *nl, UA_Logger logger) {
+    EpollLayer *layer = nl->handle;
+    layer->logger = logger;
+    // the discovery url from the hostname
+    char hostname[256];
+    if (gethostname(hostname, 255) == 0) {
+        char discoveryUrl[300];
+        UA_String du;
+        du.length = snprintf(discoveryUrl, sizeof(discoveryUrl), "opc.tcp://%s:%d", hostname, layer->port);
+        du.data = (UA_Byte *)discoveryUrl;
+        UA_String_copy(&du, &nl->discoveryUrl);
+    }
+    layer->serversockfd = socket(PF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (layer->serversockfd < 0) {
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK, "Error opening socket");
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    const struct sockaddr_in serv_addr =
+        { .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY,
+          .sin_port = htons(layer->port), .sin_zero = {0} };
+    int optval = 1;
+    if (setsockopt(layer->serversockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) != 0
+            || bind(layer->serversockfd, (const struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0
+            || listen(layer->serversockfd, MAXBACKLOG) != 0) {
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK, "Error during socket binding");
+        close(layer->serversockfd);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    layer->epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { EPOLLIN|EPOLLET, { .u32 = LISTEN_ID } };
+    if (layer->epfd < 0 || epoll_ctl(layer->epfd, EPOLL_CTL_ADD, layer->serversockfd, &ev) != 0) {
+        UA_LOG_WARNING(layer->logger, UA_LOGCATEGORY_NETWORK, "Error creating the epoll instance");
+        if (layer->epfd >= 0)
+            close(layer->epfd);
+        layer->epfd = -1;
+        close(layer->serversockfd);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                "epoll network layer listening on %.*s with %u connection slots",
+                (int)nl->discoveryUrl.length, nl->discoveryUrl.data, layer->maxConnections);
+    return UA_STATUSCODE_GOOD;
+}
+
+// timeout is given in ms, the layer does not wait while connections remain to be read
+static size_t EpollNetworkLayer_getJobs(UA_ServerNetworkLayer *nl, UA_Job **jobs, UA_UInt16 timeout) {
+    EpollLayer *layer = nl->handle;
+    *jobs = NULL;
+    int n = epoll_wait(layer->epfd, layer->events, EPOLL_EVENTS, layer->readyCount > 0 ? 0 : timeout);
+    for (int i=0; i<n; i++)
+        if (layer->events[i].data.u32 == LISTEN_ID)
+            acceptConnections(layer);
+        else
+            markReady(layer, layer->events[i].data.u32);
+    if (layer->readyCount == 0)
+        return 0;
+    UA_Job *js = malloc(sizeof(UA_Job) * layer->readyCount * (EPOLL_READS_PER_CALL+1));
+    if (js == NULL)
+        return 0;
+    // the slots not read until empty stay in the list
+    size_t count = 0;
+    unsigned int remaining = 0;
+    for (unsigned int i=0; i<layer->readyCount; i++) {
+        unsigned int index = layer->ready[i];
+        Slot *s = layer->slots+index;
+        if (readConnection(layer, s, js, &count) && !s->detached)
+            layer->ready[remaining++] = index;
+        else
+            s->ready = 0;
+    }
+    layer->readyCount = remaining;
+    if (count == 0) {
+        free(js);
+        return 0;
+    }
+    *jobs = js;
+    return count;
+}
+
+static size_t EpollNetworkLayer_stop(UA_ServerNetworkLayer *nl, UA_Job **jobs) {
+    EpollLayer *layer = nl->handle;
+    UA_LOG_INFO(layer->logger, UA_LOGCATEGORY_NETWORK,
+                "Shutting down the epoll network layer with %u open connection(s)", layer->open);
+    shutdown(layer->serversockfd, SHUT_RDWR);
+    close(layer->serversockfd);
+    *jobs = NULL;
+    UA_Job *js = malloc(sizeof(UA_Job) * (layer->open > 0 ? layer->open : 1) * 2);
+    if (js == NULL)
+        return 0;
+    size_t count = 0;
+    for (unsigned int i=0; i<layer->maxConnections; i++) {
+        Slot *s = layer->slots+i;
+        if (s->used && !s->detached) {
+            shutdown(s->connection.sockfd, SHUT_RDWR);
+            count += detachConnection(layer, s, js+count);
+        }
+    }
+    layer->readyCount = 0;
+    *jobs = js;
+    return count;
+}
+
+// run only when the server is stopped
+static void EpollNetworkLayer_deleteMembers(UA_ServerNetworkLayer *nl) {
+    EpollLayer *layer = nl->handle;
+    if (layer->epfd >= 0)
+        close(layer->epfd);
+    free(layer->slots);
+    free(layer->ready);
+    free(layer);
+    UA_String_deleteMembers(&nl->discoveryUrl);
+}
+
+UA_ServerNetworkLayer EpollNetworkLayer(UA_ConnectionConfig conf, UA_UInt16 port, unsigned int maxConnections) {
+    UA_ServerNetworkLayer nl;
+    memset(&nl, 0, sizeof(nl));
+    if (maxConnections == 0)
+        return nl;
+    EpollLayer *layer = calloc(1, sizeof(EpollLayer));
+    if (layer == NULL)
+        return nl;
+    layer->slots = calloc(maxConnections, sizeof(Slot));
+    layer->ready = calloc(maxConnections, sizeof(unsigned int));
+    if (layer->slots == NULL || layer->ready == NULL) {
+        free(layer->slots);
+        free(layer->ready);
+        free(layer);
+        return nl;
+    }
+    layer->conf = conf;
+    layer->port = port;
+    layer->maxConnections = maxConnections;
+    layer->serversockfd = -1;
+    layer->epfd = -1;
+    nl.handle = layer;
+    nl.start = EpollNetworkLayer_start;
+    nl.getJobs = EpollNetworkLayer_getJobs;
+    nl.stop = EpollNetworkLayer_stop;
+    nl.deleteMembers = EpollNetworkLayer_deleteMembers;
+    return nl;
+}
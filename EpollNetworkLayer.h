@@ -0,0 +1,44 @@
+/** @file EpollNetworkLayer.h
+ *
+ *  OPC UA server network layer based on epoll (Linux only)
+ *
+ *  The TCP network layer of the library rebuilds an fd_set and calls select()
+ *  for all connections in every iteration of the server loop, so its cost grows
+ *  with the number of clients and the number of sockets is limited by FD_SETSIZE.
+ *  This layer registers every socket once with an epoll instance
+ *  and only handles the sockets reported ready.
+ *
+ *  The sockets are registered edge-triggered, a ready socket is read until
+ *  the kernel buffer is empty. To be fair to the other clients, at most
+ *  EPOLL_READS_PER_CALL messages are read from one connection per iteration,
+ *  the rest is read in the next one (without waiting).
+ *
+ *  The connections are kept in a flat array of maxConnections slots allocated
+ *  when the layer is created. The slot stays reserved until the server has released
+ *  the connection, clients beyond maxConnections are refused right after accept().
+ *  The slot index is stored with the epoll registration.
+ *
+ *  If a buffer pool has been allocated (see BufferPool.h), the receive and send
+ *  buffers are taken from it and new clients are refused when the pool cannot
+ *  serve another connection.
+ *
+ *  Selected by <opcua port="16664" network="epoll" connections="64"/>
+ *  in the configuration file, the default is the select() layer of the library.
+ *  The layer is only used by the single server thread.
+ */
+
+#ifndef EPOLLNETWORKLAYER_H
+#define EPOLLNETWORKLAYER_H
+
+#include "open62541.h"
+
+#define EPOLL_DEFAULT_CONNECTIONS 64    // default number of connection slots
+#define EPOLL_READS_PER_CALL 4          // messages read from one connection per iteration
+#define EPOLL_EVENTS 64                 // events handled per epoll_wait()
+
+// create the network layer listening at port
+// with room for up to maxConnections simultaneous client connections
+// on failure the handle of the returned layer is NULL
+UA_ServerNetworkLayer EpollNetworkLayer(UA_ConnectionConfig conf, UA_UInt16 port, unsigned int maxConnections);
+
+#endif
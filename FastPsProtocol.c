@@ -0,0 +1,249 @@
+/** @file FastPsProtocol.c
+ *
+ *  Parsing and formatting of the FAST-PS ASCII protocol
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "FastPsProtocol.h"
+
+/***********************************/
+/* parsing                         */
+/***********************************/
+
+// powers of ten which are exactly representable as double
+static const double pow10tab[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// check the prefix of a reply, return a pointer behind it or NULL
+static const char *skipPrefix(const char *reply, const char *prefix) {
+    while (*prefix)
+        if (*reply++ != *prefix++)
+            return NULL;
+    return reply;
+}
+
+// only whitespace may follow a parsed value
+static int atEnd(const char *p) {
+    while (*p==' ' || *p=='\t' || *p=='\r' || *p=='\n')
+        p++;
+    return *p=='\0';
+}
+
+// parse a decimal number [+-]ddd[.ddd][(e|E)[+-]dd] with optional leading blanks
+// the digits are accumulated in a 64-bit integer and scaled by a power of ten only once,
+// for up to 15 significant digits this gives the correctly rounded result
+// return a pointer behind the number or NULL if there is no valid number
+static const char *parseNumber(const char *p, double *value) {
+    while (*p==' ')
+        p++;
+    int negative = 0;
+    if (*p=='+' || *p=='-')
+        negative = (*p++=='-');
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; *p>='0' && *p<='9'; p++, digits++) {
+        if (mantissa < 100000000000000000ULL)
+            mantissa = 10*mantissa + (*p-'0');
+        else
+            exponent++;         // further digits are beyond the double precision
+    }
+    if (*p=='.')
+        for (p++; *p>='0' && *p<='9'; p++, digits++) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = 10*mantissa + (*p-'0');
+                exponent--;
+            }
+        }
+    if (digits==0)
+        return NULL;
+    if (*p=='e' || *p=='E') {
+        const char *q = p+1;
+        int expNegative = 0;
+        if (*q=='+' || *q=='-')
+            expNegative = (*q++=='-');
+        if (*q>='0' && *q<='9') {
+            int e = 0;
+            for (; *q>='0' && *q<='9'; q++)
+                if (e < 1000)
+                    e = 10*e + (*q-'0');
+            exponent += expNegative ? -e : e;
+            p = q;
+        }
+    }
+    double v = (double)mantissa;
+    while (exponent > 22) {
+        v *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22) {
+        v /= 1e22;
+        exponent += 22;
+    }
+    if (exponent >= 0)
+        v *= pow10tab[exponent];
+    else
+        v /= pow10tab[-exponent];
+    *value = negative ? -v : v;
+    return p;
+}
+
+// parse an unsigned decimal integer
+static const char *parseUnsigned(const char *p, unsigned int *value) {
+    unsigned int v = 0;
+    const char *start = p;
+    for (; *p>='0' && *p<='9'; p++)
+        v = 10*v + (*p-'0');
+    if (p==start)
+        return NULL;
+    *value = v;
+    return p;
+}
+
+int FastPsParseDouble(const char *reply, const char *prefix, double *value) {
+    double v;
+    const char *p = skipPrefix(reply, prefix);
+    if (p==NULL || (p = parseNumber(p, &v))==NULL || !atEnd(p))
+        return 0;
+    *value = v;
+    return 1;
+}
+
+int FastPsParseWord(const char *reply, const char *prefix, unsigned int *value) {
+    const char *p = skipPrefix(reply, prefix);
+    if (p==NULL)
+        return 0;
+    unsigned int v = 0;
+    int digits = 0;
+    for (;; p++, digits++) {
+        unsigned int d;
+        if (*p>='0' && *p<='9')
+            d = *p-'0';
+        else if (*p>='a' && *p<='f')
+            d = *p-'a'+10;
+        else if (*p>='A' && *p<='F')
+            d = *p-'A'+10;
+        else
+            break;
+        v = (v<<4) | d;
+    }
+    if (digits==0 || digits>8 || !atEnd(p))
+        return 0;
+    *value = v;
+    return 1;
+}
+
+int FastPsParseRegister(const char *reply, unsigned int reg, double *value) {
+    unsigned int number;
+    double v;
+    const char *p = skipPrefix(reply, "#MRG:");
+    if (p==NULL || (p = parseUnsigned(p, &number))==NULL || number!=reg || *p++!=':')
+        return 0;
+    if ((p = parseNumber(p, &v))==NULL || !atEnd(p))
+        return 0;
+    *value = v;
+    return 1;
+}
+
+int FastPsParseUpmode(const char *reply, int *sfp) {
+    const char *p = skipPrefix(reply, "#UPMODE:");
+    if (p==NULL)
+        return 0;
+    if (skipPrefix(p, "SFP") && atEnd(p+3)) {
+        *sfp = 1;
+        return 1;
+    }
+    if (skipPrefix(p, "NORMAL") && atEnd(p+6)) {
+        *sfp = 0;
+        return 1;
+    }
+    return 0;
+}
+
+int FastPsIsAck(const char *reply) {
+    return skipPrefix(reply, "#AK") != NULL;
+}
+
+int FastPsIsNak(const char *reply) {
+    return skipPrefix(reply, "#NAK") != NULL;
+}
+
+/***********************************/
+/* formatting                      */
+/***********************************/
+
+// write an unsigned integer, return a pointer behind the last digit
+static char *formatUnsigned(char *p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v%10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// write a value with 6 decimals padded with blanks to a minimum width
+// return a pointer behind the last character, NULL if the value cannot be represented
+static char *formatFixed6(char *p, double value, int width) {
+    // also rejects NaN, as all comparisons with NaN are false
+    if (!(value > -1e12 && value < 1e12))
+        return NULL;
+    int negative = value < 0;
+    uint64_t scaled = (uint64_t)((negative ? -value : value) * 1e6 + 0.5);
+    char number[24];
+    char *q = number;
+    if (negative)
+        *q++ = '-';
+    q = formatUnsigned(q, scaled / 1000000);
+    *q++ = '.';
+    uint64_t fraction = scaled % 1000000;
+    for (uint64_t div = 100000; div; div /= 10)
+        *q++ = '0' + (fraction / div) % 10;
+    int len = q - number;
+    for (; width > len; width--)
+        *p++ = ' ';
+    memcpy(p, number, len);
+    return p+len;
+}
+
+int FastPsFormatSetpoint(char *cmd, const char *name, double value) {
+    char *p = cmd;
+    while (*name)
+        *p++ = *name++;
+    *p++ = ':';
+    if ((p = formatFixed6(p, value, 9)) == NULL)
+        return 0;
+    *p++ = '\r';
+    *p++ = '\n';
+    *p = '\0';
+    return p-cmd;
+}
+
+int FastPsFormatRegisterWrite(char *cmd, unsigned int reg, double value) {
+    char *p = cmd;
+    memcpy(p, "MWG:", 4);
+    p = formatUnsigned(p+4, reg);
+    *p++ = ':';
+    if ((p = formatFixed6(p, value, 0)) == NULL)
+        return 0;
+    *p++ = '\r';
+    *p++ = '\n';
+    *p = '\0';
+    return p-cmd;
+}
+
+int FastPsFormatRegisterRead(char *cmd, unsigned int reg) {
+    char *p = cmd;
+    memcpy(p, "MRG:", 4);
+    p = formatUnsigned(p+4, reg);
+    *p++ = '\r';
+    *p++ = '\n';
+    *p = '\0';
+    return p-cmd;
+}
@@ -0,0 +1,59 @@
+/** @file FastPsProtocol.h
+ *
+ *  Parsing and formatting of the FAST-PS ASCII protocol
+ *
+ *  The device answers requests with lines like
+ *  - #MRI:1.234567
+ *  - #MST:0000a001
+ *  - #MRG:43:0.250000
+ *  - #UPMODE:SFP
+ *  - #AK or #NAK:13
+ *
+ *  These routines replace the sscanf()/sprintf() calls of the read/write
+ *  callbacks. They do not depend on the locale, do not allocate memory
+ *  and check the prefix of every answer before the value is interpreted.
+ *
+ *  All parse functions return 1 if the reply was valid and the value has been
+ *  stored, 0 if the reply did not match the expected format (the value is not modified).
+ *  All format functions return the length of the generated command string
+ *  (including the \r\n termination), 0 if the value cannot be represented.
+ *  The command buffer must provide at least FASTPS_CMDSIZE characters.
+ */
+
+#ifndef FASTPSPROTOCOL_H
+#define FASTPSPROTOCOL_H
+
+#define FASTPS_CMDSIZE 40       // buffer size sufficient for any formatted command
+
+// a floating point readback, e.g. prefix "#MRI:"
+int FastPsParseDouble(const char *reply, const char *prefix, double *value);
+
+// a hexadecimal word, e.g. prefix "#MST:"
+int FastPsParseWord(const char *reply, const char *prefix, unsigned int *value);
+
+// a register readback #MRG:nn:value
+// the register number in the reply has to match the requested one
+int FastPsParseRegister(const char *reply, unsigned int reg, double *value);
+
+// the update mode #UPMODE:SFP or #UPMODE:NORMAL
+// sfp is set to 1 for the SFP mode, 0 otherwise
+int FastPsParseUpmode(const char *reply, int *sfp);
+
+// the command acknowledge #AK
+int FastPsIsAck(const char *reply);
+
+// a refused command #NAK:nn
+int FastPsIsNak(const char *reply);
+
+// a setpoint command, e.g. name "MWI" gives "MWI: 1.500000\r\n"
+// the value is written with 6 decimals and a minimum width of 9 characters
+// (identical to the former "%9.6f" format)
+int FastPsFormatSetpoint(char *cmd, const char *name, double value);
+
+// write a register, "MWG:nn:value\r\n"
+int FastPsFormatRegisterWrite(char *cmd, unsigned int reg, double value);
+
+// read a register, "MRG:nn\r\n"
+int FastPsFormatRegisterRead(char *cmd, unsigned int reg);
+
+#endif
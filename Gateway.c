@@ -0,0 +1,617 @@
+/** @file Gateway.c
+ *
+ *  Gateway to additional FAST-PS units over the network
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "Gateway.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+
+#define GATEWAY_RXSIZE 1024                     // receive buffer of a unit
+#define GATEWAY_TXSIZE (GATEWAY_PENDING*BUFSIZE) // sufficient for all outstanding commands
+#define GATEWAY_POLLMAX (GATEWAY_PENDING/2)     // commands of one poll (readbacks and uncached registers)
+
+// the kinds of commands sent to a unit
+enum {
+    GATEWAY_READBACK,           // a readback of the cache list
+    GATEWAY_REGREAD,            // MRG
+    GATEWAY_SETPOINT,           // MWI/MWV
+    GATEWAY_REGWRITE,           // MWG
+    GATEWAY_COMMAND             // MON/MOFF
+};
+
+// a command sent to a unit and not yet answered
+typedef struct {
+    int kind;
+    UA_UInt32 index;            // readback or register index
+    UA_Double value;            // the value sent with a write
+    UA_DateTime sent;           // monotonic time of the send
+} GatewayPending;
+
+// a write queued by the OPC UA thread
+typedef struct {
+    int kind;
+    UA_UInt32 index;
+    char cmd[FASTPS_CMDSIZE];
+} GatewayWriteCmd;
+
+typedef struct {
+    GatewayUnitConfig config;
+    struct sockaddr_in addr;
+    // the connection, only used by the gateway thread
+    int sock;                   // -1 if not connected
+    int connecting;             // the non-blocking connect() has not completed
+    UA_DateTime connectStart;
+    unsigned int retryDelay;    // delay before the next attempt [ms]
+    UA_DateTime nextRetry;
+    char rx[GATEWAY_RXSIZE];
+    unsigned int rxlen;
+    char tx[GATEWAY_TXSIZE];
+    unsigned int txlen;
+    GatewayPending pending[GATEWAY_PENDING];
+    unsigned int pendHead, pendTail;            // free-running counters
+    unsigned int pollOutstanding;               // unanswered commands of the last poll
+    unsigned int refreshOutstanding;            // unanswered commands of the register refresh
+    UA_DateTime nextPoll;
+    UA_DateTime nextRefresh;                    // 0 if no refresh is due
+    UA_UInt32 refreshIndex;                     // next register of a running refresh
+    UA_UInt32 pollIndex;                        // register the next poll continues with
+    int refreshing;
+    // shared with the OPC UA thread (protected by the lock)
+    volatile int up;
+    GatewayWriteCmd outbox[GATEWAY_OUTBOX];
+    unsigned int outHead, outTail;
+    CacheValue readback[CACHE_SIZE];
+    CacheValue *registers;
+    // the node handles
+    GatewayPoint readbackPoints[CACHE_SIZE];
+    GatewayPoint *registerPoints;
+} GatewayUnit;
+
+static GatewayUnit *units = NULL;
+static UA_UInt32 unitCount = 0;
+static RegisterEntry *regTable = NULL;
+static UA_UInt32 regCount = 0;
+static UA_DateTime pollPeriod;
+static UA_DateTime refreshPeriod;               // 0 = only at connect
+
+static pthread_mutex_t gatewayLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t gatewayThread;
+static volatile int gatewayRunning = 0;
+// written by the OPC UA thread to wake up the event loop for queued writes
+static int wakePipe[2] = { -1, -1 };
+
+#define NOVALUE (CacheValue){ 0.0, 0, 0, UA_STATUSCODE_BADWAITINGFORINITIALDATA }
+
+/***********************************/
+/* values                          */
+/***********************************/
+
+// the last value is kept with uncertain quality if it could not be obtained
+// values never obtained are reported as communication error (called with the lock held)
+static void valueFailed(CacheValue *v, UA_StatusCode never) {
+    if (v->timestamp != 0)
+        v->status = UA_STATUSCODE_UNCERTAINLASTUSABLEVALUE;
+    else
+        v->status = never;
+}
+
+static void valueStore(CacheValue *v, UA_Double value, UA_DateTime now) {
+    v->value = value;
+    v->timestamp = now;
+    v->status = UA_STATUSCODE_GOOD;
+}
+
+// evaluate the answer to a command (called with the lock held)
+static void evaluate(GatewayUnit *u, const GatewayPending *p, const char *reply, UA_DateTime now) {
+    CacheValue *v;
+    double value;
+    switch (p->kind) {
+        case GATEWAY_READBACK:
+            v = u->readback + p->index;
+            if (cache[p->index].isWord) {
+                unsigned int word;
+                if (FastPsParseWord(reply, cache[p->index].prefix, &word)) {
+                    v->word = word;
+                    valueStore(v, v->value, now);
+                } else
+                    valueFailed(v, v->status);
+            } else if (FastPsParseDouble(reply, cache[p->index].prefix, &value))
+                valueStore(v, value, now);
+            else
+                valueFailed(v, v->status);
+            break;
+        case GATEWAY_REGREAD:
+            v = u->registers + p->index;
+            if (FastPsParseRegister(reply, regTable[p->index].number, &value))
+                valueStore(v, value, now);
+            else
+                valueFailed(v, UA_STATUSCODE_BADCOMMUNICATIONERROR);
+            break;
+        // acknowledged writes are stored at once
+        case GATEWAY_SETPOINT:
+            if (FastPsIsAck(reply))
+                valueStore(u->readback + p->index, p->value, now);
+            break;
+        case GATEWAY_REGWRITE:
+            if (FastPsIsAck(reply))
+                valueStore(u->registers + p->index, p->value, now);
+            break;
+    }
+}
+
+/***********************************/
+/* connection management           */
+/***********************************/
+
+// close the connection, the next attempt is made at once (gateway thread only)
+static void unitFailed(GatewayUnit *u, UA_DateTime now) {
+    int wasUp = u->up;
+    if (u->sock >= 0)
+        close(u->sock);
+    u->sock = -1;
+    u->connecting = 0;
+    u->rxlen = u->txlen = 0;
+    u->pendHead = u->pendTail = 0;
+    u->pollOutstanding = u->refreshOutstanding = 0;
+    u->refreshing = 0;
+    pthread_mutex_lock(&gatewayLock);
+    u->up = 0;
+    // queued writes are dropped with the connection
+    u->outHead = u->outTail = 0;
+    for (int i=0; i<CACHE_SIZE; i++)
+        valueFailed(u->readback+i, UA_STATUSCODE_BADCOMMUNICATIONERROR);
+    for (UA_UInt32 i=0; i<regCount; i++)
+        valueFailed(u->registers+i, UA_STATUSCODE_BADCOMMUNICATIONERROR);
+    pthread_mutex_unlock(&gatewayLock);
+    if (wasUp) {
+        u->retryDelay = DEVICE_RETRY_MIN;
+        u->nextRetry = now;
+        printf("Gateway : lost connection to %s\n", u->config.name);
+        fflush(stdout);
+    }
+}
+
+// an attempt failed, the delay grows up to DEVICE_RETRY_MAX
+static void connectFailed(GatewayUnit *u, UA_DateTime now) {
+    unitFailed(u, now);
+    u->nextRetry = now + u->retryDelay*UA_MSEC_TO_DATETIME;
+    u->retryDelay *= 2;
+    if (u->retryDelay > DEVICE_RETRY_MAX)
+        u->retryDelay = DEVICE_RETRY_MAX;
+}
+
+// the connection has been established
+static void unitConnected(GatewayUnit *u, UA_DateTime now) {
+    u->connecting = 0;
+    pthread_mutex_lock(&gatewayLock);
+    u->up = 1;
+    pthread_mutex_unlock(&gatewayLock);
+    // poll at once and read all registers
+    u->nextPoll = now;
+    u->nextRefresh = now;
+    printf("Gateway : connected to %s at %s:%u\n", u->config.name, u->config.host, u->config.port);
+    fflush(stdout);
+}
+
+// start a non-blocking connect()
+static void startConnect(GatewayUnit *u, UA_DateTime now) {
+    u->sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (u->sock < 0 || fcntl(u->sock, F_SETFL, O_NONBLOCK) != 0) {
+        connectFailed(u, now);
+        return;
+    }
+    u->connectStart = now;
+    if (connect(u->sock, (struct sockaddr *)&u->addr, sizeof(u->addr)) == 0)
+        unitConnected(u, now);
+    else if (errno == EINPROGRESS)
+        u->connecting = 1;
+    else
+        connectFailed(u, now);
+}
+
+/***********************************/
+/* command pipeline                */
+/***********************************/
+
+static unsigned int pendingFree(const GatewayUnit *u) {
+    return GATEWAY_PENDING - (u->pendHead - u->pendTail);
+}
+
+// append a command to the transmit buffer and remember it as outstanding
+static void sendCommand(GatewayUnit *u, int kind, UA_UInt32 index, const char *cmd, UA_DateTime now) {
+    unsigned int len = strlen(cmd);
+    memcpy(u->tx+u->txlen, cmd, len);
+    u->txlen += len;
+    GatewayPending *p = u->pending + u->pendHead%GATEWAY_PENDING;
+    p->kind = kind;
+    p->index = index;
+    p->sent = now;
+    // the value as sent to the unit (behind "MWI:" or "MWG:nn:")
+    if (kind == GATEWAY_SETPOINT)
+        p->value = strtod(cmd+4, NULL);
+    else if (kind == GATEWAY_REGWRITE)
+        p->value = strtod(strchr(cmd+4, ':')+1, NULL);
+    u->pendHead++;
+}
+
+// the readbacks and the uncached registers, all in one batch
+// more uncached registers than fit into a batch are read in turns,
+// every poll continues with the register following the last one read
+static void sendPoll(GatewayUnit *u, UA_DateTime now) {
+    for (int i=0; i<CACHE_SIZE; i++)
+        sendCommand(u, GATEWAY_READBACK, i, cache[i].command, now);
+    u->pollOutstanding = CACHE_SIZE;
+    char cmd[FASTPS_CMDSIZE];
+    for (UA_UInt32 k=0; k<regCount && u->pollOutstanding<GATEWAY_POLLMAX; k++) {
+        UA_UInt32 i = (u->pollIndex+k) % regCount;
+        if (regTable[i].policy == REGISTER_NOCACHE) {
+            FastPsFormatRegisterRead(cmd, regTable[i].number);
+            sendCommand(u, GATEWAY_REGREAD, i, cmd, now);
+            u->pollOutstanding++;
+            u->pollIndex = (i+1) % regCount;
+        }
+    }
+}
+
+// the next batch of a register refresh
+// static registers are only read until a value has been obtained
+static void sendRefresh(GatewayUnit *u, UA_DateTime now) {
+    char cmd[FASTPS_CMDSIZE];
+    while (u->refreshIndex < regCount && u->refreshOutstanding < MAXQUEUE) {
+        UA_UInt32 i = u->refreshIndex++;
+        if (regTable[i].policy == REGISTER_NOCACHE)
+            continue;
+        if (regTable[i].policy == REGISTER_STATIC && u->registers[i].status == UA_STATUSCODE_GOOD)
+            continue;
+        FastPsFormatRegisterRead(cmd, regTable[i].number);
+        sendCommand(u, GATEWAY_REGREAD, i, cmd, now);
+        u->refreshOutstanding++;
+    }
+    if (u->refreshIndex >= regCount)
+        u->refreshing = 0;
+}
+
+// the regular work of a connected unit
+static void schedule(GatewayUnit *u, UA_DateTime now) {
+    // the writes queued by the OPC UA thread go first
+    pthread_mutex_lock(&gatewayLock);
+    while (u->outTail != u->outHead && pendingFree(u) > 0) {
+        GatewayWriteCmd *w = u->outbox + u->outTail%GATEWAY_OUTBOX;
+        sendCommand(u, w->kind, w->index, w->cmd, now);
+        u->outTail++;
+    }
+    pthread_mutex_unlock(&gatewayLock);
+    // a new poll is only sent when the previous one has been answered,
+    // otherwise the poll is skipped, the schedule stays fixed
+    if (now >= u->nextPoll) {
+        if (u->pollOutstanding == 0 && pendingFree(u) >= GATEWAY_POLLMAX)
+            sendPoll(u, now);
+        while (u->nextPoll <= now)
+            u->nextPoll += pollPeriod;
+    }
+    if (u->nextRefresh != 0 && now >= u->nextRefresh && !u->refreshing) {
+        u->refreshing = 1;
+        u->refreshIndex = 0;
+        u->nextRefresh = refreshPeriod != 0 ? now + refreshPeriod : 0;
+    }
+    if (u->refreshing && u->refreshOutstanding == 0 && pendingFree(u) >= GATEWAY_POLLMAX + MAXQUEUE)
+        sendRefresh(u, now);
+}
+
+// send as much of the transmit buffer as the socket accepts
+static int flushTx(GatewayUnit *u) {
+    while (u->txlen > 0) {
+        // a connection closed by the unit must not raise SIGPIPE
+        int n = send(u->sock, u->tx, u->txlen, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+        if (n <= 0)
+            return 0;
+        memmove(u->tx, u->tx+n, u->txlen-n);
+        u->txlen -= n;
+    }
+    return 1;
+}
+
+// receive and evaluate all complete lines
+// every line answers the oldest outstanding command
+// return 0 if the connection has failed
+static int receive(GatewayUnit *u) {
+    int n = recv(u->sock, u->rx+u->rxlen, GATEWAY_RXSIZE-u->rxlen, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 1;
+    if (n <= 0)
+        return 0;
+    u->rxlen += n;
+    UA_DateTime now = UA_DateTime_now();
+    unsigned int start = 0;
+    pthread_mutex_lock(&gatewayLock);
+    for (unsigned int i=0; i+1<u->rxlen; i++)
+        if (u->rx[i]=='\r' && u->rx[i+1]=='\n') {
+            char line[BUFSIZE];
+            unsigned int len = i-start < BUFSIZE-1 ? i-start : BUFSIZE-1;
+            memcpy(line, u->rx+start, len);
+            line[len] = '\0';
+            start = i+2;
+            i++;
+            // an answer nobody asked for
+            if (u->pendTail == u->pendHead)
+                continue;
+            GatewayPending *p = u->pending + u->pendTail%GATEWAY_PENDING;
+            evaluate(u, p, line, now);
+            if (p->kind == GATEWAY_READBACK || (p->kind == GATEWAY_REGREAD && regTable[p->index].policy == REGISTER_NOCACHE))
+                u->pollOutstanding--;
+            else if (p->kind == GATEWAY_REGREAD)
+                u->refreshOutstanding--;
+            u->pendTail++;
+        }
+    pthread_mutex_unlock(&gatewayLock);
+    // a line filling the whole buffer cannot be framed, it is dropped
+    if (start == 0 && u->rxlen == GATEWAY_RXSIZE)
+        start = u->rxlen;
+    memmove(u->rx, u->rx+start, u->rxlen-start);
+    u->rxlen -= start;
+    return 1;
+}
+
+/***********************************/
+/* event loop                      */
+/***********************************/
+
+static void *gatewayLoop(void *arg) {
+    struct pollfd *fds = malloc((unitCount+1)*sizeof(struct pollfd));
+    GatewayUnit **polled = malloc((unitCount+1)*sizeof(GatewayUnit *));
+    UA_DateTime timeout = DEVICE_RXTIMEOUT*UA_MSEC_TO_DATETIME;
+    while (gatewayRunning) {
+        UA_DateTime now = UA_DateTime_nowMonotonic();
+        // the time until the next scheduled action of any unit
+        UA_DateTime next = now + 200*UA_MSEC_TO_DATETIME;
+        fds[0] = (struct pollfd){ wakePipe[0], POLLIN, 0 };
+        unsigned int nfds = 1;
+        for (UA_UInt32 i=0; i<unitCount; i++) {
+            GatewayUnit *u = units+i;
+            if (u->sock < 0 && now >= u->nextRetry)
+                startConnect(u, now);
+            if (u->sock < 0) {
+                if (u->nextRetry < next)
+                    next = u->nextRetry;
+                continue;
+            }
+            if (u->connecting) {
+                if (now - u->connectStart > timeout) {
+                    connectFailed(u, now);
+                    continue;
+                }
+                if (u->connectStart + timeout < next)
+                    next = u->connectStart + timeout;
+            } else {
+                schedule(u, now);
+                // a unit not answering is treated like a lost connection
+                if (u->pendTail != u->pendHead) {
+                    UA_DateTime oldest = u->pending[u->pendTail%GATEWAY_PENDING].sent;
+                    if (now - oldest > timeout) {
+                        unitFailed(u, now);
+                        continue;
+                    }
+                    if (oldest + timeout < next)
+                        next = oldest + timeout;
+                }
+                if (u->nextPoll < next)
+                    next = u->nextPoll;
+                if (u->nextRefresh != 0 && u->nextRefresh < next)
+                    next = u->nextRefresh;
+            }
+            short events = POLLIN;
+            if (u->connecting || u->txlen > 0)
+                events = u->connecting ? POLLOUT : POLLIN|POLLOUT;
+            fds[nfds] = (struct pollfd){ u->sock, events, 0 };
+            polled[nfds++] = u;
+        }
+        int wait = next > now ? (int)((next-now+UA_MSEC_TO_DATETIME-1)/UA_MSEC_TO_DATETIME) : 0;
+        if (poll(fds, nfds, wait) <= 0)
+            continue;
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wakePipe[0], drain, sizeof(drain)) > 0);
+        }
+        now = UA_DateTime_nowMonotonic();
+        for (unsigned int k=1; k<nfds; k++) {
+            GatewayUnit *u = polled[k];
+            short revents = fds[k].revents;
+            if (revents == 0)
+                continue;
+            if (u->connecting) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (getsockopt(u->sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+                    connectFailed(u, now);
+                else
+                    unitConnected(u, now);
+                continue;
+            }
+            int ok = !(revents & (POLLERR|POLLNVAL));
+            if (ok && (revents & (POLLIN|POLLHUP)))
+                ok = receive(u);
+            if (ok && (revents & POLLOUT))
+                ok = flushTx(u);
+            if (!ok)
+                unitFailed(u, now);
+        }
+    }
+    free(fds);
+    free(polled);
+    return NULL;
+}
+
+// wake up the event loop (any thread)
+static void wakeup() {
+    char c = 0;
+    if (write(wakePipe[1], &c, 1) < 0) {
+        // the pipe is full, the loop is going to wake up anyway
+    }
+}
+
+/***********************************/
+/* interface                       */
+/***********************************/
+
+int GatewayStart(const GatewayUnitConfig *configs, UA_UInt32 count,
+        const RegisterEntry *registers, UA_UInt32 registerCount, UA_UInt32 interval, UA_UInt32 refresh) {
+    units = calloc(count, sizeof(GatewayUnit));
+    regTable = malloc((registerCount ? registerCount : 1)*sizeof(RegisterEntry));
+    if (units == NULL || regTable == NULL)
+        return -1;
+    memcpy(regTable, registers, registerCount*sizeof(RegisterEntry));
+    regCount = registerCount;
+    UA_UInt32 uncached = 0;
+    for (UA_UInt32 k=0; k<registerCount; k++)
+        if (registers[k].policy == REGISTER_NOCACHE)
+            uncached++;
+    if (uncached > GATEWAY_POLLMAX-CACHE_SIZE)
+        printf("Gateway : %u uncached registers, read in turns of %u per poll\n",
+            uncached, GATEWAY_POLLMAX-CACHE_SIZE);
+    unitCount = count;
+    pollPeriod = interval*UA_MSEC_TO_DATETIME;
+    refreshPeriod = refresh*UA_MSEC_TO_DATETIME;
+    UA_DateTime now = UA_DateTime_nowMonotonic();
+    for (UA_UInt32 i=0; i<count; i++) {
+        GatewayUnit *u = units+i;
+        u->config = configs[i];
+        memset(&u->addr, 0, sizeof(u->addr));
+        u->addr.sin_family = AF_INET;
+        if (inet_pton(AF_INET, u->config.host, &u->addr.sin_addr) != 1)
+            return -1;
+        u->addr.sin_port = htons(u->config.port);
+        u->sock = -1;
+        u->retryDelay = DEVICE_RETRY_MIN;
+        u->nextRetry = now;
+        u->registers = malloc((registerCount ? registerCount : 1)*sizeof(CacheValue));
+        u->registerPoints = malloc((registerCount ? registerCount : 1)*sizeof(GatewayPoint));
+        if (u->registers == NULL || u->registerPoints == NULL)
+            return -1;
+        for (int k=0; k<CACHE_SIZE; k++) {
+            u->readback[k] = NOVALUE;
+            u->readbackPoints[k] = (GatewayPoint){ i, k, 0 };
+        }
+        for (UA_UInt32 k=0; k<registerCount; k++) {
+            u->registers[k] = NOVALUE;
+            u->registerPoints[k] = (GatewayPoint){ i, k, 1 };
+        }
+    }
+    if (pipe(wakePipe) != 0)
+        return -1;
+    fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+    gatewayRunning = 1;
+    if (pthread_create(&gatewayThread, NULL, gatewayLoop, NULL) != 0) {
+        gatewayRunning = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void GatewayStop() {
+    if (!gatewayRunning)
+        return;
+    gatewayRunning = 0;
+    wakeup();
+    pthread_join(gatewayThread, NULL);
+    for (UA_UInt32 i=0; i<unitCount; i++) {
+        if (units[i].sock >= 0)
+            close(units[i].sock);
+        free(units[i].registers);
+        free(units[i].registerPoints);
+    }
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    free(units);
+    free(regTable);
+    units = NULL;
+    unitCount = 0;
+}
+
+UA_UInt32 GatewayUnits() {
+    return unitCount;
+}
+
+const GatewayPoint *GatewayReadback(UA_UInt32 unit, int index) {
+    return units[unit].readbackPoints + index;
+}
+
+const GatewayPoint *GatewayRegister(UA_UInt32 unit, UA_UInt32 index) {
+    return units[unit].registerPoints + index;
+}
+
+const RegisterEntry *GatewayRegisterInfo(UA_UInt32 index) {
+    return regTable + index;
+}
+
+CacheValue GatewayGet(const GatewayPoint *point) {
+    GatewayUnit *u = units + point->unit;
+    pthread_mutex_lock(&gatewayLock);
+    CacheValue v = point->isRegister ? u->registers[point->index] : u->readback[point->index];
+    pthread_mutex_unlock(&gatewayLock);
+    return v;
+}
+
+// queue a command for the gateway thread
+static UA_StatusCode post(GatewayUnit *u, int kind, UA_UInt32 index, const char *cmd) {
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    pthread_mutex_lock(&gatewayLock);
+    if (!u->up)
+        retval = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    else if (u->outHead - u->outTail >= GATEWAY_OUTBOX)
+        retval = UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+    else {
+        GatewayWriteCmd *w = u->outbox + u->outHead%GATEWAY_OUTBOX;
+        w->kind = kind;
+        w->index = index;
+        strcpy(w->cmd, cmd);
+        u->outHead++;
+    }
+    pthread_mutex_unlock(&gatewayLock);
+    if (retval == UA_STATUSCODE_GOOD)
+        wakeup();
+    return retval;
+}
+
+UA_StatusCode GatewayWrite(const GatewayPoint *point, UA_Double value, char *cmd) {
+    if (point->isRegister) {
+        const RegisterEntry *entry = regTable + point->index;
+        if (!(value >= entry->min && value <= entry->max))
+            return UA_STATUSCODE_BADOUTOFRANGE;
+        if (entry->type == REGISTER_INT && value != floor(value))
+            return UA_STATUSCODE_BADOUTOFRANGE;
+        if (FastPsFormatRegisterWrite(cmd, entry->number, value) == 0)
+            return UA_STATUSCODE_BADOUTOFRANGE;
+        return post(units + point->unit, GATEWAY_REGWRITE, point->index, cmd);
+    }
+    const char *name = point->index == CACHE_CURRENTSETPOINT ? "MWI" : "MWV";
+    if (FastPsFormatSetpoint(cmd, name, value) == 0)
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    return post(units + point->unit, GATEWAY_SETPOINT, point->index, cmd);
+}
+
+UA_StatusCode GatewaySetOutput(UA_UInt32 unit, int on) {
+    return post(units + unit, GATEWAY_COMMAND, 0, on ? "MON\r\n" : "MOFF\r\n");
+}
+
+int GatewayConnected(UA_UInt32 unit) {
+    return units[unit].up;
+}
@@ -0,0 +1,104 @@
+/** @file Gateway.h
+ *
+ *  Gateway to additional FAST-PS units over the network
+ *
+ *  Besides the supply it is running on, the server can manage any number
+ *  of further units reached at their device server (port 10001) over the network.
+ *  Each unit gets its own Device, SetPoint and Registers nodes (below Units/<name>),
+ *  so a whole string of supplies is served by a single OPC UA endpoint.
+ *
+ *  All units are handled by one gateway thread with an event loop (poll()),
+ *  no thread ever blocks on a single unit. Every unit has one persistent
+ *  non-blocking connection. The readbacks (the same commands as for the
+ *  readback cache) of all units are sent at the same time every poll interval,
+ *  each unit as one pipelined batch, and the answers are evaluated as they arrive.
+ *  The time for a complete poll of all units is therefore about one round-trip,
+ *  independent of the number of units. A new poll of a unit is only sent
+ *  when the previous one has been answered.
+ *
+ *  The registers configured in <parameters> at startup are read from all units
+ *  in pipelined batches of MAXQUEUE commands every refresh interval and cached,
+ *  static registers only once, uncached registers with every poll of the readbacks
+ *  (in turns if there are more than fit into the batch of a poll).
+ *  Writes of setpoints, registers and the output state are queued by the
+ *  OPC UA thread and sent with the next iteration of the loop. Acknowledged
+ *  setpoints and register values are stored immediately.
+ *
+ *  A connection that fails, or a unit that does not answer within DEVICE_RXTIMEOUT,
+ *  is closed and re-established with the backoff of the device link.
+ *  While a unit is not connected its values are kept with UncertainLastUsableValue
+ *  status (BadCommunicationError if never obtained) and writes are refused.
+ *
+ *  Configured by
+ *  <gateway interval="100" refresh="60000">
+ *      <unit name="LA1-MFH.02" host="10.66.67.11" port="10001"/>
+ *  </gateway>
+ *  The values are shared by the OPC UA and the gateway threads,
+ *  all functions take care of the locking.
+ */
+
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include "open62541.h"
+#include "ReadbackCache.h"
+#include "RegisterCache.h"
+
+#define GATEWAY_DEFAULT_PORT 10001
+#define GATEWAY_PENDING 64          // commands a unit can have outstanding
+#define GATEWAY_OUTBOX 16           // writes a unit can have queued
+
+// a <unit> element
+typedef struct {
+    char name[80];
+    char host[16];              // IPv4 address
+    unsigned short port;
+} GatewayUnitConfig;
+
+// a value of a unit, used as the handle of its node
+typedef struct {
+    UA_UInt32 unit;
+    UA_UInt32 index;            // CACHE_CURRENT, ... or the index of the register
+    int isRegister;
+} GatewayPoint;
+
+// connect to the units and start the gateway thread
+// the register table is copied (later reloads do not affect the units)
+// interval is the poll interval, refresh the register refresh interval [ms] (0 = only at connect)
+// return 0 on success
+int GatewayStart(const GatewayUnitConfig *units, UA_UInt32 count,
+    const RegisterEntry *registers, UA_UInt32 registerCount, UA_UInt32 interval, UA_UInt32 refresh);
+
+// stop the gateway thread and close all connections
+void GatewayStop();
+
+// the number of units
+UA_UInt32 GatewayUnits();
+
+// the handle of a readback (CACHE_CURRENT, ...) of a unit
+const GatewayPoint *GatewayReadback(UA_UInt32 unit, int index);
+
+// the handle of a register of a unit
+const GatewayPoint *GatewayRegister(UA_UInt32 unit, UA_UInt32 index);
+
+// the configuration of a register of the units
+const RegisterEntry *GatewayRegisterInfo(UA_UInt32 index);
+
+// a copy of the last value obtained from the unit
+CacheValue GatewayGet(const GatewayPoint *point);
+
+// write a setpoint (CACHE_CURRENTSETPOINT or CACHE_VOLTAGESETPOINT) or a register
+// the value is stored when the unit acknowledges the write
+// the command sent is copied into cmd (for logging)
+// return UA_STATUSCODE_BADOUTOFRANGE if the value cannot be sent,
+// UA_STATUSCODE_BADCOMMUNICATIONERROR if the unit is not connected,
+// UA_STATUSCODE_BADRESOURCEUNAVAILABLE if too many writes are queued
+UA_StatusCode GatewayWrite(const GatewayPoint *point, UA_Double value, char *cmd);
+
+// switch the output of a unit on or off (return codes as GatewayWrite())
+UA_StatusCode GatewaySetOutput(UA_UInt32 unit, int on);
+
+// check whether the connection to a unit is established
+int GatewayConnected(UA_UInt32 unit);
+
+#endif
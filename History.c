@@ -0,0 +1,226 @@
+/** @file History.c
+ *
+ *  Compressed in-memory history of the readbacks
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "History.h"
+
+#define RECORD_MAXSIZE 35               // 3 64-bit and one 32-bit variable-length integer
+
+typedef struct {
+    UA_DateTime firstTime;              // the first sample (stored in full)
+    UA_DateTime lastTime;
+    int64_t firstCurrent;               // [uA]
+    int64_t firstVoltage;               // [uV]
+    UA_UInt32 firstStatus;
+    UA_UInt32 count;                    // number of samples in the block
+    UA_UInt32 used;                     // bytes of data used by the differences
+    unsigned char data[HISTORY_BLOCKSIZE-48];
+} HistoryBlock;
+
+static HistoryBlock *blocks = NULL;
+static UA_UInt32 blockCount = 0;
+static UA_UInt32 oldest = 0;            // index of the oldest block in use
+static UA_UInt32 blocksUsed = 0;
+static UA_UInt32 sampleCount = 0;
+// the last sample appended, the reference for the next difference
+static UA_DateTime lastTime;
+static int64_t lastCurrent;
+static int64_t lastVoltage;
+static UA_UInt32 lastStatus;
+
+static pthread_mutex_t historyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/***********************************/
+/* variable-length integers        */
+/***********************************/
+
+// 7 bits per byte, the high bit is set on all but the last byte
+static unsigned int putVarint(unsigned char *p, uint64_t v) {
+    unsigned int n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static uint64_t getVarint(const unsigned char *p, unsigned int *pos) {
+    uint64_t v = 0;
+    for (int shift=0; ; shift+=7) {
+        unsigned char b = p[(*pos)++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return v;
+    }
+}
+
+// signed differences are mapped to small unsigned numbers (0, -1, 1, -2, ...)
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/***********************************/
+/* store                           */
+/***********************************/
+
+int HistoryInit(UA_UInt32 memory) {
+    blockCount = memory / sizeof(HistoryBlock);
+    blocks = malloc(blockCount*sizeof(HistoryBlock));
+    if (blockCount < 2 || blocks == NULL) {
+        free(blocks);
+        blocks = NULL;
+        blockCount = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void HistoryExit() {
+    pthread_mutex_lock(&historyLock);
+    free(blocks);
+    blocks = NULL;
+    blockCount = blocksUsed = sampleCount = 0;
+    pthread_mutex_unlock(&historyLock);
+}
+
+// start a new block with a sample, the oldest block is dropped if the store is full
+// (called with the lock held)
+static void newBlock(UA_DateTime time, int64_t current, int64_t voltage, UA_UInt32 status) {
+    if (blocksUsed == blockCount) {
+        sampleCount -= blocks[oldest].count;
+        oldest = (oldest+1) % blockCount;
+        blocksUsed--;
+    }
+    HistoryBlock *b = blocks + (oldest+blocksUsed) % blockCount;
+    blocksUsed++;
+    b->firstTime = b->lastTime = time;
+    b->firstCurrent = current;
+    b->firstVoltage = voltage;
+    b->firstStatus = status;
+    b->count = 1;
+    b->used = 0;
+}
+
+void HistoryAppend(UA_DateTime time, UA_Double current, UA_Double voltage, UA_UInt32 status) {
+    int64_t i = llround(current*1e6);
+    int64_t v = llround(voltage*1e6);
+    pthread_mutex_lock(&historyLock);
+    if (blocks == NULL) {
+        pthread_mutex_unlock(&historyLock);
+        return;
+    }
+    HistoryBlock *b = blocks + (oldest+blocksUsed-1) % blockCount;
+    // the times within a block are increasing (the clock may have been set back)
+    if (blocksUsed == 0 || b->used + RECORD_MAXSIZE > sizeof(b->data) || time < lastTime)
+        newBlock(time, i, v, status);
+    else {
+        unsigned char *p = b->data + b->used;
+        unsigned int n = putVarint(p, time-lastTime);
+        n += putVarint(p+n, zigzag(i-lastCurrent));
+        n += putVarint(p+n, zigzag(v-lastVoltage));
+        n += putVarint(p+n, status ^ lastStatus);
+        b->used += n;
+        b->count++;
+        b->lastTime = time;
+    }
+    sampleCount++;
+    lastTime = time;
+    lastCurrent = i;
+    lastVoltage = v;
+    lastStatus = status;
+    pthread_mutex_unlock(&historyLock);
+}
+
+UA_UInt32 HistoryCount() {
+    pthread_mutex_lock(&historyLock);
+    UA_UInt32 count = sampleCount;
+    pthread_mutex_unlock(&historyLock);
+    return count;
+}
+
+UA_DateTime HistoryOldest() {
+    pthread_mutex_lock(&historyLock);
+    UA_DateTime time = blocksUsed > 0 ? blocks[oldest].firstTime : 0;
+    pthread_mutex_unlock(&historyLock);
+    return time;
+}
+
+UA_UInt64 HistoryBytes() {
+    pthread_mutex_lock(&historyLock);
+    UA_UInt64 bytes = 0;
+    for (UA_UInt32 k=0; k<blocksUsed; k++)
+        bytes += sizeof(HistoryBlock) - sizeof(blocks->data) + blocks[(oldest+k) % blockCount].used;
+    pthread_mutex_unlock(&historyLock);
+    return bytes;
+}
+
+// decode the samples within the interval, at most limit (0 for all)
+// the samples are only stored if time is not NULL, return their number
+// (historyLock has to be held)
+static size_t decodeInterval(UA_DateTime start, UA_DateTime end, size_t limit,
+        UA_DateTime *time, UA_Double *current, UA_Double *voltage, UA_UInt32 *status) {
+    size_t n = 0;
+    for (UA_UInt32 k=0; k<blocksUsed && (limit == 0 || n<limit); k++) {
+        const HistoryBlock *b = blocks + (oldest+k) % blockCount;
+        if (b->lastTime < start || b->firstTime > end)
+            continue;
+        UA_DateTime t = b->firstTime;
+        int64_t i = b->firstCurrent;
+        int64_t v = b->firstVoltage;
+        UA_UInt32 s = b->firstStatus;
+        unsigned int pos = 0;
+        for (UA_UInt32 m=0; m<b->count && (limit == 0 || n<limit); m++) {
+            if (m > 0) {
+                t += getVarint(b->data, &pos);
+                i += unzigzag(getVarint(b->data, &pos));
+                v += unzigzag(getVarint(b->data, &pos));
+                s ^= getVarint(b->data, &pos);
+            }
+            if (t < start || t > end)
+                continue;
+            if (time != NULL) {
+                time[n] = t;
+                current[n] = i / 1e6;
+                voltage[n] = v / 1e6;
+                status[n] = s;
+            }
+            n++;
+        }
+    }
+    return n;
+}
+
+UA_StatusCode HistoryRead(UA_DateTime start, UA_DateTime end, UA_UInt32 maxValues, size_t *count,
+        UA_DateTime **time, UA_Double **current, UA_Double **voltage, UA_UInt32 **status) {
+    pthread_mutex_lock(&historyLock);
+    // the samples are counted exactly first, blocks overlapping the interval
+    // may hold none within it (e.g. an interval inside an outage of the device)
+    size_t size = decodeInterval(start, end, maxValues, NULL, NULL, NULL, NULL);
+    // an empty result gives empty arrays (UA_EMPTY_ARRAY_SENTINEL), not scalars
+    *time = UA_Array_new(size, &UA_TYPES[UA_TYPES_DATETIME]);
+    *current = UA_Array_new(size, &UA_TYPES[UA_TYPES_DOUBLE]);
+    *voltage = UA_Array_new(size, &UA_TYPES[UA_TYPES_DOUBLE]);
+    *status = UA_Array_new(size, &UA_TYPES[UA_TYPES_UINT32]);
+    if (*time == NULL || *current == NULL || *voltage == NULL || *status == NULL) {
+        pthread_mutex_unlock(&historyLock);
+        UA_Array_delete(*time, size, &UA_TYPES[UA_TYPES_DATETIME]);
+        UA_Array_delete(*current, size, &UA_TYPES[UA_TYPES_DOUBLE]);
+        UA_Array_delete(*voltage, size, &UA_TYPES[UA_TYPES_DOUBLE]);
+        UA_Array_delete(*status, size, &UA_TYPES[UA_TYPES_UINT32]);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    *count = size > 0 ? decodeInterval(start, end, size, *time, *current, *voltage, *status) : 0;
+    pthread_mutex_unlock(&historyLock);
+    return UA_STATUSCODE_GOOD;
+}
@@ -0,0 +1,61 @@
+/** @file History.h
+ *
+ *  Compressed in-memory history of the readbacks
+ *
+ *  Every complete sample of the readback poll (Current, Voltage and DeviceStatus)
+ *  is appended to a store of fixed size allocated at startup, so the last
+ *  minutes or hours before an event can be fetched by a client in one bulk request
+ *  instead of polling fast all the time.
+ *
+ *  The store is a ring of blocks of HISTORY_BLOCKSIZE bytes. The first sample
+ *  of a block is kept in the block header, all following samples as differences
+ *  to their predecessor: the time, the current [uA] and the voltage [uV]
+ *  as variable-length integers, the status word XOR the previous one.
+ *  Slowly changing readbacks take only a few bytes per sample.
+ *  The device reports the readbacks with 6 decimals, so the integer values
+ *  are exact. When the store is full, the oldest block is dropped as a whole.
+ *
+ *  The library version used does not implement the HistoryRead service,
+ *  the history is read with the method History/ReadHistory(start, end, maxValues)
+ *  returning arrays of the times, currents, voltages and status words
+ *  of the samples start <= t <= end, oldest first.
+ *
+ *  Configured by <history memory="1048576"/> [bytes].
+ *  The samples are appended by the device I/O thread and read by the OPC UA thread,
+ *  all functions take care of the locking.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "open62541.h"
+
+#define HISTORY_BLOCKSIZE 4096          // size of a block of the store [bytes]
+#define HISTORY_MINMEMORY (4*HISTORY_BLOCKSIZE)
+
+// allocate the store of the given size [bytes]
+// return 0 on success
+int HistoryInit(UA_UInt32 memory);
+
+// free the store
+void HistoryExit();
+
+// append a sample (ignored without store)
+void HistoryAppend(UA_DateTime time, UA_Double current, UA_Double voltage, UA_UInt32 status);
+
+// the number of samples in the store
+UA_UInt32 HistoryCount();
+
+// the time of the oldest sample, 0 if none
+UA_DateTime HistoryOldest();
+
+// the number of bytes used by the samples
+UA_UInt64 HistoryBytes();
+
+// the samples start <= t <= end, oldest first, at most maxValues (0 = no limit)
+// the arrays are allocated with UA_Array_new() and owned by the caller
+// return UA_STATUSCODE_BADOUTOFMEMORY if they cannot be allocated
+UA_StatusCode HistoryRead(UA_DateTime start, UA_DateTime end, UA_UInt32 maxValues, size_t *count,
+    UA_DateTime **time, UA_Double **current, UA_Double **voltage, UA_UInt32 **status);
+
+#endif
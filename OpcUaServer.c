@@ -14,15 +14,35 @@
  *  @section Functionality
  *  - Provides an OPC-UA server at TCP/IP port 16664.
  *  - Access to device data is handled via the provided TCP server (port 10001).
+ *    All device communication runs in a separate I/O thread (see DeviceLink.h).
+ *    The connection is re-established automatically when it is lost.
+ *  - A server responding to UDP packets is listening at port 16665.
+ *  - The readbacks can be published periodically to a multicast group.
+ *  - UDP clients can subscribe to a stream of readbacks sent to them on a timer.
+ *  - Readback values are polled periodically and served from a cache.
+ *  - Configuration registers are served from a cache with write-through (see RegisterCache.h).
+ *  - An optional waveform capture samples current and voltage at high rate (see Capture.h).
+ *  - Current ramps uploaded as a table are played back by the server (see Ramp.h).
+ *  - A current setpoint can be scheduled for a given time (see SetpointQueue.h).
+ *  - Read values are served from a fixed-size pool instead of the heap (see ScalarPool.h).
+ *  - An epoll network layer can replace select() for many clients (see EpollNetworkLayer.h).
+ *    Its network buffers can be taken from a pool of fixed size (see BufferPool.h).
+ *  - The hot paths are recorded in a binary event trace for offline profiling (see Trace.h).
+ *  - The readbacks can be kept in a compressed in-memory history (see History.h).
+ *  - Further FAST-PS units can be served over the network as a gateway (see Gateway.h).
+ *  - Latency histograms and counters are published in the Diagnostics folder (see Diagnostics.h).
  *  - Server configuration is loadad from file /etc/opcua.xml
+ *  - The parsed configuration can be kept in a binary cache file (option -c cachefile).
+ *  - The poll and register configuration is reloaded on SIGHUP or by Device/ReloadConfiguration().
  *
  *  The OPC UA server compiles and runs stabily on all power supplies tested.
  *  All functionality necessary to user the supllies to power corrector coils
  *  in an accelerator control system environment is provided. This does not
  *  cover the whole functionality provided by the devices, only the essentials.
  *
- *  For faster control an UDP server was implemented listening at port 16665.
- *  This is now provided as a separate binary.
+ *  For faster control an UDP server is listening at port 16665.
+ *  It runs in a separate thread of this server and shares the device connection
+ *  and the readback cache with the OPC UA server (see UdpServer.h).
  *  
  *  @section Build
  *  The server is built with a cross-compiler running on a Linux system
@@ -39,9 +59,24 @@
  *  
  *  A makefile is not yet provided, just a few lines are required to build the server.
  *  - source ../tools/environment
- *  - $CC -std=c99 -c open62541.c
+ *  - $CC -std=c99 -DSCALARPOOL_ALLOCATOR -include ScalarPool.h -c open62541.c
+ *  - $CC -std=c99 -c Diagnostics.c
+ *  - $CC -std=c99 -c BufferPool.c
+ *  - $CC -std=c99 -c Capture.c
+ *  - $CC -std=c99 -c DeviceLink.c
+ *  - $CC -std=c99 -c EpollNetworkLayer.c
+ *  - $CC -std=c99 -c FastPsProtocol.c
+ *  - $CC -std=c99 -c Gateway.c
+ *  - $CC -std=c99 -c History.c
+ *  - $CC -std=c99 -c Ramp.c
+ *  - $CC -std=c99 -c ReadbackCache.c
+ *  - $CC -std=c99 -c RegisterCache.c
+ *  - $CC -std=c99 -c ScalarPool.c
+ *  - $CC -std=c99 -c SetpointQueue.c
+ *  - $CC -std=c99 -c Trace.c
+ *  - $CC -std=c99 -c UdpServer.c
  *  - $CC -std=c99 -c -I $SDKTARGETSYSROOT/usr/include/libxml2/ OpcUaServer.c
- *  - $CXX -o opcuaserver OpcUaServer.o open62541.o -lxml2
+ *  - $CXX -o opcuaserver OpcUaServer.o BufferPool.o Capture.o DeviceLink.o Diagnostics.o EpollNetworkLayer.o FastPsProtocol.o Gateway.o History.o Ramp.o ReadbackCache.o RegisterCache.o ScalarPool.o SetpointQueue.o Trace.o UdpServer.o open62541.o -lpthread -lxml2
  *
  *  @section Installation
  *  For istallation a few files need to be copied onto the device:
@@ -57,7 +92,6 @@
  *
  *  @section TODO
  *  - evaluate the AK/NAK responses
- *  - error handling when reading the device response, don't just die
  *  - VER
  *  - LOOP
  *  - MSAVE
@@ -71,7 +105,9 @@
 #include <signal.h>		     // for signal()
 #include <errno.h>		     // for error messages
 #include <math.h>
+#include <stdint.h>
 
+#include <sys/stat.h>        // for stat()
 #include <sys/socket.h>      // for TCP/IP communication
 #include <netinet/udp.h>	 // declarations for udp header
 #include <netinet/ip.h>		 // declarations for ip header
@@ -81,6 +117,21 @@
 #include <libxml/tree.h>
 
 #include "open62541.h"       // the OPC-UA library
+#include "DeviceLink.h"      // communication with the device TCP/IP server
+#include "FastPsProtocol.h"  // parsing and formatting of device commands
+#include "ReadbackCache.h"   // cache of the device readbacks
+#include "RegisterCache.h"   // cache of the configuration registers
+#include "SetpointQueue.h"   // writing of the setpoints
+#include "UdpServer.h"       // UDP server for fast control loops
+#include "Diagnostics.h"     // latency histograms and counters
+#include "Capture.h"         // waveform capture
+#include "Ramp.h"            // playback of current ramps
+#include "ScalarPool.h"      // storage of the values returned by the reads
+#include "EpollNetworkLayer.h" // network layer for many clients
+#include "BufferPool.h"         // memory budget of the network buffers
+#include "Trace.h"              // binary event trace
+#include "Gateway.h"         // additional units over the network
+#include "History.h"         // compressed readback history
 
 /***********************************/
 /* Server-related variables        */
@@ -89,14 +140,45 @@
 // the OPC-UA server
 UA_Server *server;
 unsigned short serverPortNumber;
+// the network layer, select() of the library or epoll with a fixed number of connections
+int networkEpoll = 0;
+UA_UInt32 networkConnections = EPOLL_DEFAULT_CONNECTIONS;
+// the buffer pool of the epoll layer (optional, disabled if no memory is given)
+UA_UInt32 bufferMemory = 0;
+UA_UInt32 bufferSize = BUFFERPOOL_DEFAULTSIZE;
+char deviceName[80];
+// the UDP server (optional)
+unsigned short udpPortNumber = 0;
+UA_UInt32 udpMaxAge = 0;
+// the multicast publisher (optional, disabled while the group is empty)
+char multicastGroup[16] = "";
+char multicastInterface[16] = "";
+unsigned short multicastPort = 16666;
+UA_UInt32 multicastInterval = 0;
+UA_UInt32 multicastTtl = 1;
+// the waveform capture (optional)
+UA_UInt32 captureDepth = 0;
+UA_Double captureRate = 1000.0;
+int captureMode = CAPTURE_CONTINUOUS;
+int captureTrigger = CAPTURE_TRIGGER_MANUAL;
+UA_UInt32 capturePosttrigger = 0;
+// the additional units of the gateway (optional)
+GatewayUnitConfig *gatewayUnits = NULL;
+UA_UInt32 gatewayCount = 0;
+UA_UInt32 gatewayInterval = 0;
+UA_UInt32 gatewayRefresh = 0;
+// the readback history (optional, size of the store in bytes)
+UA_UInt32 historyMemory = 0;
+// the event trace (records per thread, 0 disables it) and the file it is dumped to
+UA_UInt32 traceRecords = TRACE_DEFAULT_RECORDS;
+char traceFile[80] = TRACE_DEFAULT_FILE;
 // log to the console
 UA_Logger logger = Logger_Stdout;
 
 // Overview of the OPC-UA variables hosted by this server.
-// all parameters are double-valued registers accessed with MRG/MWG
+// all parameters are registers accessed with MRG/MWG (Double or Int32 nodes)
 // the list of parameters is read from the XML configuration file
 // all parameters are stored with a register number
-#define maxreg 40           // the maximum number of registers
 /*
     Server
     |   ...
@@ -105,14 +187,91 @@ UA_Logger logger = Logger_Stdout;
     |   Status
     |   OutputOn
     |   MReset
+    |   SFP-upmode
+    |   ReloadConfiguration()
+    |   <the configured bits of the status word>
     SetPoint
     |   Voltage
     |   Current
     |   VoltageSetpoint
     |   CurrentSetpoint
+    |   VoltageApplied
+    |   VoltageAppliedTime
+    |   CurrentApplied
+    |   CurrentAppliedTime
+    |   ScheduleCurrent()
+    |   ScheduledTime
+    |   ScheduledSentTime
+    |   ScheduledSkew
+    |   ScheduledPending
     Parameters
     |   PID_I_Kp_v
     |   ...
+    |   AllRegisters
+    |   RegisterNumbers
+    |   WriteRegisters()
+    |   Refresh
+    |   ModificationCount
+    Diagnostics
+    |   MRI ... ServerIteration
+    |   |   Count
+    |   |   Mean
+    |   |   P99
+    |   |   Max
+    |   |   Histogram
+    |   NakReplies ... StreamedFrames
+    |   CacheHitRate
+    |   UaQueueDepth
+    |   UaQueueMaxDepth
+    |   UdpQueueDepth
+    |   UdpQueueMaxDepth
+    |   PoolInUse
+    |   PoolMaxInUse
+    |   BufferPoolInUse
+    |   BufferPoolMaxInUse
+    |   DumpTrace()
+    |   StartupTime
+    |   FirstReadbackTime
+    Capture
+    |   Current
+    |   Voltage
+    |   Time
+    |   Count
+    |   State
+    |   Trigger
+    |   Arm
+    |   TriggerTime
+    |   Overruns
+    Ramp
+    |   Time
+    |   Current
+    |   Rate
+    |   Start
+    |   Abort
+    |   State
+    |   Elapsed
+    |   Skipped
+    History (only with <history>)
+    |   Count
+    |   OldestTime
+    |   Bytes
+    |   ReadHistory()
+    Units (only with a <gateway>)
+    |   <name of the unit>
+    |   |   Device
+    |   |   |   DeviceName
+    |   |   |   DeviceStatus
+    |   |   |   OutputOn
+    |   |   |   Connected
+    |   |   |   <the configured bits of the status word>
+    |   |   SetPoint
+    |   |   |   Current
+    |   |   |   Voltage
+    |   |   |   CurrentSetpoint
+    |   |   |   VoltageSetpoint
+    |   |   Registers
+    |   |   |   PID_I_Kp_v
+    |   |   |   ...
 */
 
 // this variable is a flag for the running server
@@ -137,29 +296,105 @@ static void stopHandler(int signal)
     running = 0;
 }
 
+// set by SIGHUP, the configuration is reloaded by the server loop
+static volatile sig_atomic_t reloadRequested = 0;
+static int reloadConfiguration();
+
+// handle SIGHUP
+static void reloadHandler(int sig)
+{
+    // the handler may have been reset when it was called
+    signal(SIGHUP, reloadHandler);
+    reloadRequested = 1;
+}
+
+// set by SIGUSR1, the event trace is dumped by the server loop
+static volatile sig_atomic_t traceRequested = 0;
+
+// handle SIGUSR1
+static void traceHandler(int sig)
+{
+    signal(SIGUSR1, traceHandler);
+    traceRequested = 1;
+}
+
 /***********************************/
-/* TCP/IP communication            */
+/* startup timing                  */
 /***********************************/
 
-int sock;
-struct sockaddr_in tcpserver;
+// the time of the program start (monotonic)
+static UA_DateTime startupStart;
+// the time [ms] until the endpoint was listening and until the first readbacks were obtained
+static UA_Double startupListenTime = 0.0;
+static UA_Double startupReadbackTime = 0.0;
+
+// log the time since the program start when a phase of the startup is completed
+// the time is also stored in *ms unless it is NULL
+static void startupPhase(const char *phase, UA_Double *ms) {
+    UA_Double elapsed = (UA_Double)(UA_DateTime_nowMonotonic()-startupStart) / UA_MSEC_TO_DATETIME;
+    printf("OpcUaServer : startup %s after %.1f ms\n", phase, elapsed);
+    if (ms != NULL)
+        *ms = elapsed;
+}
 
-#define BUFSIZE 80
-char command[BUFSIZE];			// command string buffer
-char response[BUFSIZE];			// receive buffer
+/***********************************/
+/* readback cache                  */
+/***********************************/
 
-// send the string in command to the device
-// receive the answer in response
-// return the number of read characters
-unsigned int TcpSendReceive() {
-    unsigned int buflen = strlen(command);
-    if (send(sock, command, buflen, 0) != buflen)
-        Die("Mismatch in number of sent bytes");
-    // receive the answer from the server
-    unsigned int reclen;
-    reclen = recv(sock, response, BUFSIZE-1, 0);
-    response[reclen] = '\0';			// assure null terminated string
-    return reclen;
+void refreshRegisters(UA_Server *server, void *data);
+
+// repeated job of the server - sample all cached values
+// the poll is posted to the device I/O thread, the job does not wait for the answers
+// a new poll is only posted when the previous one has been completed
+// whenever the device link comes up, all registers are read as well
+void pollDevice(UA_Server *server, void *data) {
+    static DeviceRequest *lastPoll = NULL;
+    static int wasConnected = 0;
+    if (lastPoll != NULL && !DeviceRequestDone(&uaQueue, lastPoll))
+        return;
+    if (lastPoll != NULL && !lastPoll->failed && startupReadbackTime == 0.0)
+        startupPhase("first readback", &startupReadbackTime);
+    int connected = DeviceConnected();
+    if (connected && !wasConnected)
+        refreshRegisters(server, NULL);
+    wasConnected = connected;
+    lastPoll = CachePoll(&uaQueue);
+}
+
+// repeated job of the server - send the pending setpoints (coalescing mode)
+void flushSetpoints(UA_Server *server, void *data) {
+    SetpointFlush();
+}
+
+// copy the status and source timestamp of the reported value into a data value
+void setCacheQuality(const CacheValue *reported, UA_Boolean sourceTimeStamp, UA_DataValue *dataValue) {
+    if (reported->status != UA_STATUSCODE_GOOD) {
+        dataValue->hasStatus = true;
+        dataValue->status = reported->status;
+    }
+    if (sourceTimeStamp && reported->timestamp != 0) {
+        dataValue->hasSourceTimestamp = true;
+        dataValue->sourceTimestamp = reported->timestamp;
+    }
+}
+
+// the node in the trace records of the DataSource reads (all nodes have numeric ids)
+static UA_UInt32 traceNodeId(const UA_NodeId nodeid) {
+    return nodeid.identifierType == UA_NODEIDTYPE_NUMERIC ? nodeid.identifier.numeric : 0;
+}
+
+// callback routine for reading any of the cached floating point values
+// handle is supposed to point to the cache entry
+UA_StatusCode readCachedDouble( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    CacheValue reported = CacheReported((CacheEntry *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &reported.value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    setCacheQuality(&reported, sourceTimeStamp, dataValue);
+    DiagCount(DIAG_CACHEHITS);
+    DiagRecordStatus(DIAG_DATASOURCE, start, reported.status, traceNodeId(nodeid));
+    return UA_STATUSCODE_GOOD;
 }
 
 /***********************************/
@@ -168,58 +403,68 @@ unsigned int TcpSendReceive() {
 /***********************************/
 
 // switch the output on/off
-// handle (pointing at DeviceOutputOn) is interpreted as a boolean on/off information
 UA_StatusCode writeDeviceOutputOn(void *handle, const UA_NodeId nodeid,
             const UA_Variant *data, const UA_NumericRange *range) {
+    // handle points to the status word cache entry, the requested state is not stored there
+    UA_Boolean on = false;
     if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data) {
-        *(UA_Boolean*)handle = *(UA_Boolean*)data->data;
+        on = *(UA_Boolean*)data->data;
     }
-    if (*(bool *)handle) {
+    if (on) {
         // switch on the output
         UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "MON");
         strcpy(command,"MON\r\n");
-        TcpSendReceive();
+        if (!TcpSendAsync(NULL))
+            return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
     } else {
         // switch off the output
         UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "MOFF");
         strcpy(command,"MOFF\r\n");
-        TcpSendReceive();
+        if (!TcpSendAsync(NULL))
+            return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
     };
     return UA_STATUSCODE_GOOD;
 }
 
+// the output state is bit 0 of the cached status word
 UA_StatusCode readDeviceOutputOn( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // send status request to server    
-    strcpy(command,"MST\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert the answer into a number
-    // first 5 charecters are #MST:
-    unsigned int status;
-    sscanf(response+5,"%x",&status);
-    *(bool *)handle = (status & 1 == 1);
-    // set the variable value
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    CacheValue reported = CacheReported((CacheEntry *)handle);
+    UA_Boolean on = ((reported.word & 1) == 1);
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Boolean *)handle, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    ScalarPoolSet(&dataValue->value, &on, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    setCacheQuality(&reported, sourceTimeStamp, dataValue);
+    DiagCount(DIAG_CACHEHITS);
+    DiagRecordStatus(DIAG_DATASOURCE, start, reported.status, traceNodeId(nodeid));
     return UA_STATUSCODE_GOOD;
 }
 
+// the status word as obtained by the last MST sample
 UA_StatusCode readDeviceStatus( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // send request to server    
-    strcpy(command,"MST\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert the answer into a number
-    // first 5 charecters are #MST:
-    unsigned int status;
-    int result = sscanf(response+5,"%x",&status);
-    if (result==0)
-        *(unsigned int *)handle = -1;
-    else
-        *(unsigned int *)handle = status;
-    // set the variable value
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    CacheValue reported = CacheReported((CacheEntry *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &reported.word, &UA_TYPES[UA_TYPES_UINT32]);
+    setCacheQuality(&reported, sourceTimeStamp, dataValue);
+    DiagCount(DIAG_CACHEHITS);
+    DiagRecordStatus(DIAG_DATASOURCE, start, reported.status, traceNodeId(nodeid));
+    return UA_STATUSCODE_GOOD;
+}
+
+// a single bit of the status word as obtained by the last MST sample
+// handle is the number of the bit
+UA_StatusCode readDeviceStatusBit( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    CacheValue reported = CacheReported(cache+CACHE_STATUS);
+    UA_Boolean set = (reported.word >> (uintptr_t)handle) & 1;
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (unsigned int *)handle, &UA_TYPES[UA_TYPES_UINT32]);
+    ScalarPoolSet(&dataValue->value, &set, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    setCacheQuality(&reported, sourceTimeStamp, dataValue);
+    DiagCount(DIAG_CACHEHITS);
+    DiagRecordStatus(DIAG_DATASOURCE, start, reported.status, traceNodeId(nodeid));
     return UA_STATUSCODE_GOOD;
 }
 
@@ -234,27 +479,38 @@ UA_StatusCode writeMReset(void *handle, const UA_NodeId nodeid,
         UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "MRESET");
         // send command
         strcpy(command,"MRESET\r\n");
-        TcpSendReceive();
+        if (!TcpSendAsync(NULL))
+            return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
     };
     return UA_STATUSCODE_GOOD;
 }
 
+// the iteration of the server loop, incremented for every call of getJobs()
+static UA_UInt64 serverIteration = 0;
+// the answer to UPMODE obtained by the prefetch of an iteration
+static UA_UInt64 upmodePrefetched = 0;
+static char upmodeReply[BUFSIZE];
+
 // switch to SFP update mode and back
 UA_StatusCode writeDeviceModeSFP(void *handle, const UA_NodeId nodeid,
             const UA_Variant *data, const UA_NumericRange *range) {
     if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data) {
         *(UA_Boolean*)handle = *(UA_Boolean*)data->data;
     }
+    // a prefetched answer is outdated for the following reads
+    upmodePrefetched = 0;
     if (*(bool *)handle) {
         // switch on the output
         UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "UPMODE:SFP");
         strcpy(command,"UPMODE:SFP\r\n");
-        TcpSendReceive();
+        if (!TcpSendAsync(NULL))
+            return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
     } else {
         // switch off the output
         UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "UPMODE:NORMAL");
         strcpy(command,"UPMODE:NORMAL\r\n");
-        TcpSendReceive();
+        if (!TcpSendAsync(NULL))
+            return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
     };
     return UA_STATUSCODE_GOOD;
 }
@@ -262,215 +518,1630 @@ UA_StatusCode writeDeviceModeSFP(void *handle, const UA_NodeId nodeid,
 // read the SFP output mode
 UA_StatusCode readDeviceModeSFP( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // send status request to server    
-    strcpy(command,"UPMODE\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // first 8 charecters are #UPMODE:
-    if (strncmp(response+8,"SFP",3)==0)
-        *(bool *)handle = true;
-    else
-        *(bool *)handle = false;
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    // send status request to server (unless prefetched for the request)
+    if (upmodePrefetched == serverIteration)
+        strcpy(response, upmodeReply);
+    else {
+        strcpy(command,"UPMODE\r\n");
+        TcpSendReceive();
+    }
+    // the answer is #UPMODE:SFP or #UPMODE:NORMAL
+    int sfp;
+    if (!FastPsParseUpmode(response,&sfp)) {
+        // no answer at all or a refused command is not malformed
+        if (response[0] != '\0' && !FastPsIsNak(response))
+            DiagCount(DIAG_MALFORMEDREPLIES);
+        // the server presets hasValue, there is no value to encode
+        dataValue->hasValue = false;
+        dataValue->hasStatus = true;
+        dataValue->status = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+        DiagRecordStatus(DIAG_DATASOURCE, start, UA_STATUSCODE_BADCOMMUNICATIONERROR, traceNodeId(nodeid));
+        return UA_STATUSCODE_GOOD;
+    }
+    *(bool *)handle = sfp;
     // set the variable value
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Boolean *)handle, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    ScalarPoolSet(&dataValue->value, (UA_Boolean *)handle, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    DiagRecordStatus(DIAG_DATASOURCE, start, UA_STATUSCODE_GOOD, traceNodeId(nodeid));
+    return UA_STATUSCODE_GOOD;
+}
+
+// callback routine for writing the current value
+UA_StatusCode writeCurrent(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    // handle is supposed to point to the CurrentSetpoint cache entry
+    CacheEntry *entry = (CacheEntry *)handle;
+    double value = CacheSample(entry).value;
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
+        value = *(UA_Double*)data->data;
+    }
+    // send to the device (or queue it when coalescing)
+    return SetpointWrite(setpoints+SETPOINT_CURRENT, value);
+}
+
+// callback routine for writing the voltage value
+UA_StatusCode writeVoltage(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    // handle is supposed to point to the VoltageSetpoint cache entry
+    CacheEntry *entry = (CacheEntry *)handle;
+    double value = CacheSample(entry).value;
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
+        value = *(UA_Double*)data->data;
+    }
+    // send to the device (or queue it when coalescing)
+    return SetpointWrite(setpoints+SETPOINT_VOLTAGE, value);
+}
+
+// the last setpoint value acknowledged by the device
+// handle is supposed to point to the setpoint
+UA_StatusCode readSetpointApplied( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    Setpoint sp = SetpointGet((Setpoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &sp.appliedValue, &UA_TYPES[UA_TYPES_DOUBLE]);
+    if (sp.appliedTime == 0) {
+        dataValue->hasStatus = true;
+        dataValue->status = UA_STATUSCODE_BADWAITINGFORINITIALDATA;
+    } else if (sourceTimeStamp) {
+        dataValue->hasSourceTimestamp = true;
+        dataValue->sourceTimestamp = sp.appliedTime;
+    }
     return UA_STATUSCODE_GOOD;
 }
 
-// callback routine for reading the current value
-UA_StatusCode readCurrent( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+// the time when the last setpoint value was acknowledged by the device
+// handle is supposed to point to the setpoint
+UA_StatusCode readSetpointAppliedTime( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // handle is supposed to point to CurrentReadback
-    // send request to server    
-    strcpy(command,"MRI\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert buffer to numerical value
-    // first 5 charecters are #MRI:
-    if(strncmp(response,"#MRI:",5)==0)
-        sscanf(response+5,"%lf",(double *)handle);
-    else
-    {
-        // printf("wrong MRI response : %s",response);
-        *(double *)handle = 999.999;
+    Setpoint sp = SetpointGet((Setpoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &sp.appliedTime, &UA_TYPES[UA_TYPES_DATETIME]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the requested time of the last scheduled setpoint value applied
+// handle is supposed to point to the setpoint
+UA_StatusCode readSetpointScheduledTime( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    Setpoint sp = SetpointGet((Setpoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &sp.scheduledTime, &UA_TYPES[UA_TYPES_DATETIME]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the time when the last scheduled setpoint value was actually sent to the device
+UA_StatusCode readSetpointScheduledSent( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    Setpoint sp = SetpointGet((Setpoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &sp.scheduledSent, &UA_TYPES[UA_TYPES_DATETIME]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the difference between the send and the requested time [us]
+UA_StatusCode readSetpointScheduledSkew( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    Setpoint sp = SetpointGet((Setpoint *)handle);
+    UA_Double skew = (UA_Double)(sp.scheduledSent - sp.scheduledTime) / UA_USEC_TO_DATETIME;
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &skew, &UA_TYPES[UA_TYPES_DOUBLE]);
+    if (sp.scheduledTime == 0) {
+        dataValue->hasStatus = true;
+        dataValue->status = UA_STATUSCODE_BADWAITINGFORINITIALDATA;
     }
-    // set the variable value
+    return UA_STATUSCODE_GOOD;
+}
+
+// ScheduleCurrent(Value, Time)
+// the current setpoint is sent to the device at the given time
+UA_StatusCode scheduleCurrentMethod(void *methodHandle, const UA_NodeId objectId,
+        size_t inputSize, const UA_Variant *input, size_t outputSize, UA_Variant *output) {
+    if (inputSize != 2)
+        return UA_STATUSCODE_BADARGUMENTSMISSING;
+    if (!UA_Variant_isScalar(&input[0]) || input[0].type != &UA_TYPES[UA_TYPES_DOUBLE]
+            || !UA_Variant_isScalar(&input[1]) || input[1].type != &UA_TYPES[UA_TYPES_DATETIME])
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    return SetpointSchedule(setpoints+SETPOINT_CURRENT,
+        *(UA_Double *)input[0].data, *(UA_DateTime *)input[1].data);
+}
+
+static int registerPrefetched(int index);
+static void registerUnprefetch(int index);
+
+// handle is the index of the register in the register cache
+UA_StatusCode readRegister( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    int index = (uintptr_t)handle;
+    const RegisterEntry *info = RegisterInfo(index);
+    // uncached registers are read unless prefetched for the request
+    if (info->policy == REGISTER_NOCACHE && !registerPrefetched(index))
+        RegisterUpdate(index, 1);
+    else
+        DiagCount(DIAG_CACHEHITS);
+    CacheValue reg = RegisterGet(index);
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
+    if (info->type == REGISTER_INT) {
+        UA_Int32 value = (UA_Int32)lround(reg.value);
+        ScalarPoolSet(&dataValue->value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    } else
+        ScalarPoolSet(&dataValue->value, &reg.value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    setCacheQuality(&reg, sourceTimeStamp, dataValue);
+    DiagRecordStatus(DIAG_DATASOURCE, start, reg.status, traceNodeId(nodeid));
     return UA_STATUSCODE_GOOD;
 }
 
-// callback routine for writing the current value
-UA_StatusCode writeCurrent(void *handle, const UA_NodeId nodeid,
+// handle is the index of the register in the register cache
+// Double and Int32 values are accepted for all registers
+UA_StatusCode writeRegister(void *handle, const UA_NodeId nodeid,
             const UA_Variant *data, const UA_NumericRange *range) {
-    // handle is supposed to point to CurrentReadback
-    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
-        *(UA_Double*)handle = *(UA_Double*)data->data;
+    if (!UA_Variant_isScalar(data) || data->data == NULL)
+        return UA_STATUSCODE_GOOD;
+    UA_Double value;
+    if (data->type == &UA_TYPES[UA_TYPES_DOUBLE])
+        value = *(UA_Double *)data->data;
+    else if (data->type == &UA_TYPES[UA_TYPES_INT32])
+        value = *(UA_Int32 *)data->data;
+    else
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    char cmd[FASTPS_CMDSIZE];
+    registerUnprefetch((uintptr_t)handle);
+    // the answer is printed and stored in the cache by the I/O thread
+    UA_StatusCode retval = RegisterWrite((uintptr_t)handle, value, cmd);
+    // register writes sent to the device are logged (without the line termination)
+    if (retval == UA_STATUSCODE_GOOD)
+        UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "%.*s", (int)strlen(cmd)-2, cmd);
+    return retval;
+}
+
+// repeated job of the server - read all registers into the register cache
+// a new refresh is only posted when the previous one has been completed
+void refreshRegisters(UA_Server *server, void *data) {
+    static DeviceRequest *lastRefresh = NULL;
+    if (lastRefresh != NULL && !DeviceRequestDone(&uaQueue, lastRefresh))
+        return;
+    lastRefresh = RegisterRefresh();
+}
+
+// writing true refreshes the register cache at once
+UA_StatusCode writeRegisterRefresh(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data)
+        if (*(UA_Boolean*)data->data)
+            refreshRegisters(server, NULL);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readRegisterModifications( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 count = RegisterModifications();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &count, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********************************/
+/* register blocks                 */
+/***********************************/
+
+// all configured registers (or the selected slice) from the register cache
+// values never obtained are NaN, the status is the first one not good
+UA_StatusCode readAllRegisters( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    size_t first, count;
+    UA_StatusCode retval = CaptureRange(range, registerCount, &first, &count);
+    if (retval != UA_STATUSCODE_GOOD) {
+        DiagRecordStatus(DIAG_DATASOURCE, start, retval, traceNodeId(nodeid));
+        return retval;
+    }
+    // the uncached registers are read in one pipelined exchange
+    RegisterUpdate(first, count);
+    UA_Double *values = UA_Array_new(count, &UA_TYPES[UA_TYPES_DOUBLE]);
+    if (values == NULL)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    UA_StatusCode status = UA_STATUSCODE_GOOD;
+    for (size_t i=0; i<count; i++) {
+        CacheValue reg = RegisterGet(first+i);
+        values[i] = reg.timestamp != 0 ? reg.value : NAN;
+        if (status == UA_STATUSCODE_GOOD)
+            status = reg.status;
+    }
+    dataValue->hasValue = true;
+    UA_Variant_setArray(&dataValue->value, values, count, &UA_TYPES[UA_TYPES_DOUBLE]);
+    if (status != UA_STATUSCODE_GOOD) {
+        dataValue->hasStatus = true;
+        dataValue->status = status;
     }
-    // send request to server
-    sprintf(command,"MWI:%9.6f\r\n",*(double *)handle);
-    // UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, command);
-    TcpSendReceive();
+    DiagCount(DIAG_CACHEHITS);
+    DiagRecordStatus(DIAG_DATASOURCE, start, status, traceNodeId(nodeid));
     return UA_STATUSCODE_GOOD;
 }
 
-// callback routine for reading the current setpoint
-// this only works if the output is on, otherwise #NAK:13 is answered
-UA_StatusCode readCurrentSetpoint( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+// the register numbers in the order of AllRegisters
+UA_StatusCode readRegisterNumbers( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // send request to server    
-    strcpy(command,"MWI:?\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert buffer to numerical value
-    // first 5 charecters are #MWI:
-    if(strncmp(response,"#MWI:",5)==0)
-        sscanf(response+5,"%lf",(double *)handle);
+    size_t first, count;
+    UA_StatusCode retval = CaptureRange(range, registerCount, &first, &count);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    UA_UInt32 *numbers = UA_Array_new(count, &UA_TYPES[UA_TYPES_UINT32]);
+    if (numbers == NULL)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    for (size_t i=0; i<count; i++)
+        numbers[i] = RegisterNumber(first+i);
+    dataValue->hasValue = true;
+    UA_Variant_setArray(&dataValue->value, numbers, count, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// check and format a register set (WriteRegisters)
+static UA_StatusCode prepareRegisters(size_t count, const UA_UInt32 *numbers, const UA_Double *values,
+        int *index, char (*commands)[BUFSIZE]) {
+    for (size_t i=0; i<count; i++) {
+        // only configured registers can be written
+        if ((index[i] = RegisterFind(numbers[i])) < 0)
+            return UA_STATUSCODE_BADINVALIDARGUMENT;
+        UA_StatusCode retval = RegisterCheck(index[i], values[i]);
+        if (retval != UA_STATUSCODE_GOOD)
+            return retval;
+        if (FastPsFormatRegisterWrite(commands[i], numbers[i], values[i]) == 0)
+            return UA_STATUSCODE_BADOUTOFRANGE;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+// WriteRegisters(Numbers UInt32[], Values Double[]) -> Acknowledged Boolean[]
+// all values are checked before anything is sent, so an invalid set is not applied partly
+UA_StatusCode writeRegistersMethod(void *methodHandle, const UA_NodeId objectId,
+        size_t inputSize, const UA_Variant *input, size_t outputSize, UA_Variant *output) {
+    if (inputSize != 2 || outputSize != 1)
+        return UA_STATUSCODE_BADARGUMENTSMISSING;
+    // the output is always set, the stack cannot encode an empty variant
+    UA_Variant_setArray(output, UA_Array_new(0, &UA_TYPES[UA_TYPES_BOOLEAN]), 0, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    if (input[0].type != &UA_TYPES[UA_TYPES_UINT32] || input[1].type != &UA_TYPES[UA_TYPES_DOUBLE]
+            || UA_Variant_isScalar(&input[0]) || UA_Variant_isScalar(&input[1]))
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    size_t count = input[0].arrayLength;
+    if (input[1].arrayLength != count)
+        return UA_STATUSCODE_BADINVALIDARGUMENT;
+    if (count == 0)
+        return UA_STATUSCODE_GOOD;
+    int *index = malloc(count*sizeof(int));
+    char (*commands)[BUFSIZE] = malloc(count*BUFSIZE);
+    char (*replies)[BUFSIZE] = malloc(count*BUFSIZE);
+    UA_Boolean *ack = UA_Array_new(count, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    UA_StatusCode retval = UA_STATUSCODE_BADOUTOFMEMORY;
+    if (index != NULL && commands != NULL && replies != NULL && ack != NULL)
+        retval = prepareRegisters(count, input[0].data, input[1].data, index, commands);
+    if (retval == UA_STATUSCODE_GOOD) {
+        for (size_t i=0; i<count; i++) {
+            registerUnprefetch(index[i]);
+            UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "%.*s", (int)strlen(commands[i])-2, commands[i]);
+        }
+        if (DeviceExchange(&uaQueue, commands, replies, count) < count)
+            retval = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+        for (size_t i=0; i<count; i++) {
+            ack[i] = RegisterWritten(index[i], commands[i], replies[i]);
+            if (!ack[i])
+                printf("MWG response : %s\n", replies[i]);
+        }
+        UA_Variant_setArray(output, ack, count, &UA_TYPES[UA_TYPES_BOOLEAN]);
+        ack = NULL;
+    }
+    if (ack != NULL)
+        UA_Array_delete(ack, count, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    free(index);
+    free(commands);
+    free(replies);
+    return retval;
+}
+
+/***********************************/
+/* diagnostics                     */
+/***********************************/
+
+// the time the network layer spent in the last getJobs() call
+// (mostly waiting in select() or epoll_wait() for the clients)
+static UA_ServerNetworkLayer tcpLayer;
+static UA_DateTime networkTime = 0;
+
+// the network layer of the server calls the TCP layer through this function
+// the uncached values read by the received requests are prefetched
+static void prefetchReads(const UA_Job *jobs, size_t count);
+static size_t timedGetJobs(UA_ServerNetworkLayer *nl, UA_Job **jobs, UA_UInt16 timeout) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    size_t count = tcpLayer.getJobs(nl, jobs, timeout);
+    networkTime += UA_DateTime_nowMonotonic() - start;
+    serverIteration++;
+    prefetchReads(*jobs, count);
+    return count;
+}
+
+// write the event trace to the configured file
+// return the number of records written, -1 on failure
+static int dumpTrace() {
+    int count = TraceDump(traceFile);
+    if (count < 0)
+        UA_LOG_WARNING(logger, UA_LOGCATEGORY_SERVER, "failed to write the event trace to %s", traceFile);
     else
-        *(double *)handle = 999.999;
-    // set the variable value
+        UA_LOG_INFO(logger, UA_LOGCATEGORY_SERVER, "%d trace records written to %s", count, traceFile);
+    return count;
+}
+
+// method without input returning the number of records written
+UA_StatusCode dumpTraceMethod(void *methodHandle, const UA_NodeId objectId,
+            size_t inputSize, const UA_Variant *input,
+            size_t outputSize, UA_Variant *output) {
+    if (outputSize != 1)
+        return UA_STATUSCODE_BADARGUMENTSMISSING;
+    int count = dumpTrace();
+    if (count < 0)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    UA_UInt32 n = count;
+    return UA_Variant_setScalarCopy(&output[0], &n, &UA_TYPES[UA_TYPES_UINT32]);
+}
+
+// run the server loop until running is cleared
+// a configuration reload requested by SIGHUP is done between two iterations
+// the time of every iteration without the network wait is recorded
+static UA_StatusCode runServer(UA_Server *server) {
+    UA_StatusCode retval = UA_Server_run_startup(server);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    startupPhase("listening", &startupListenTime);
+    while (running) {
+        UA_DateTime start = UA_DateTime_nowMonotonic();
+        networkTime = 0;
+        UA_Server_run_iterate(server, true);
+        DiagRecordSince(DIAG_UALOOP, start + networkTime);
+        if (reloadRequested) {
+            reloadRequested = 0;
+            reloadConfiguration();
+        }
+        if (traceRequested) {
+            traceRequested = 0;
+            dumpTrace();
+        }
+    }
+    return UA_Server_run_shutdown(server);
+}
+
+// handle is supposed to point to the histogram
+UA_StatusCode readDiagCount( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    DiagHistogram h;
+    DiagHistogramGet((DiagHistogram *)handle, &h);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &h.count, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the mean duration [us]
+UA_StatusCode readDiagMean( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    DiagHistogram h;
+    DiagHistogramGet((DiagHistogram *)handle, &h);
+    UA_Double mean = h.count ? (UA_Double)h.sum / h.count : 0.0;
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &mean, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the 99th percentile [us] (upper bound of the histogram bucket)
+UA_StatusCode readDiagP99( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    DiagHistogram h;
+    DiagHistogramGet((DiagHistogram *)handle, &h);
+    UA_Double p99 = DiagPercentile(&h, 0.99);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &p99, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the longest duration [us]
+UA_StatusCode readDiagMax( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    DiagHistogram h;
+    DiagHistogramGet((DiagHistogram *)handle, &h);
+    UA_Double max = (UA_Double)h.max;
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &max, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the counts of all buckets as an array
+UA_StatusCode readDiagBuckets( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    DiagHistogram h;
+    DiagHistogramGet((DiagHistogram *)handle, &h);
+    size_t first, count;
+    UA_StatusCode retval = CaptureRange(range, DIAG_BUCKETS, &first, &count);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    dataValue->hasValue = true;
+    UA_Variant_setArrayCopy(&dataValue->value, h.bucket+first, count, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// handle is supposed to point to the counter
+UA_StatusCode readDiagCounter( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 count = DiagCounter((UA_UInt64 *)handle - diagCounters);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &count, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the fraction of all reads served from the cache
+UA_StatusCode readCacheHitRate( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 hits = DiagCounter(DIAG_CACHEHITS);
+    UA_UInt64 total = hits + DiagCounter(DIAG_CACHEMISSES);
+    UA_Double rate = total ? (UA_Double)hits / total : 0.0;
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &rate, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// handle is supposed to point to the device queue
+UA_StatusCode readQueueDepth( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 depth = DeviceQueueDepth((DeviceQueue *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &depth, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readQueueMaxDepth( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 depth = DeviceQueueMaxDepth((DeviceQueue *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &depth, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readPoolInUse( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 n = ScalarPoolInUse();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &n, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readPoolMaxInUse( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 n = ScalarPoolMaxInUse();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &n, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readBufferPoolInUse( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 n = BufferPoolInUse();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &n, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readBufferPoolMaxInUse( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 n = BufferPoolMaxInUse();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &n, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********************************/
+/* waveform capture                */
+/***********************************/
+
+// the samples of a captured signal
+// handle is supposed to point to the signal number (CAPTURE_CURRENT, ...)
+// the numeric range selects a slice of the samples
+UA_StatusCode readCaptureSignal( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_StatusCode retval = CaptureRead(*(int *)handle, range, &dataValue->value);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    dataValue->hasValue = true;
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readCaptureCount( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 count = CaptureCount();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &count, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readCaptureState( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 state = CaptureState();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &state, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readCaptureTriggerTime( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime time = CaptureTriggerTime();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &time, &UA_TYPES[UA_TYPES_DATETIME]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readCaptureOverruns( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 overruns = CaptureOverruns();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &overruns, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// writing true triggers the capture (triggered mode only)
+UA_StatusCode writeCaptureTrigger(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data)
+        if (*(UA_Boolean*)data->data)
+            CaptureTrigger();
+    return UA_STATUSCODE_GOOD;
+}
+
+// writing true clears the buffer and restarts the recording
+UA_StatusCode writeCaptureArm(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data)
+        if (*(UA_Boolean*)data->data)
+            CaptureArm();
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********************************/
+/* ramp playback                   */
+/***********************************/
+
+// a column of the ramp table
+// handle is supposed to point to the column number (RAMP_TIME, RAMP_CURRENT)
+UA_StatusCode readRampColumn( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_StatusCode retval = RampRead(*(int *)handle, range, &dataValue->value);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    dataValue->hasValue = true;
+    return UA_STATUSCODE_GOOD;
+}
+
+// the whole column is replaced by the written array
+UA_StatusCode writeRampColumn(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if (range != NULL)
+        return UA_STATUSCODE_BADINDEXRANGEINVALID;
+    if (data->type != &UA_TYPES[UA_TYPES_DOUBLE])
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    size_t count = UA_Variant_isScalar(data) ? 1 : data->arrayLength;
+    return RampLoad(*(int *)handle, (const UA_Double *)data->data, count);
+}
+
+UA_StatusCode readRampRate( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_Double rate = RampGetRate();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &rate, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode writeRampRate(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data)
+        return RampSetRate(*(UA_Double*)data->data);
+    return UA_STATUSCODE_BADTYPEMISMATCH;
+}
+
+// writing true starts the playback, an invalid table is refused
+UA_StatusCode writeRampStart(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data)
+        if (*(UA_Boolean*)data->data) {
+            UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "ramp started");
+            return RampStart();
+        }
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode writeRampAbort(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data)
+        if (*(UA_Boolean*)data->data) {
+            UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "ramp aborted");
+            RampAbort();
+        }
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readRampState( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt32 state = RampState();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &state, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readRampElapsed( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_Double elapsed = RampElapsed();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &elapsed, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readRampSkipped( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 skipped = RampSkipped();
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
+    ScalarPoolSet(&dataValue->value, &skipped, &UA_TYPES[UA_TYPES_UINT64]);
     return UA_STATUSCODE_GOOD;
 }
 
-// callback routine for reading the voltage value
-UA_StatusCode readVoltage( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+/***********************************/
+/* readback history                */
+/***********************************/
+
+UA_StatusCode readHistoryCount( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
         const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // handle is supposed to point to VoltageReadback
-    // send request to server    
-    strcpy(command,"MRV\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert buffer to numerical value
-    // first 5 charecters are #MRV:
-    if(strncmp(response,"#MRV:",5)==0)
-        sscanf(response+5,"%lf",(double *)handle);
+    UA_UInt32 count = HistoryCount();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &count, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readHistoryOldest( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_DateTime time = HistoryOldest();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &time, &UA_TYPES[UA_TYPES_DATETIME]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readHistoryBytes( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_UInt64 bytes = HistoryBytes();
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &bytes, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+// ReadHistory(StartTime, EndTime, MaxValues) -> (Time[], Current[], Voltage[], Status[])
+// MaxValues 0 returns all samples of the interval, a client fetching the history in parts
+// continues with the time of the last sample + 1 as StartTime
+UA_StatusCode readHistoryMethod(void *methodHandle, const UA_NodeId objectId,
+        size_t inputSize, const UA_Variant *input, size_t outputSize, UA_Variant *output) {
+    if (inputSize != 3 || outputSize != 4)
+        return UA_STATUSCODE_BADARGUMENTSMISSING;
+    if (!UA_Variant_isScalar(&input[0]) || input[0].type != &UA_TYPES[UA_TYPES_DATETIME]
+            || !UA_Variant_isScalar(&input[1]) || input[1].type != &UA_TYPES[UA_TYPES_DATETIME]
+            || !UA_Variant_isScalar(&input[2]) || input[2].type != &UA_TYPES[UA_TYPES_UINT32])
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    size_t count;
+    UA_DateTime *time;
+    UA_Double *current, *voltage;
+    UA_UInt32 *status;
+    UA_StatusCode retval = HistoryRead(*(UA_DateTime *)input[0].data, *(UA_DateTime *)input[1].data,
+        *(UA_UInt32 *)input[2].data, &count, &time, &current, &voltage, &status);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    UA_Variant_setArray(&output[0], time, count, &UA_TYPES[UA_TYPES_DATETIME]);
+    UA_Variant_setArray(&output[1], current, count, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_Variant_setArray(&output[2], voltage, count, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_Variant_setArray(&output[3], status, count, &UA_TYPES[UA_TYPES_UINT32]);
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********************************/
+/* read/write methods for the      */
+/* units of the gateway            */
+/***********************************/
+
+// the handle of all unit variables is the GatewayPoint of the value
+UA_StatusCode readGatewayDouble( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    CacheValue v = GatewayGet((GatewayPoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &v.value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    setCacheQuality(&v, sourceTimeStamp, dataValue);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readGatewayStatus( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    CacheValue v = GatewayGet((GatewayPoint *)handle);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &v.word, &UA_TYPES[UA_TYPES_UINT32]);
+    setCacheQuality(&v, sourceTimeStamp, dataValue);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the output state is bit 0 of the status word
+UA_StatusCode readGatewayOutputOn( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    CacheValue v = GatewayGet((GatewayPoint *)handle);
+    UA_Boolean on = ((v.word & 1) == 1);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &on, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    setCacheQuality(&v, sourceTimeStamp, dataValue);
+    return UA_STATUSCODE_GOOD;
+}
+
+// the handle of a status bit node of a unit
+typedef struct {
+    const GatewayPoint *status;     // the status word of the unit
+    UA_UInt32 bit;
+} GatewayStatusBit;
+
+UA_StatusCode readGatewayStatusBit( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    const GatewayStatusBit *sb = handle;
+    CacheValue v = GatewayGet(sb->status);
+    UA_Boolean set = (v.word >> sb->bit) & 1;
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &set, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    setCacheQuality(&v, sourceTimeStamp, dataValue);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode writeGatewayOutputOn(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    const GatewayPoint *point = handle;
+    UA_Boolean on = false;
+    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_BOOLEAN] && data->data) {
+        on = *(UA_Boolean*)data->data;
+    }
+    UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "%s %s", gatewayUnits[point->unit].name, on ? "MON" : "MOFF");
+    return GatewaySetOutput(point->unit, on);
+}
+
+UA_StatusCode readGatewayConnected( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    UA_Boolean connected = GatewayConnected(((GatewayPoint *)handle)->unit);
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, &connected, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readGatewayRegister( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    const GatewayPoint *point = handle;
+    CacheValue v = GatewayGet(point);
+    dataValue->hasValue = true;
+    if (GatewayRegisterInfo(point->index)->type == REGISTER_INT) {
+        UA_Int32 value = (UA_Int32)lround(v.value);
+        ScalarPoolSet(&dataValue->value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    } else
+        ScalarPoolSet(&dataValue->value, &v.value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    setCacheQuality(&v, sourceTimeStamp, dataValue);
+    return UA_STATUSCODE_GOOD;
+}
+
+// setpoints and registers, Double and Int32 values are accepted
+UA_StatusCode writeGatewayValue(void *handle, const UA_NodeId nodeid,
+            const UA_Variant *data, const UA_NumericRange *range) {
+    const GatewayPoint *point = handle;
+    if (!UA_Variant_isScalar(data) || data->data == NULL)
+        return UA_STATUSCODE_GOOD;
+    UA_Double value;
+    if (data->type == &UA_TYPES[UA_TYPES_DOUBLE])
+        value = *(UA_Double *)data->data;
+    else if (data->type == &UA_TYPES[UA_TYPES_INT32])
+        value = *(UA_Int32 *)data->data;
     else
-        *(double *)handle = 999.999;
-    int result = sscanf(response+5,"%lf",(double *)handle);
+        return UA_STATUSCODE_BADTYPEMISMATCH;
+    char cmd[FASTPS_CMDSIZE];
+    UA_StatusCode retval = GatewayWrite(point, value, cmd);
+    // writes queued for the unit are logged (without the line termination)
+    if (retval == UA_STATUSCODE_GOOD)
+        UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, "%s %.*s", gatewayUnits[point->unit].name, (int)strlen(cmd)-2, cmd);
+    return retval;
+}
+
+/***********************************/
+/* generic read/write methods      */
+/* for server-internal variables   */
+/***********************************/
+
+UA_StatusCode readBoolean( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
     // set the variable value
     dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
+    ScalarPoolSet(&dataValue->value, (UA_Boolean*)handle, &UA_TYPES[UA_TYPES_BOOLEAN]);
     return UA_STATUSCODE_GOOD;
 }
 
-// callback routine for writing the voltage value
-UA_StatusCode writeVoltage(void *handle, const UA_NodeId nodeid,
+UA_StatusCode readUInt64( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+            const UA_NumericRange *range, UA_DataValue *dataValue) {
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, (UA_UInt64*)handle, &UA_TYPES[UA_TYPES_UINT64]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode readDouble( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+            const UA_NumericRange *range, UA_DataValue *dataValue) {
+    dataValue->hasValue = true;
+    ScalarPoolSet(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode writeDouble(void *handle, const UA_NodeId nodeid,
             const UA_Variant *data, const UA_NumericRange *range) {
-    // handle is supposed to point to VoltageReadback
     if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
         *(UA_Double*)handle = *(UA_Double*)data->data;
     }
-    // send request to server
-    sprintf(command,"MWV:%9.6f\r\n",*(double *)handle);
-    // UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, command);
-    TcpSendReceive();
-    return UA_STATUSCODE_GOOD;
+    return UA_STATUSCODE_GOOD;
+}
+
+// the trigger, arm, start and abort variables always read false
+// the constant is not copied, the library does not free it
+UA_StatusCode readFalse( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
+        const UA_NumericRange *range, UA_DataValue *dataValue) {
+    static UA_Boolean value = false;
+    dataValue->hasValue = true;
+    UA_Variant_setScalar(&dataValue->value, &value, &UA_TYPES[UA_TYPES_BOOLEAN]);
+    dataValue->value.storageType = UA_VARIANT_DATA_NODELETE;
+    return UA_STATUSCODE_GOOD;
+}
+
+// add a data source variable, writable if a write callback is given
+static void addDataSourceVariable(UA_NodeId parent, char *name, char *description, void *handle,
+        UA_StatusCode (*read)(void *, const UA_NodeId, UA_Boolean, const UA_NumericRange *, UA_DataValue *),
+        UA_StatusCode (*write)(void *, const UA_NodeId, const UA_Variant *, const UA_NumericRange *)) {
+    UA_VariableAttributes attr;
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US",description);
+    attr.displayName = UA_LOCALIZEDTEXT("en_US",name);
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    if (write != NULL)
+        attr.accessLevel |= UA_ACCESSLEVELMASK_WRITE;
+    UA_DataSource ds = (UA_DataSource)
+        {
+            .handle = handle,
+            .read = read,
+            .write = write
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            parent,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, name),
+            UA_NODEID_NULL,
+            attr,
+            ds,
+            NULL);
+}
+
+/***********************************/
+/* configuration                   */
+/***********************************/
+
+// The parts of the configuration which can be reloaded while the server is running
+// (<poll> with its deadbands, the refresh interval and the registers in <parameters>)
+// are parsed by the functions below, which return an error message instead of aborting.
+// All other settings only take effect at startup.
+
+// the settings of the <poll> element
+typedef struct {
+    UA_UInt32 interval;
+    UA_Double deadbandAbsolute[CACHE_SIZE];
+    UA_Double deadbandPercent[CACHE_SIZE];
+} PollConfig;
+
+// a <register> element
+typedef struct {
+    RegisterEntry entry;
+    char name[80];
+    char description[80];
+} RegisterConfig;
+
+// a <bit> of the <status> element
+typedef struct {
+    UA_UInt32 number;           // 0 is the least significant bit
+    char name[80];
+    char description[80];
+} StatusBitConfig;
+
+#define STATUS_BITS 32          // the size of the status word
+
+// the nodes of a register (same index as in the register cache)
+typedef struct {
+    RegisterConfig config;
+    UA_NodeId node;
+    UA_NodeId unitNode;         // UA_NODEID_NULL without unit
+    UA_UInt64 prefetched;       // server iteration of the last prefetch (uncached registers)
+} RegisterNode;
+
+// the <poll> settings read at startup
+static PollConfig configuredPoll;
+// the bits of the status word shown as Boolean nodes (optional)
+static StatusBitConfig statusBits[STATUS_BITS];
+static UA_UInt32 statusBitCount = 0;
+// the handles of the status bit nodes of the units (statusBitCount per unit)
+static GatewayStatusBit *gatewayStatusBits = NULL;
+
+static RegisterNode *registerNodes = NULL;
+static UA_NodeId registersFolder;
+// the indices of the registers with cache="none" (looked up by the read prefetch)
+static UA_UInt32 *uncachedRegisters = NULL;
+static UA_UInt32 uncachedCount = 0;
+
+// the repeated jobs depending on the configuration
+static UA_Guid pollJobId;
+static UA_Guid refreshJobId;
+
+// the last child element with the given name, NULL if none
+static xmlNode *findElement(xmlNode *parent, const char *name) {
+    xmlNode *found = NULL;
+    for (xmlNode *currNode = parent->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, name))
+                found = currNode;
+    return found;
+}
+
+// the (optional) <poll> element
+static const char *parsePoll(xmlNode *configurationNode, PollConfig *config) {
+    config->interval = POLL_DEFAULT_INTERVAL;
+    for (int i=0; i<CACHE_SIZE; i++) {
+        config->deadbandAbsolute[i] = 0.0;
+        config->deadbandPercent[i] = 0.0;
+    }
+    xmlNode *pollNode = findElement(configurationNode, "poll");
+    if (pollNode == NULL)
+        return NULL;
+    // the properties are parsed on every reload, all of them are freed again
+    // read the poll interval
+    xmlChar *intervalProp = xmlGetProp(pollNode,"interval");
+    if (intervalProp == NULL)
+        return "OpcUaServer : Failed to read XML <poll> interval property\n";
+    int ok = sscanf(intervalProp,"%u",&config->interval)==1;
+    xmlFree(intervalProp);
+    if (!ok)
+        return "OpcUaServer : Failed to interpret <poll> interval property\n";
+    // the server does not run repeated jobs faster than every 5 ms
+    if (config->interval<5)
+        return "OpcUaServer : <poll> interval must be at least 5 ms\n";
+    // the deadbands of the cached variables
+    for (xmlNode *currNode = pollNode->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "deadband"))
+            {
+                xmlChar *nameProp = xmlGetProp(currNode,"name");
+                if (nameProp == NULL)
+                    return "OpcUaServer : Failed to read XML <deadband> name property\n";
+                CacheEntry *entry = CacheFind(nameProp);
+                xmlFree(nameProp);
+                if (entry == NULL || entry->isWord)
+                    return "OpcUaServer : <deadband> name is not a cached floating point variable\n";
+                // both limits are optional
+                int i = entry-cache;
+                xmlChar *absoluteProp = xmlGetProp(currNode,"absolute");
+                if (absoluteProp != NULL) {
+                    ok = sscanf(absoluteProp,"%lf",&config->deadbandAbsolute[i])==1;
+                    xmlFree(absoluteProp);
+                    if (!ok)
+                        return "OpcUaServer : Failed to interpret <deadband> absolute property\n";
+                }
+                xmlChar *percentProp = xmlGetProp(currNode,"percent");
+                if (percentProp != NULL) {
+                    ok = sscanf(percentProp,"%lf",&config->deadbandPercent[i])==1;
+                    xmlFree(percentProp);
+                    if (!ok)
+                        return "OpcUaServer : Failed to interpret <deadband> percent property\n";
+                }
+            };
+    return NULL;
+}
+
+// the (optional) refresh interval of the register cache
+static const char *parseRefresh(xmlNode *parametersNode, UA_UInt32 *interval) {
+    *interval = REGISTER_DEFAULT_REFRESH;
+    xmlChar *refreshProp = xmlGetProp(parametersNode,"refresh");
+    if (refreshProp != NULL) {
+        int ok = sscanf(refreshProp,"%u",interval)==1;
+        xmlFree(refreshProp);
+        if (!ok)
+            return "OpcUaServer : Failed to interpret <parameters> refresh property\n";
+    }
+    if (*interval!=0 && *interval<5)
+        return "OpcUaServer : <parameters> refresh must be at least 5 ms\n";
+    return NULL;
+}
+
+// one <register> element
+static const char *parseRegister(xmlNode *node, RegisterConfig *config) {
+    config->entry = (RegisterEntry){ .type = REGISTER_DOUBLE, .unit = "",
+                                     .min = -INFINITY, .max = INFINITY, .policy = REGISTER_REFRESH };
+    // the properties are parsed on every reload, all of them are freed again
+    // first the register number
+    xmlChar *numberProp = xmlGetProp(node,"number");
+    if (numberProp == NULL)
+        return "OpcUaServer : Failed to read XML <register> number property\n";
+    int ok = sscanf(numberProp,"%u",&config->entry.number)==1;
+    xmlFree(numberProp);
+    if (!ok)
+        return "OpcUaServer : Failed to interpret <register> number property\n";
+    // second the node name
+    xmlChar *nameProp = xmlGetProp(node,"name");
+    ok = nameProp != NULL && xmlStrlen(nameProp) != 0;
+    if (ok)
+        xmlStrPrintf(config->name, sizeof(config->name), "%s", nameProp);
+    xmlFree(nameProp);
+    if (!ok)
+        return "OpcUaServer : Failed to read XML <register> name property\n";
+    // third the node description
+    xmlChar *descProp = xmlGetProp(node,"description");
+    ok = descProp != NULL && xmlStrlen(descProp) != 0;
+    if (ok)
+        xmlStrPrintf(config->description, sizeof(config->description), "%s", descProp);
+    xmlFree(descProp);
+    if (!ok)
+        return "OpcUaServer : Failed to read XML <register> description property\n";
+    // the optional properties
+    xmlChar *typeProp = xmlGetProp(node,"type");
+    if (typeProp != NULL) {
+        ok = 1;
+        if (! strcmp(typeProp, "int"))
+            config->entry.type = REGISTER_INT;
+        else if (strcmp(typeProp, "double"))
+            ok = 0;
+        xmlFree(typeProp);
+        if (!ok)
+            return "OpcUaServer : Failed to interpret <register> type property\n";
+    }
+    xmlChar *unitProp = xmlGetProp(node,"unit");
+    if (unitProp != NULL) {
+        ok = xmlStrlen(unitProp) < sizeof(config->entry.unit);
+        if (ok)
+            strcpy(config->entry.unit, unitProp);
+        xmlFree(unitProp);
+        if (!ok)
+            return "OpcUaServer : <register> unit property too long\n";
+    }
+    xmlChar *minProp = xmlGetProp(node,"min");
+    if (minProp != NULL) {
+        ok = sscanf(minProp,"%lf",&config->entry.min)==1;
+        xmlFree(minProp);
+        if (!ok)
+            return "OpcUaServer : Failed to interpret <register> min property\n";
+    }
+    xmlChar *maxProp = xmlGetProp(node,"max");
+    if (maxProp != NULL) {
+        ok = sscanf(maxProp,"%lf",&config->entry.max)==1;
+        xmlFree(maxProp);
+        if (!ok)
+            return "OpcUaServer : Failed to interpret <register> max property\n";
+    }
+    xmlChar *cacheProp = xmlGetProp(node,"cache");
+    if (cacheProp != NULL) {
+        ok = 1;
+        if (! strcmp(cacheProp, "static"))
+            config->entry.policy = REGISTER_STATIC;
+        else if (! strcmp(cacheProp, "none"))
+            config->entry.policy = REGISTER_NOCACHE;
+        else if (strcmp(cacheProp, "refresh"))
+            ok = 0;
+        xmlFree(cacheProp);
+        if (!ok)
+            return "OpcUaServer : Failed to interpret <register> cache property\n";
+    }
+    return NULL;
+}
+
+// all <register> elements of the <parameters> element
+// *configs has to be freed by the caller (also after an error)
+static const char *parseRegisters(xmlNode *parametersNode, RegisterConfig **configs, UA_UInt32 *count) {
+    UA_UInt32 size = 0;
+    *configs = NULL;
+    *count = 0;
+    for (xmlNode *currNode = parametersNode->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "register"))
+            {
+                if (*count == size) {
+                    size = size == 0 ? 64 : 2*size;
+                    RegisterConfig *grown = realloc(*configs, size*sizeof(RegisterConfig));
+                    if (grown == NULL)
+                        return "OpcUaServer : Failed to allocate the register table\n";
+                    *configs = grown;
+                }
+                const char *err = parseRegister(currNode, *configs + *count);
+                if (err != NULL)
+                    return err;
+                (*count)++;
+            };
+    return NULL;
+}
+
+// the engineering unit is shown as a property of a register
+// unitNode is set to UA_NODEID_NULL for registers without unit
+static void addUnitProperty(UA_NodeId node, char *unitName, UA_NodeId *unitNode) {
+    *unitNode = UA_NODEID_NULL;
+    if (unitName[0] == '\0')
+        return;
+    UA_String unit = UA_STRING(unitName);
+    UA_VariableAttributes attr;
+    UA_VariableAttributes_init(&attr);
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","Unit");
+    attr.description = UA_LOCALIZEDTEXT("en_US","engineering unit");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_Variant_setScalarCopy(&attr.value, &unit, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Server_addVariableNode(server,
+                              UA_NODEID_NUMERIC(1, 0),
+                              node,
+                              UA_NODEID_NUMERIC(0, UA_NS0ID_HASPROPERTY),
+                              UA_QUALIFIEDNAME(1, "Unit"),
+                              UA_NODEID_NUMERIC(0, UA_NS0ID_PROPERTYTYPE),
+                              attr,
+                              NULL,
+                              unitNode);
+    UA_Variant_deleteMembers(&attr.value);
+}
+
+// create the nodes of a register
+static void addRegisterNode(int index) {
+    RegisterNode *reg = registerNodes+index;
+    UA_VariableAttributes attr;
+    UA_VariableAttributes_init(&attr);
+    attr.displayName = UA_LOCALIZEDTEXT("en_US",reg->config.name);
+    attr.description = UA_LOCALIZEDTEXT("en_US",reg->config.description);
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+    // the handle is the index in the register cache
+    // we have special routines for reading/writing registers
+    UA_DataSource ds = (UA_DataSource)
+        {
+            .handle = (void *)(uintptr_t)index,
+            .read = readRegister,
+            .write = writeRegister
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            registersFolder,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, reg->config.name),
+            UA_NODEID_NULL,
+            attr,
+            ds,
+            &reg->node);
+    addUnitProperty(reg->node, reg->config.entry.unit, &reg->unitNode);
+}
+
+// delete the nodes of a register
+static void deleteRegisterNode(RegisterNode *reg) {
+    if (!UA_NodeId_isNull(&reg->unitNode))
+        UA_Server_deleteNode(server, reg->unitNode, true);
+    UA_Server_deleteNode(server, reg->node, true);
+}
+
+// a register keeps its nodes if everything shown in the address space is unchanged
+static int sameRegisterNode(const RegisterConfig *a, const RegisterConfig *b) {
+    return a->entry.number == b->entry.number && a->entry.type == b->entry.type
+        && !strcmp(a->entry.unit, b->entry.unit)
+        && !strcmp(a->name, b->name) && !strcmp(a->description, b->description);
+}
+
+// make the register cache and the nodes match a new register configuration
+// the nodes of unchanged registers are kept together with the monitored items of the clients,
+// the others are deleted and created anew
+// (no request of the OPC UA queue may be outstanding)
+// return the number of registers which kept their nodes, -1 if out of memory (nothing changed)
+static int applyRegisters(const RegisterConfig *configs, UA_UInt32 count) {
+    UA_UInt32 oldCount = registerCount;
+    RegisterNode *nodes = malloc((count ? count : 1)*sizeof(RegisterNode));
+    RegisterEntry *entries = malloc((count ? count : 1)*sizeof(RegisterEntry));
+    UA_UInt32 *uncached = malloc((count ? count : 1)*sizeof(UA_UInt32));
+    char *used = calloc(oldCount ? oldCount : 1, 1);
+    if (nodes == NULL || entries == NULL || uncached == NULL || used == NULL) {
+        free(nodes);
+        free(entries);
+        free(uncached);
+        free(used);
+        return -1;
+    }
+    int kept = 0;
+    for (UA_UInt32 i=0; i<count; i++) {
+        nodes[i].config = configs[i];
+        nodes[i].node = UA_NODEID_NULL;
+        nodes[i].unitNode = UA_NODEID_NULL;
+        nodes[i].prefetched = 0;
+        entries[i] = configs[i].entry;
+        int old = RegisterFind(configs[i].entry.number);
+        if (old >= 0 && !used[old] && sameRegisterNode(&registerNodes[old].config, configs+i)) {
+            nodes[i].node = registerNodes[old].node;
+            nodes[i].unitNode = registerNodes[old].unitNode;
+            used[old] = 1;
+            kept++;
+        }
+    }
+    if (RegisterReplace(entries, count) != 0) {
+        free(nodes);
+        free(entries);
+        free(uncached);
+        free(used);
+        return -1;
+    }
+    for (UA_UInt32 j=0; j<oldCount; j++)
+        if (!used[j])
+            deleteRegisterNode(registerNodes+j);
+    free(registerNodes);
+    registerNodes = nodes;
+    for (UA_UInt32 i=0; i<count; i++)
+        if (UA_NodeId_isNull(&nodes[i].node)) {
+            printf("OpcUaServer : Register=%u %s\n", nodes[i].config.entry.number, nodes[i].config.name);
+            addRegisterNode(i);
+        } else {
+            // the index in the cache may have changed
+            UA_DataSource ds = (UA_DataSource)
+                {
+                    .handle = (void *)(uintptr_t)i,
+                    .read = readRegister,
+                    .write = writeRegister
+                };
+            UA_Server_setVariableNode_dataSource(server, nodes[i].node, ds);
+        }
+    UA_UInt32 n = 0;
+    for (UA_UInt32 i=0; i<count; i++)
+        if (nodes[i].config.entry.policy == REGISTER_NOCACHE)
+            uncached[n++] = i;
+    free(uncachedRegisters);
+    uncachedRegisters = uncached;
+    uncachedCount = n;
+    free(entries);
+    free(used);
+    return kept;
+}
+
+// a folder organized by parent
+static UA_NodeId addFolder(UA_NodeId parent, char *name, char *description) {
+    UA_ObjectAttributes object_attr;
+    UA_ObjectAttributes_init(&object_attr);
+    object_attr.description = UA_LOCALIZEDTEXT("en_US",description);
+    object_attr.displayName = UA_LOCALIZEDTEXT("en_US",name);
+    UA_NodeId folder;
+    UA_Server_addObjectNode(server,
+                            UA_NODEID_NUMERIC(1, 0),
+                            parent,
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                            UA_QUALIFIEDNAME(1, name),
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),
+                            object_attr,
+                            NULL,
+                            &folder);
+    return folder;
+}
+
+// create the nodes of a unit of the gateway
+// the registers are the ones configured at startup (in the order of the register cache)
+static void addGatewayUnit(UA_NodeId unitsFolder, UA_UInt32 unit, const RegisterConfig *configs, UA_UInt32 count) {
+    UA_NodeId unitFolder = addFolder(unitsFolder, gatewayUnits[unit].name, "power supply of the gateway");
+    // Device
+    UA_NodeId deviceFolder = addFolder(unitFolder, "Device", "Device");
+    UA_VariableAttributes attr;
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US","device name");
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","DeviceName");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_String name = UA_STRING(gatewayUnits[unit].name);
+    UA_Variant_setScalarCopy(&attr.value, &name, &UA_TYPES[UA_TYPES_STRING]);
+    UA_Server_addVariableNode(server,
+                              UA_NODEID_NUMERIC(1, 0),
+                              deviceFolder,
+                              UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                              UA_QUALIFIEDNAME(1, "DeviceName"),
+                              UA_NODEID_NULL,
+                              attr,
+                              NULL,
+                              NULL);
+    UA_Variant_deleteMembers(&attr.value);
+    void *status = (void *)GatewayReadback(unit, CACHE_STATUS);
+    addDataSourceVariable(deviceFolder, "DeviceStatus", "power supply internal status",
+        status, readGatewayStatus, NULL);
+    addDataSourceVariable(deviceFolder, "OutputOn", "on/off state of the device output",
+        status, readGatewayOutputOn, writeGatewayOutputOn);
+    addDataSourceVariable(deviceFolder, "Connected", "the connection to the unit is established",
+        status, readGatewayConnected, NULL);
+    for (UA_UInt32 i=0; i<statusBitCount; i++) {
+        GatewayStatusBit *sb = gatewayStatusBits + unit*statusBitCount + i;
+        sb->status = status;
+        sb->bit = statusBits[i].number;
+        addDataSourceVariable(deviceFolder, statusBits[i].name, statusBits[i].description,
+            sb, readGatewayStatusBit, NULL);
+    }
+    // SetPoint
+    UA_NodeId setpointFolder = addFolder(unitFolder, "SetPoint", "output settings");
+    addDataSourceVariable(setpointFolder, "Current", "current readback [A]",
+        (void *)GatewayReadback(unit, CACHE_CURRENT), readGatewayDouble, NULL);
+    addDataSourceVariable(setpointFolder, "Voltage", "voltage readback [V]",
+        (void *)GatewayReadback(unit, CACHE_VOLTAGE), readGatewayDouble, NULL);
+    addDataSourceVariable(setpointFolder, "CurrentSetpoint", "current setpoint [A]",
+        (void *)GatewayReadback(unit, CACHE_CURRENTSETPOINT), readGatewayDouble, writeGatewayValue);
+    addDataSourceVariable(setpointFolder, "VoltageSetpoint", "voltage setpoint [V]",
+        (void *)GatewayReadback(unit, CACHE_VOLTAGESETPOINT), readGatewayDouble, writeGatewayValue);
+    // Registers
+    UA_NodeId registerFolder = addFolder(unitFolder, "Registers", "parameter settings");
+    for (UA_UInt32 i=0; i<count; i++) {
+        UA_VariableAttributes_init(&attr);
+        attr.displayName = UA_LOCALIZEDTEXT("en_US",(char *)configs[i].name);
+        attr.description = UA_LOCALIZEDTEXT("en_US",(char *)configs[i].description);
+        attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+        UA_DataSource ds = (UA_DataSource)
+            {
+                .handle = (void *)GatewayRegister(unit, i),
+                .read = readGatewayRegister,
+                .write = writeGatewayValue
+            };
+        UA_NodeId node, unitNode;
+        UA_Server_addDataSourceVariableNode(
+                server,
+                UA_NODEID_NUMERIC(1, 0),
+                registerFolder,
+                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                UA_QUALIFIEDNAME(1, (char *)configs[i].name),
+                UA_NODEID_NULL,
+                attr,
+                ds,
+                &node);
+        addUnitProperty(node, (char *)configs[i].entry.unit, &unitNode);
+    }
 }
 
-// callback routine for reading the voltage setpoint
-// this only works if the output is on, otherwise #NAK:13 is answered
-UA_StatusCode readVoltageSetpoint( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
-        const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // send request to server    
-    strcpy(command,"MWV:?\r\n");
-    unsigned int reclen = TcpSendReceive();
-    // convert buffer to numerical value
-    // first 5 charecters are #MWV:
-    if(strncmp(response,"#MWV:",5)==0)
-        sscanf(response+5,"%lf",(double *)handle);
-    else
-        *(double *)handle = 999.999;
-    // set the variable value
-    dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
-    return UA_STATUSCODE_GOOD;
+/***********************************/
+/* read prefetch                   */
+/***********************************/
+
+// Most values are served from the caches, but the registers with cache="none"
+// and SFP-upmode need a device exchange for every read. A ReadRequest for several
+// of them would call the read callbacks one after the other, every one with its
+// own round-trip. Instead, the requests received in an iteration of the server loop
+// are decoded before the server processes them. The commands needed by all
+// their nodes are collected (every command only once) and sent in one pipelined
+// exchange. The read callbacks of the same iteration use these answers.
+// Only complete unencrypted messages are inspected, all other reads
+// fall back to their own exchange. A read must not overtake a write of the same
+// client, so a connection is not inspected further in an iteration once it sent
+// any other request (which may write a register or switch SFP-upmode).
+
+// declared in the internal header ua_types_encoding_binary.h of the library
+UA_StatusCode UA_decodeBinary(const UA_ByteString *src, size_t *offset, void *dst, const UA_DataType *type);
+
+#define PREFETCH_SPLIT 16           // connections with a split message per iteration
+
+static UA_NodeId sfpNode;
+
+// the commands collected for the current iteration
+static char prefetchCommands[MAXQUEUE][BUFSIZE];
+static char prefetchReplies[MAXQUEUE][BUFSIZE];
+static int prefetchIndex[MAXQUEUE];         // register index, -1 for UPMODE
+static unsigned int prefetchCount;
+
+static int registerPrefetched(int index) {
+    return registerNodes[index].prefetched == serverIteration;
 }
 
-UA_StatusCode readRegister( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
-        const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // handle is supposed to point to the (unsigned short) register number
-    unsigned short index = *((unsigned short *)handle);
-    double value;
-    sprintf(command,"MRG:%d\r\n",index);
-    // UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, command);
-    unsigned int reclen = TcpSendReceive();
-    // TODO: check reclen
-    // convert buffer to numerical value
-    // first 8 charecters are #MRG:??:
-    int result = sscanf(response+8,"%lf",&value);
-    // TODO: check result
-    // set the variable value
-    dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)&value, &UA_TYPES[UA_TYPES_DOUBLE]);
-    return UA_STATUSCODE_GOOD;
+// a written register is read anew by the following reads of the iteration
+static void registerUnprefetch(int index) {
+    registerNodes[index].prefetched = 0;
 }
 
-UA_StatusCode writeRegister(void *handle, const UA_NodeId nodeid,
-            const UA_Variant *data, const UA_NumericRange *range) {
-    // handle is supposed to point to the (unsigned short) register number
-    unsigned short index = *((unsigned short *)handle);
-    double value;
-    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
-        value = *(double *)data->data;
-        // register writes are logged
-        sprintf(command,"MWG:%d:%lf",index,value);
-        UA_LOG_INFO(logger, UA_LOGCATEGORY_USERLAND, command);
-        // send request to server
-        sprintf(command,"MWG:%d:%lf\r\n",index,value);
-        TcpSendReceive();
-        printf("MWG response : %s",response);
+// add the command needed to read a node (if any and not yet collected)
+static void prefetchNode(const UA_NodeId *node) {
+    if (prefetchCount == MAXQUEUE)
+        return;
+    if (UA_NodeId_equal(node, &sfpNode)) {
+        if (upmodePrefetched != serverIteration) {
+            upmodePrefetched = serverIteration;
+            strcpy(prefetchCommands[prefetchCount], "UPMODE\r\n");
+            prefetchIndex[prefetchCount++] = -1;
+        }
+        return;
+    }
+    for (UA_UInt32 k=0; k<uncachedCount; k++) {
+        UA_UInt32 i = uncachedRegisters[k];
+        if (UA_NodeId_equal(node, &registerNodes[i].node)) {
+            if (registerNodes[i].prefetched != serverIteration) {
+                registerNodes[i].prefetched = serverIteration;
+                FastPsFormatRegisterRead(prefetchCommands[prefetchCount], registerNodes[i].config.entry.number);
+                prefetchIndex[prefetchCount++] = i;
+            }
+            return;
+        }
     }
-    return UA_STATUSCODE_GOOD;
 }
 
-/***********************************/
-/* generic read/write methods      */
-/* for server-internal variables   */
-/***********************************/
+// the nodes of the ReadRequests in the chunks of a received message
+// return 0 if the message does not end with a complete chunk
+// or contains another request, the following reads are then not prefetched
+static int prefetchMessage(const UA_ByteString *message) {
+    size_t pos = 0;
+    while (pos < message->length) {
+        if (pos + 8 > message->length)
+            return 0;
+        const UA_Byte *p = message->data + pos;
+        size_t size = p[4] | p[5]<<8 | p[6]<<16 | (size_t)p[7]<<24;
+        if (size < 8 || pos + size > message->length)
+            return 0;
+        // an intermediate chunk belongs to a message which cannot be inspected
+        if (!memcmp(p, "MSGC", 4))
+            return 0;
+        // a final chunk with the message, security and sequence headers (24 bytes)
+        if (!memcmp(p, "MSGF", 4)) {
+            UA_ByteString chunk = { size, (UA_Byte *)p };
+            size_t offset = 24;
+            UA_NodeId type;
+            if (UA_decodeBinary(&chunk, &offset, &type, &UA_TYPES[UA_TYPES_NODEID]) != UA_STATUSCODE_GOOD)
+                return 0;
+            int read = type.namespaceIndex == 0 && type.identifierType == UA_NODEIDTYPE_NUMERIC
+                && type.identifier.numeric == UA_NS0ID_READREQUEST + UA_ENCODINGOFFSET_BINARY;
+            UA_NodeId_deleteMembers(&type);
+            if (!read)
+                return 0;
+            UA_ReadRequest request;
+            if (UA_decodeBinary(&chunk, &offset, &request, &UA_TYPES[UA_TYPES_READREQUEST]) != UA_STATUSCODE_GOOD)
+                return 0;
+            for (size_t i=0; i<request.nodesToReadSize; i++)
+                if (request.nodesToRead[i].attributeId == UA_ATTRIBUTEID_VALUE)
+                    prefetchNode(&request.nodesToRead[i].nodeId);
+            UA_ReadRequest_deleteMembers(&request);
+        }
+        pos += size;
+    }
+    return 1;
+}
 
-UA_StatusCode readBoolean( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
-        const UA_NumericRange *range, UA_DataValue *dataValue) {
-    // set the variable value
-    dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Boolean*)handle, &UA_TYPES[UA_TYPES_BOOLEAN]);
-    return UA_STATUSCODE_GOOD;
+static void prefetchReads(const UA_Job *jobs, size_t count) {
+    prefetchCount = 0;
+    // a message continuing a half-received one cannot be decoded on its own,
+    // that of the previous iteration is kept by the connection, one of this iteration
+    // (several messages of a connection) is recorded here,
+    // as well as the connections which sent another request than a read
+    const UA_Connection *split[PREFETCH_SPLIT];
+    unsigned int splitCount = 0;
+    for (size_t j=0; j<count; j++) {
+        if (jobs[j].type != UA_JOBTYPE_BINARYMESSAGE_NETWORKLAYER)
+            continue;
+        const UA_Connection *c = jobs[j].job.binaryMessage.connection;
+        int skip = 0;
+        for (unsigned int k=0; k<splitCount; k++)
+            if (split[k] == c)
+                skip = 1;
+        if (skip)
+            continue;
+        if (c->incompleteMessage.length > 0 || !prefetchMessage(&jobs[j].job.binaryMessage.message)) {
+            if (splitCount == PREFETCH_SPLIT)
+                break;
+            split[splitCount++] = c;
+        }
+    }
+    if (prefetchCount == 0)
+        return;
+    DeviceExchange(&uaQueue, prefetchCommands, prefetchReplies, prefetchCount);
+    for (unsigned int k=0; k<prefetchCount; k++)
+        if (prefetchIndex[k] < 0)
+            strcpy(upmodeReply, prefetchReplies[k]);
+        else
+            RegisterStoreReply(prefetchIndex[k], prefetchReplies[k]);
 }
 
-UA_StatusCode readUInt64( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
-            const UA_NumericRange *range, UA_DataValue *dataValue) {
-    dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_UInt64*)handle, &UA_TYPES[UA_TYPES_UINT64]);
-    return UA_STATUSCODE_GOOD;
+// (re-)start the repeated job polling the device
+static void schedulePoll(UA_UInt32 interval) {
+    static int scheduled = 0;
+    if (scheduled)
+        UA_Server_removeRepeatedJob(server, pollJobId);
+    UA_Job pollJob = (UA_Job)
+        {
+            .type = UA_JOBTYPE_METHODCALL,
+            .job.methodCall = { .method = pollDevice, .data = NULL }
+        };
+    UA_Server_addRepeatedJob(server, pollJob, interval, &pollJobId);
+    scheduled = 1;
+    pollInterval = interval;
 }
 
-UA_StatusCode readDouble( void *handle, const UA_NodeId nodeid, UA_Boolean sourceTimeStamp,
-            const UA_NumericRange *range, UA_DataValue *dataValue) {
-    dataValue->hasValue = true;
-    UA_Variant_setScalarCopy(&dataValue->value, (UA_Double*)handle, &UA_TYPES[UA_TYPES_DOUBLE]);
-    return UA_STATUSCODE_GOOD;
+// (re-)start the repeated job refreshing the register cache, 0 stops it
+static void scheduleRefresh(UA_UInt32 interval) {
+    static int scheduled = 0;
+    if (scheduled)
+        UA_Server_removeRepeatedJob(server, refreshJobId);
+    scheduled = 0;
+    if (interval != 0) {
+        UA_Job refreshJob = (UA_Job)
+            {
+                .type = UA_JOBTYPE_METHODCALL,
+                .job.methodCall = { .method = refreshRegisters, .data = NULL }
+            };
+        UA_Server_addRepeatedJob(server, refreshJob, interval, &refreshJobId);
+        scheduled = 1;
+    }
+    registerRefreshInterval = interval;
 }
 
-UA_StatusCode writeDouble(void *handle, const UA_NodeId nodeid,
-            const UA_Variant *data, const UA_NumericRange *range) {
-    if(UA_Variant_isScalar(data) && data->type == &UA_TYPES[UA_TYPES_DOUBLE] && data->data) {
-        *(UA_Double*)handle = *(UA_Double*)data->data;
+// re-read /etc/opcua.xml and apply the poll, deadband, refresh and register settings
+// the file is checked completely before anything is changed
+// return 0 on success, -1 if the configuration was rejected
+static int reloadConfiguration() {
+    PollConfig poll;
+    UA_UInt32 refresh;
+    RegisterConfig *configs = NULL;
+    UA_UInt32 count = 0;
+    const char *err = NULL;
+    xmlDocPtr doc = xmlReadFile("/etc/opcua.xml", NULL, 0);
+    if (doc == NULL) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_SERVER, "reload : failed to parse XML config file");
+        return -1;
     }
-    return UA_STATUSCODE_GOOD;
+    xmlNode *rootNode = xmlDocGetRootElement(doc);
+    xmlNode *configurationNode = NULL;
+    for (xmlNode *currNode = rootNode; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "configuration"))
+                configurationNode = currNode;
+    xmlNode *parametersNode = configurationNode ? findElement(configurationNode, "parameters") : NULL;
+    if (parametersNode == NULL)
+        err = "OpcUaServer : Failed to find XML <parameters> node\n";
+    if (err == NULL)
+        err = parsePoll(configurationNode, &poll);
+    if (err == NULL)
+        err = parseRefresh(parametersNode, &refresh);
+    if (err == NULL)
+        err = parseRegisters(parametersNode, &configs, &count);
+    xmlFreeDoc(doc);
+    if (err != NULL) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_SERVER, "reload rejected : %s", err);
+        free(configs);
+        return -1;
+    }
+    // the I/O thread must not work on the register table while it is replaced
+    if (!DeviceQueueFlush(&uaQueue, DEVICE_TIMEOUT)) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_SERVER, "reload rejected : device requests pending");
+        free(configs);
+        return -1;
+    }
+    UA_UInt32 oldCount = registerCount;
+    int kept = applyRegisters(configs, count);
+    free(configs);
+    if (kept < 0) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_SERVER, "reload rejected : out of memory");
+        return -1;
+    }
+    for (int i=0; i<CACHE_SIZE; i++)
+        CacheSetDeadband(cache+i, poll.deadbandAbsolute[i], poll.deadbandPercent[i]);
+    if (poll.interval != pollInterval)
+        schedulePoll(poll.interval);
+    if (refresh != registerRefreshInterval)
+        scheduleRefresh(refresh);
+    // the new registers are read at once
+    refreshRegisters(server, NULL);
+    UA_LOG_INFO(logger, UA_LOGCATEGORY_SERVER,
+        "configuration reloaded : %d registers kept, %u added, %u removed, poll %u ms, refresh %u ms",
+        kept, count-kept, oldCount-kept, pollInterval, registerRefreshInterval);
+    return 0;
 }
 
-/***********************************/
-/* main program                    */
-/***********************************/
+// method without arguments
+UA_StatusCode reloadMethod(void *methodHandle, const UA_NodeId objectId,
+            size_t inputSize, const UA_Variant *input,
+            size_t outputSize, UA_Variant *output) {
+    if (reloadConfiguration() != 0)
+        return UA_STATUSCODE_BADCONFIGURATIONERROR;
+    return UA_STATUSCODE_GOOD;
+}
 
-int main(int argc, char *argv[])
+// read the startup settings from /etc/opcua.xml into the global variables
+// and the (poll and register) settings which can also be reloaded
+// the program is aborted if the file is not valid
+static void readConfigFile(RegisterConfig **registers, UA_UInt32 *count)
 {
-
-    // server will be running until we receive a SIGINT or SIGTERM
-    signal(SIGINT,  stopHandler);
-    signal(SIGTERM, stopHandler);
-
-    //***********************************
-    // parse configuration XML-file
-    //***********************************
-    LIBXML_TEST_VERSION                 // initialize the XML library and check potential ABI mismatches
     char buf[80];                       // buffer for reading strings
     int buflen;                         // number of valid characters in the buffer
     xmlDocPtr doc;                      // the resulting document tree
@@ -501,9 +2172,33 @@ int main(int argc, char *argv[])
     if (buflen == 0)
         Die("OpcUaServer : Failed to read XML <opcua> port property\n");
     buf[buflen] = '\0';         // string termination
-    if (sscanf(buf,"%d",&serverPortNumber)<1)
+    if (sscanf(buf,"%hu",&serverPortNumber)<1)
         Die("OpcUaServer : Failed to interpret <opcua> port property\n");
-    printf("OpcUaServer : OPC-UA port=%d\n", serverPortNumber);
+    // the network layer (optional)
+    xmlChar *networkProp = xmlGetProp(opcuaNode,"network");
+    if (networkProp != NULL) {
+        if (! strcmp(networkProp, "epoll"))
+            networkEpoll = 1;
+        else if (strcmp(networkProp, "select"))
+            Die("OpcUaServer : Failed to interpret <opcua> network property\n");
+    }
+    xmlChar *connectionsProp = xmlGetProp(opcuaNode,"connections");
+    if (connectionsProp != NULL)
+        if (sscanf(connectionsProp,"%u",&networkConnections)<1 || networkConnections == 0)
+            Die("OpcUaServer : Failed to interpret <opcua> connections property\n");
+    xmlChar *bufferMemoryProp = xmlGetProp(opcuaNode,"buffermemory");
+    if (bufferMemoryProp != NULL) {
+        if (sscanf(bufferMemoryProp,"%u",&bufferMemory)<1 || bufferMemory == 0)
+            Die("OpcUaServer : Failed to interpret <opcua> buffermemory property\n");
+        if (!networkEpoll)
+            Die("OpcUaServer : <opcua> buffermemory requires network=\"epoll\"\n");
+    }
+    xmlChar *bufferSizeProp = xmlGetProp(opcuaNode,"buffersize");
+    if (bufferSizeProp != NULL)
+        if (sscanf(bufferSizeProp,"%u",&bufferSize)<1 || bufferSize<BUFFERPOOL_MINSIZE || bufferSize>BUFFERPOOL_DEFAULTSIZE)
+            Die("OpcUaServer : Failed to interpret <opcua> buffersize property\n");
+    if (bufferMemory != 0 && bufferMemory/bufferSize < 2*BUFFERPOOL_RESERVE)
+        Die("OpcUaServer : <opcua> buffermemory is too small for the buffer size\n");
     // find the device node
     xmlNode *deviceNode = NULL;
     for (xmlNode *currNode = configurationNode->children; currNode; currNode = currNode->next)
@@ -518,8 +2213,7 @@ int main(int argc, char *argv[])
     if (buflen == 0)
         Die("OpcUaServer : Failed to read XML <opcua/device> name property\n");
     buf[buflen] = '\0';         // string termination
-    printf("OpcUaServer : DeviceName=%s\n", buf);
-    UA_String DeviceName = UA_STRING(buf);
+    strcpy(deviceName, buf);
     // find the parameters node
     xmlNode *parametersNode = NULL;
     for (xmlNode *currNode = configurationNode->children; currNode; currNode = currNode->next)
@@ -528,32 +2222,488 @@ int main(int argc, char *argv[])
                 parametersNode = currNode;
     if (parametersNode == NULL)
         Die("OpcUaServer : Failed to find XML <parameters> node\n");
+    // the (optional) refresh interval of the register cache
+    UA_UInt32 refreshInterval;
+    const char *configError = parseRefresh(parametersNode, &refreshInterval);
+    if (configError != NULL)
+        Die((char *)configError);
+    registerRefreshInterval = refreshInterval;
+    // the (optional) poll node
+    configError = parsePoll(configurationNode, &configuredPoll);
+    if (configError != NULL)
+        Die((char *)configError);
+    // find the (optional) setpoints node
+    xmlNode *setpointsNode = NULL;
+    for (xmlNode *currNode = configurationNode->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "setpoints"))
+                setpointsNode = currNode;
+    if (setpointsNode != NULL)
+    {
+        xmlChar *coalesceProp = xmlGetProp(setpointsNode,"coalesce");
+        if (coalesceProp != NULL)
+            setpointCoalescing = (! strcmp(coalesceProp, "true"));
+        xmlChar *flushProp = xmlGetProp(setpointsNode,"interval");
+        if (flushProp != NULL)
+            if (sscanf(flushProp,"%u",&setpointFlushInterval)<1)
+                Die("OpcUaServer : Failed to interpret <setpoints> interval property\n");
+        if (setpointFlushInterval<5)
+            Die("OpcUaServer : <setpoints> interval must be at least 5 ms\n");
+    }
+    // find the (optional) udp node
+    xmlNode *udpNode = NULL;
+    for (xmlNode *currNode = configurationNode->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "udp"))
+                udpNode = currNode;
+    if (udpNode != NULL)
+    {
+        // read the port number
+        xmlChar *udpPortProp = xmlGetProp(udpNode,"port");
+        buflen = xmlStrPrintf(buf, 80, "%s", udpPortProp);
+        if (buflen == 0)
+            Die("OpcUaServer : Failed to read XML <udp> port property\n");
+        buf[buflen] = '\0';         // string termination
+        if (sscanf(buf,"%hu",&udpPortNumber)<1)
+            Die("OpcUaServer : Failed to interpret <udp> port property\n");
+        // the maximum age of cached readbacks is optional, default is the poll interval
+        udpMaxAge = configuredPoll.interval;
+        xmlChar *maxageProp = xmlGetProp(udpNode,"maxage");
+        if (maxageProp != NULL)
+            if (sscanf(maxageProp,"%u",&udpMaxAge)<1)
+                Die("OpcUaServer : Failed to interpret <udp> maxage property\n");
+    }
+    // find the (optional) multicast node
+    xmlNode *multicastNode = findElement(configurationNode, "multicast");
+    if (multicastNode != NULL)
+    {
+        // the group is required, all other properties are optional
+        xmlChar *groupProp = xmlGetProp(multicastNode,"group");
+        struct in_addr group;
+        if (groupProp == NULL || xmlStrlen(groupProp) >= sizeof(multicastGroup)
+                || inet_pton(AF_INET, groupProp, &group) != 1 || !IN_MULTICAST(ntohl(group.s_addr)))
+            Die("OpcUaServer : Failed to interpret <multicast> group property\n");
+        strcpy(multicastGroup, groupProp);
+        xmlChar *mcPortProp = xmlGetProp(multicastNode,"port");
+        if (mcPortProp != NULL)
+            if (sscanf(mcPortProp,"%hu",&multicastPort)<1)
+                Die("OpcUaServer : Failed to interpret <multicast> port property\n");
+        // the default interval is the poll interval
+        multicastInterval = configuredPoll.interval;
+        xmlChar *mcIntervalProp = xmlGetProp(multicastNode,"interval");
+        if (mcIntervalProp != NULL)
+            if (sscanf(mcIntervalProp,"%u",&multicastInterval)<1 || multicastInterval==0)
+                Die("OpcUaServer : Failed to interpret <multicast> interval property\n");
+        xmlChar *ttlProp = xmlGetProp(multicastNode,"ttl");
+        if (ttlProp != NULL)
+            if (sscanf(ttlProp,"%u",&multicastTtl)<1 || multicastTtl>255)
+                Die("OpcUaServer : Failed to interpret <multicast> ttl property\n");
+        xmlChar *interfaceProp = xmlGetProp(multicastNode,"interface");
+        if (interfaceProp != NULL) {
+            if (xmlStrlen(interfaceProp) >= sizeof(multicastInterface)
+                    || inet_pton(AF_INET, interfaceProp, &group) != 1)
+                Die("OpcUaServer : Failed to interpret <multicast> interface property\n");
+            strcpy(multicastInterface, interfaceProp);
+        }
+    }
+    // find the (optional) gateway node
+    xmlNode *gatewayNode = findElement(configurationNode, "gateway");
+    if (gatewayNode != NULL)
+    {
+        // the defaults are the poll and register refresh intervals of the device
+        gatewayInterval = configuredPoll.interval;
+        xmlChar *gwIntervalProp = xmlGetProp(gatewayNode,"interval");
+        if (gwIntervalProp != NULL)
+            if (sscanf(gwIntervalProp,"%u",&gatewayInterval)<1 || gatewayInterval<5)
+                Die("OpcUaServer : Failed to interpret <gateway> interval property\n");
+        gatewayRefresh = registerRefreshInterval;
+        xmlChar *gwRefreshProp = xmlGetProp(gatewayNode,"refresh");
+        if (gwRefreshProp != NULL)
+            if (sscanf(gwRefreshProp,"%u",&gatewayRefresh)<1 || (gatewayRefresh!=0 && gatewayRefresh<5))
+                Die("OpcUaServer : Failed to interpret <gateway> refresh property\n");
+        for (xmlNode *currNode = gatewayNode->children; currNode; currNode = currNode->next)
+            if (currNode->type == XML_ELEMENT_NODE)
+                if (! strcmp(currNode->name, "unit"))
+                {
+                    gatewayUnits = realloc(gatewayUnits, (gatewayCount+1)*sizeof(GatewayUnitConfig));
+                    if (gatewayUnits == NULL)
+                        Die("OpcUaServer : Failed to allocate the gateway units\n");
+                    GatewayUnitConfig *unit = gatewayUnits + gatewayCount++;
+                    unit->port = GATEWAY_DEFAULT_PORT;
+                    xmlChar *unitNameProp = xmlGetProp(currNode,"name");
+                    if (unitNameProp == NULL || xmlStrlen(unitNameProp) == 0)
+                        Die("OpcUaServer : Failed to read XML <unit> name property\n");
+                    xmlStrPrintf(unit->name, sizeof(unit->name), "%s", unitNameProp);
+                    xmlChar *hostProp = xmlGetProp(currNode,"host");
+                    struct in_addr host;
+                    if (hostProp == NULL || xmlStrlen(hostProp) >= sizeof(unit->host)
+                            || inet_pton(AF_INET, hostProp, &host) != 1)
+                        Die("OpcUaServer : Failed to interpret <unit> host property\n");
+                    strcpy(unit->host, hostProp);
+                    xmlChar *unitPortProp = xmlGetProp(currNode,"port");
+                    if (unitPortProp != NULL)
+                        if (sscanf(unitPortProp,"%hu",&unit->port)<1)
+                            Die("OpcUaServer : Failed to interpret <unit> port property\n");
+                };
+    }
+    // find the (optional) status node
+    xmlNode *statusNode = findElement(configurationNode, "status");
+    if (statusNode != NULL)
+        for (xmlNode *currNode = statusNode->children; currNode; currNode = currNode->next)
+            if (currNode->type == XML_ELEMENT_NODE)
+                if (! strcmp(currNode->name, "bit"))
+                {
+                    if (statusBitCount == STATUS_BITS)
+                        Die("OpcUaServer : Too many <bit> elements\n");
+                    StatusBitConfig *bit = statusBits + statusBitCount++;
+                    xmlChar *numberProp = xmlGetProp(currNode,"number");
+                    if (numberProp == NULL || sscanf(numberProp,"%u",&bit->number)<1 || bit->number>=STATUS_BITS)
+                        Die("OpcUaServer : Failed to interpret <bit> number property\n");
+                    xmlChar *bitNameProp = xmlGetProp(currNode,"name");
+                    if (bitNameProp == NULL || xmlStrlen(bitNameProp) == 0)
+                        Die("OpcUaServer : Failed to read XML <bit> name property\n");
+                    xmlStrPrintf(bit->name, sizeof(bit->name), "%s", bitNameProp);
+                    for (UA_UInt32 i=0; i<statusBitCount-1; i++)
+                        if (! strcmp(statusBits[i].name, bit->name))
+                            Die("OpcUaServer : Duplicate <bit> name property\n");
+                    xmlChar *bitDescriptionProp = xmlGetProp(currNode,"description");
+                    xmlStrPrintf(bit->description, sizeof(bit->description), "%s",
+                        bitDescriptionProp != NULL ? bitDescriptionProp : bitNameProp);
+                };
+    // find the (optional) history node
+    xmlNode *historyNode = findElement(configurationNode, "history");
+    if (historyNode != NULL)
+    {
+        xmlChar *memoryProp = xmlGetProp(historyNode,"memory");
+        if (memoryProp == NULL)
+            Die("OpcUaServer : Failed to read XML <history> memory property\n");
+        if (sscanf(memoryProp,"%u",&historyMemory)<1 || historyMemory<HISTORY_MINMEMORY)
+            Die("OpcUaServer : Failed to interpret <history> memory property\n");
+    }
+    // find the (optional) trace node
+    xmlNode *traceNode = findElement(configurationNode, "trace");
+    if (traceNode != NULL)
+    {
+        xmlChar *recordsProp = xmlGetProp(traceNode,"records");
+        if (recordsProp != NULL)
+            if (sscanf(recordsProp,"%u",&traceRecords)<1 || traceRecords>(1u<<20))
+                Die("OpcUaServer : Failed to interpret <trace> records property\n");
+        xmlChar *fileProp = xmlGetProp(traceNode,"file");
+        if (fileProp != NULL) {
+            buflen = xmlStrPrintf(traceFile, sizeof(traceFile), "%s", fileProp);
+            if (buflen <= 0 || buflen >= (int)sizeof(traceFile)-1)
+                Die("OpcUaServer : Failed to interpret <trace> file property\n");
+            traceFile[buflen] = '\0';
+        }
+    }
+    // find the (optional) capture node
+    xmlNode *captureNode = NULL;
+    for (xmlNode *currNode = configurationNode->children; currNode; currNode = currNode->next)
+        if (currNode->type == XML_ELEMENT_NODE)
+            if (! strcmp(currNode->name, "capture"))
+                captureNode = currNode;
+    if (captureNode != NULL)
+    {
+        // the buffer depth is required, all other properties are optional
+        xmlChar *depthProp = xmlGetProp(captureNode,"depth");
+        if (depthProp == NULL)
+            Die("OpcUaServer : Failed to read XML <capture> depth property\n");
+        if (sscanf(depthProp,"%u",&captureDepth)<1 || captureDepth==0 || captureDepth>CAPTURE_MAXDEPTH)
+            Die("OpcUaServer : Failed to interpret <capture> depth property\n");
+        xmlChar *rateProp = xmlGetProp(captureNode,"rate");
+        if (rateProp != NULL)
+            if (sscanf(rateProp,"%lf",&captureRate)<1 || !(captureRate>=CAPTURE_MINRATE))
+                Die("OpcUaServer : Failed to interpret <capture> rate property\n");
+        xmlChar *modeProp = xmlGetProp(captureNode,"mode");
+        if (modeProp != NULL)
+            captureMode = (! strcmp(modeProp, "triggered")) ? CAPTURE_TRIGGERED : CAPTURE_CONTINUOUS;
+        xmlChar *triggerProp = xmlGetProp(captureNode,"trigger");
+        if (triggerProp != NULL)
+            captureTrigger = (! strcmp(triggerProp, "setpoint")) ? CAPTURE_TRIGGER_SETPOINT : CAPTURE_TRIGGER_MANUAL;
+        // by default half of the buffer is recorded after the trigger
+        capturePosttrigger = captureDepth/2;
+        xmlChar *postProp = xmlGetProp(captureNode,"posttrigger");
+        if (postProp != NULL)
+            if (sscanf(postProp,"%u",&capturePosttrigger)<1)
+                Die("OpcUaServer : Failed to interpret <capture> posttrigger property\n");
+    }
+    // the registers
+    configError = parseRegisters(parametersNode, registers, count);
+    if (configError != NULL)
+        Die((char *)configError);
+    xmlFreeDoc(doc);
+}
+
+// The configuration cache is a binary image of the settings read from /etc/opcua.xml.
+// It is only used while the modification time, size and contents (hash) of the XML file
+// are the same as when it was written, so editing the file needs no extra step
+// (also when the modification time stays within the same second).
+// Hashing the small file costs far less than parsing it.
+// The layout depends on the build, a cache written by another version is ignored.
+
+#define CONFIG_CACHE_MAGIC 0x43535046       // "FPSC"
+#define CONFIG_CACHE_VERSION 9
+
+typedef struct {
+    UA_UInt32 magic;
+    UA_UInt32 version;
+    UA_UInt32 registerSize;                 // sizeof(RegisterConfig)
+    UA_UInt32 registerCount;                // number of RegisterConfig following the settings
+    UA_UInt32 unitSize;                     // sizeof(GatewayUnitConfig)
+    UA_UInt32 unitCount;                    // number of GatewayUnitConfig following the registers
+    int64_t xmlTime;                        // modification time of the XML file
+    int64_t xmlSize;
+    UA_UInt64 xmlHash;                      // FNV-1a hash of the contents of the XML file
+} ConfigCacheHeader;
+
+// the global variables stored in the cache
+static const struct { void *value; size_t size; } cachedSettings[] = {
+    { &serverPortNumber, sizeof(serverPortNumber) },
+    { &networkEpoll, sizeof(networkEpoll) },
+    { &networkConnections, sizeof(networkConnections) },
+    { &bufferMemory, sizeof(bufferMemory) },
+    { &bufferSize, sizeof(bufferSize) },
+    { deviceName, sizeof(deviceName) },
+    { &registerRefreshInterval, sizeof(registerRefreshInterval) },
+    { &configuredPoll, sizeof(configuredPoll) },
+    { &setpointCoalescing, sizeof(setpointCoalescing) },
+    { &setpointFlushInterval, sizeof(setpointFlushInterval) },
+    { &udpPortNumber, sizeof(udpPortNumber) },
+    { &udpMaxAge, sizeof(udpMaxAge) },
+    { multicastGroup, sizeof(multicastGroup) },
+    { multicastInterface, sizeof(multicastInterface) },
+    { &multicastPort, sizeof(multicastPort) },
+    { &multicastInterval, sizeof(multicastInterval) },
+    { &multicastTtl, sizeof(multicastTtl) },
+    { &captureDepth, sizeof(captureDepth) },
+    { &captureRate, sizeof(captureRate) },
+    { &captureMode, sizeof(captureMode) },
+    { &captureTrigger, sizeof(captureTrigger) },
+    { &capturePosttrigger, sizeof(capturePosttrigger) },
+    { &gatewayInterval, sizeof(gatewayInterval) },
+    { &gatewayRefresh, sizeof(gatewayRefresh) },
+    { &historyMemory, sizeof(historyMemory) },
+    { &traceRecords, sizeof(traceRecords) },
+    { traceFile, sizeof(traceFile) },
+    { statusBits, sizeof(statusBits) },
+    { &statusBitCount, sizeof(statusBitCount) }
+};
+#define CACHED_SETTINGS (sizeof(cachedSettings)/sizeof(cachedSettings[0]))
+
+// the FNV-1a hash of the contents of a file
+// return 0 if the file cannot be read
+static int hashFile(const char *fileName, UA_UInt64 *hash) {
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL)
+        return 0;
+    unsigned char buffer[4096];
+    size_t n;
+    *hash = 14695981039346656037ULL;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        for (size_t i=0; i<n; i++)
+            *hash = (*hash ^ buffer[i]) * 1099511628211ULL;
+    int ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// the header describing the current XML file
+// return 0 if the file cannot be found
+static int configCacheHeader(ConfigCacheHeader *header, UA_UInt32 registers, UA_UInt32 units) {
+    struct stat xml;
+    UA_UInt64 hash;
+    if (stat("/etc/opcua.xml", &xml) != 0 || !hashFile("/etc/opcua.xml", &hash))
+        return 0;
+    *header = (ConfigCacheHeader){ CONFIG_CACHE_MAGIC, CONFIG_CACHE_VERSION,
+                                   sizeof(RegisterConfig), registers,
+                                   sizeof(GatewayUnitConfig), units, xml.st_mtime, xml.st_size, hash };
+    return 1;
+}
+
+// read the settings from the cache if it matches the XML file
+// return 0 on success, -1 if the file has to be parsed (nothing changed)
+static int loadConfigCache(const char *fileName, RegisterConfig **registers, UA_UInt32 *count) {
+    ConfigCacheHeader header, expected;
+    FILE *f = fopen(fileName, "rb");
+    if (f == NULL)
+        return -1;
+    if (fread(&header, sizeof(header), 1, f) != 1 || !configCacheHeader(&expected, header.registerCount, header.unitCount)
+            || memcmp(&header, &expected, sizeof(header)) != 0) {
+        fclose(f);
+        return -1;
+    }
+    // the settings are only copied into the variables when the file is complete
+    size_t total = 0;
+    for (size_t i=0; i<CACHED_SETTINGS; i++)
+        total += cachedSettings[i].size;
+    char *settings = malloc(total);
+    RegisterConfig *configs = malloc((header.registerCount ? header.registerCount : 1)*sizeof(RegisterConfig));
+    GatewayUnitConfig *units = malloc((header.unitCount ? header.unitCount : 1)*sizeof(GatewayUnitConfig));
+    if (settings == NULL || configs == NULL || units == NULL
+            || fread(settings, total, 1, f) != 1
+            || fread(configs, sizeof(RegisterConfig), header.registerCount, f) != header.registerCount
+            || fread(units, sizeof(GatewayUnitConfig), header.unitCount, f) != header.unitCount
+            || fgetc(f) != EOF) {
+        free(settings);
+        free(configs);
+        free(units);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    char *p = settings;
+    for (size_t i=0; i<CACHED_SETTINGS; i++) {
+        memcpy(cachedSettings[i].value, p, cachedSettings[i].size);
+        p += cachedSettings[i].size;
+    }
+    free(settings);
+    *registers = configs;
+    *count = header.registerCount;
+    gatewayUnits = units;
+    gatewayCount = header.unitCount;
+    return 0;
+}
+
+// store the settings in the cache
+// the file is replaced by renaming, a failure is only logged
+static void saveConfigCache(const char *fileName, const RegisterConfig *registers, UA_UInt32 count) {
+    ConfigCacheHeader header;
+    char tmpName[256];
+    if (!configCacheHeader(&header, count, gatewayCount) || snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName) >= sizeof(tmpName))
+        return;
+    FILE *f = fopen(tmpName, "wb");
+    int ok = f != NULL && fwrite(&header, sizeof(header), 1, f) == 1;
+    for (size_t i=0; ok && i<CACHED_SETTINGS; i++)
+        ok = fwrite(cachedSettings[i].value, cachedSettings[i].size, 1, f) == 1;
+    if (ok)
+        ok = fwrite(registers, sizeof(RegisterConfig), count, f) == count;
+    if (ok)
+        ok = fwrite(gatewayUnits, sizeof(GatewayUnitConfig), gatewayCount, f) == gatewayCount;
+    if (f != NULL && fclose(f) != 0)
+        ok = 0;
+    if (ok && rename(tmpName, fileName) == 0)
+        printf("OpcUaServer : configuration cached in %s\n", fileName);
+    else {
+        printf("OpcUaServer : Failed to write the configuration cache %s\n", fileName);
+        remove(tmpName);
+    }
+}
+
+/***********************************/
+/* main program                    */
+/***********************************/
+
+int main(int argc, char *argv[])
+{
+    startupStart = UA_DateTime_nowMonotonic();
+
+    // opcuaserver [-c cachefile]
+    const char *cacheFile = NULL;
+    for (int i=1; i<argc; i++)
+        if (! strcmp(argv[i], "-c") && i+1 < argc)
+            cacheFile = argv[++i];
+        else
+            Die("usage : opcuaserver [-c cachefile]\n");
+
+    // server will be running until we receive a SIGINT or SIGTERM
+    signal(SIGINT,  stopHandler);
+    signal(SIGTERM, stopHandler);
+    // and reloads the configuration on SIGHUP
+    signal(SIGHUP,  reloadHandler);
+    signal(SIGUSR1, traceHandler);
+
+    //***********************************
+    // parse configuration XML-file
+    //***********************************
+    LIBXML_TEST_VERSION                 // initialize the XML library and check potential ABI mismatches
+    RegisterConfig *registerConfigs = NULL;
+    UA_UInt32 configCount = 0;
+    if (cacheFile == NULL || loadConfigCache(cacheFile, &registerConfigs, &configCount) != 0) {
+        readConfigFile(&registerConfigs, &configCount);
+        if (cacheFile != NULL)
+            saveConfigCache(cacheFile, registerConfigs, configCount);
+    } else
+        printf("OpcUaServer : configuration loaded from %s\n", cacheFile);
+    printf("OpcUaServer : OPC-UA port=%d\n", serverPortNumber);
+    if (networkEpoll)
+        printf("OpcUaServer : epoll network layer connections=%u\n", networkConnections);
+    if (bufferMemory != 0)
+        printf("OpcUaServer : buffer pool memory=%u size=%u\n", bufferMemory, bufferSize);
+    printf("OpcUaServer : DeviceName=%s\n", deviceName);
+    printf("OpcUaServer : register refresh interval=%u ms\n", registerRefreshInterval);
+    pollInterval = configuredPoll.interval;
+    for (int i=0; i<CACHE_SIZE; i++)
+        if (configuredPoll.deadbandAbsolute[i] != 0.0 || configuredPoll.deadbandPercent[i] != 0.0) {
+            CacheSetDeadband(cache+i, configuredPoll.deadbandAbsolute[i], configuredPoll.deadbandPercent[i]);
+            printf("OpcUaServer : deadband %s absolute=%g percent=%g\n",
+                cache[i].name, cache[i].deadbandAbsolute, cache[i].deadbandPercent);
+        }
+    printf("OpcUaServer : poll interval=%u ms\n", pollInterval);
+    if (setpointCoalescing)
+        printf("OpcUaServer : setpoint coalescing interval=%u ms\n", setpointFlushInterval);
+    if (udpPortNumber != 0)
+        printf("OpcUaServer : UDP port=%d maxage=%u ms\n", udpPortNumber, udpMaxAge);
+    if (multicastGroup[0] != '\0')
+        printf("OpcUaServer : multicast group=%s port=%d interval=%u ms\n",
+            multicastGroup, multicastPort, multicastInterval);
+    if (gatewayCount != 0)
+        printf("OpcUaServer : gateway units=%u interval=%u ms refresh=%u ms\n",
+            gatewayCount, gatewayInterval, gatewayRefresh);
+    if (historyMemory != 0)
+        printf("OpcUaServer : history memory=%u bytes\n", historyMemory);
+    if (traceRecords != 0)
+        printf("OpcUaServer : trace records=%u file=%s\n", traceRecords, traceFile);
+    if (captureDepth != 0)
+        printf("OpcUaServer : capture depth=%u rate=%g Hz %s\n", captureDepth, captureRate,
+            captureMode == CAPTURE_TRIGGERED ? "triggered" : "continuous");
+    startupPhase("configuration", NULL);
 
     //***********************************
     // connect to the internal TCP/IP server
     //***********************************
-    if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
-        Die("ERROR : Failed to create socket");
-    UA_LOG_INFO(logger, UA_LOGCATEGORY_NETWORK, "TCP/IP socket opened.");
-    // Construct the server sockaddr_in structure
+    // the connection is established (and re-established when lost)
+    // by the device I/O thread, the server starts without waiting for it
     memset(&tcpserver, 0, sizeof(tcpserver));			   // clear struct
     tcpserver.sin_family = AF_INET;				           // Internet/IP
     tcpserver.sin_addr.s_addr = inet_addr("127.0.0.1");	   // IP address
     tcpserver.sin_port = htons(10001);				       // server port
-    // Establish connection
-    if (connect(sock, (struct sockaddr *) &tcpserver, sizeof(tcpserver)) < 0)
-        Die("ERROR : Failed to connect to TCP/IP server");
-    UA_LOG_INFO(logger, UA_LOGCATEGORY_NETWORK, "Connected to internal TCP/IP server.");
+    // the trace rings exist before the first thread is started
+    if (TraceInit(traceRecords) != 0)
+        Die("OpcUaServer : Failed to allocate the event trace\n");
+    TraceThread("opcua");
+    if (DeviceStart() != 0)
+        Die("ERROR : Failed to start the device I/O thread");
 
     //***********************************
     // configure the UA server
     //***********************************
     UA_ServerConfig config = UA_ServerConfig_standard;
-    UA_ServerNetworkLayer nl = UA_ServerNetworkLayerTCP(UA_ConnectionConfig_standard, serverPortNumber);
+    UA_ServerNetworkLayer nl;
+    if (networkEpoll) {
+        // with the pool the chunks are limited to the buffer size
+        UA_ConnectionConfig conf = UA_ConnectionConfig_standard;
+        if (bufferMemory != 0) {
+            if (BufferPoolInit(bufferMemory, bufferSize) != 0)
+                Die("OpcUaServer : Failed to allocate the buffer pool\n");
+            conf.recvBufferSize = conf.sendBufferSize = conf.maxMessageSize = bufferSize;
+            printf("OpcUaServer : %u network buffers in the pool\n", BufferPoolCount());
+        }
+        nl = EpollNetworkLayer(conf, serverPortNumber, networkConnections);
+    } else
+        nl = UA_ServerNetworkLayerTCP(UA_ConnectionConfig_standard, serverPortNumber);
+    if (nl.handle == NULL)
+        Die("OpcUaServer : Failed to create the network layer\n");
+    // the time spent waiting for the network is measured separately
+    tcpLayer = nl;
+    nl.getJobs = timedGetJobs;
     config.logger = logger;
     config.networkLayers = &nl;
     config.networkLayersSize = 1;
     server = UA_Server_new(config);
+    if (ScalarPoolInit())
+        printf("OpcUaServer : read values served from the scalar pool\n");
+    else
+        printf("OpcUaServer : library built without the scalar pool allocator\n");
 
     UA_ObjectAttributes object_attr;   // attributes for folders
     UA_VariableAttributes attr;        // attributes for variable nodes
@@ -588,6 +2738,7 @@ int main(int argc, char *argv[])
     attr.description = UA_LOCALIZEDTEXT("en_US","device name");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","DeviceName");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_String DeviceName = UA_STRING(deviceName);
     UA_Variant_setScalarCopy(&attr.value, &DeviceName, &UA_TYPES[UA_TYPES_STRING]);
     UA_Server_addVariableNode(server,                                       // UA_Server *server
                               UA_NODEID_NUMERIC(1, 0),                      // UA_NodeId requestedNewNodeId
@@ -601,14 +2752,13 @@ int main(int argc, char *argv[])
 
     // create the DeviceStatus variable
     // read-only
-    unsigned int DeviceStatus = 0;
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","power supply internal status");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","DeviceStatus");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ;
     UA_DataSource DeviceStatusDataSource = (UA_DataSource)
         {
-            .handle = &DeviceStatus,
+            .handle = cache+CACHE_STATUS,
             .read = readDeviceStatus,
             .write = 0
         };
@@ -624,15 +2774,14 @@ int main(int argc, char *argv[])
             NULL);
 
     // writing OutputOn as true switches on the device power output
-    // reading returns the value obtained from the status word
-    bool DeviceOutputOn = 0;
+    // reading returns the value obtained from the cached status word
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","on/off state of the device output");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","OutputOn");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
     UA_DataSource OutputOnDataSource = (UA_DataSource)
         {
-            .handle = &DeviceOutputOn,
+            .handle = cache+CACHE_STATUS,
             .read = readDeviceOutputOn,
             .write = writeDeviceOutputOn
         };
@@ -647,6 +2796,14 @@ int main(int argc, char *argv[])
             OutputOnDataSource,
             NULL);
 
+    // the configured bits of the status word
+    // reading returns the bit of the cached status word
+    for (UA_UInt32 i=0; i<statusBitCount; i++) {
+        addDataSourceVariable(DeviceFolder, statusBits[i].name, statusBits[i].description,
+            (void *)(uintptr_t)statusBits[i].number, readDeviceStatusBit, NULL);
+        printf("OpcUaServer : StatusBit=%u %s\n", statusBits[i].number, statusBits[i].name);
+    }
+
     // create the Reset variable
     // boolean value - writing true performs the reset
     // read will always return false
@@ -695,7 +2852,26 @@ int main(int argc, char *argv[])
             UA_NODEID_NULL,
             attr,
             SFPmodeDataSource,
-            NULL);
+            &sfpNode);
+
+    // the reload has no arguments
+    UA_MethodAttributes reload_attr;
+    UA_MethodAttributes_init(&reload_attr);
+    reload_attr.description = UA_LOCALIZEDTEXT("en_US","re-read the poll and register configuration from /etc/opcua.xml");
+    reload_attr.displayName = UA_LOCALIZEDTEXT("en_US","ReloadConfiguration");
+    reload_attr.executable = true;
+    reload_attr.userExecutable = true;
+    UA_Server_addMethodNode(server,
+                            UA_NODEID_NUMERIC(1, 0),
+                            DeviceFolder,
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                            UA_QUALIFIEDNAME(1, "ReloadConfiguration"),
+                            reload_attr,
+                            reloadMethod,
+                            NULL,
+                            0, NULL,
+                            0, NULL,
+                            NULL);
 
     /**************************
     SetPoint
@@ -703,6 +2879,15 @@ int main(int argc, char *argv[])
     |   Current
     |   VOltageSetpoint
     |   CurrentSetpoint
+    |   VoltageApplied
+    |   VoltageAppliedTime
+    |   CurrentApplied
+    |   CurrentAppliedTime
+    |   ScheduleCurrent()
+    |   ScheduledTime
+    |   ScheduledSentTime
+    |   ScheduledSkew
+    |   ScheduledPending
     **************************/
 
     UA_ObjectAttributes_init(&object_attr);
@@ -719,15 +2904,14 @@ int main(int argc, char *argv[])
                             NULL,                                          // UA_InstantiationCallback *instantiationCallback
                             &SetPointFolder);                                // UA_NodeId *outNewNodeId
 
-    double VoltageReadback = 0.0;
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","voltage readback [V]");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","Voltage");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ;
     UA_DataSource VoltageDataSource = (UA_DataSource)
         {
-            .handle = &VoltageReadback,
-            .read = readVoltage,
+            .handle = cache+CACHE_VOLTAGE,
+            .read = readCachedDouble,
             .write = 0
         };
     UA_Server_addDataSourceVariableNode(
@@ -741,15 +2925,14 @@ int main(int argc, char *argv[])
             VoltageDataSource,
             NULL);
 
-    double CurrentReadback = 0.0;
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","current readback [A]");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","Current");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ;
     UA_DataSource CurrentDataSource = (UA_DataSource)
         {
-            .handle = &CurrentReadback,
-            .read = readCurrent,
+            .handle = cache+CACHE_CURRENT,
+            .read = readCachedDouble,
             .write = 0
         };
     UA_Server_addDataSourceVariableNode(
@@ -766,17 +2949,15 @@ int main(int argc, char *argv[])
     // when the setpoint is written, the voltage setting in the device is updated
     // (the special writeVoltage() callback is used for that)
     // reading the setpoint returns the active setpoint value
-    // as read from the device
-    // (the special readVoltageSetpoint() callback is used for that)
-    double VoltageSetpoint = 0.0;
+    // as last sampled from the device
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","voltage setpoint [V]");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","VoltageSetpoint");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
     UA_DataSource VoltageSetpointDataSource = (UA_DataSource)
         {
-            .handle = &VoltageSetpoint,
-            .read = readVoltageSetpoint,
+            .handle = cache+CACHE_VOLTAGESETPOINT,
+            .read = readCachedDouble,
             .write = writeVoltage
         };
     UA_Server_addDataSourceVariableNode(
@@ -793,16 +2974,15 @@ int main(int argc, char *argv[])
     // when the setpoint is written, the current setting in the device is updated
     // (the special writeCurrent() callback is used for that)
     // reading the setpoint returns the active setpoint value
-    // as read from the device
-    double CurrentSetpoint = 0.0;
+    // as last sampled from the device
     UA_VariableAttributes_init(&attr);
     attr.description = UA_LOCALIZEDTEXT("en_US","current setpoint [A]");
     attr.displayName = UA_LOCALIZEDTEXT("en_US","CurrentSetpoint");
     attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
     UA_DataSource CurrentSetpointDataSource = (UA_DataSource)
         {
-            .handle = &CurrentSetpoint,
-            .read = readCurrentSetpoint,
+            .handle = cache+CACHE_CURRENTSETPOINT,
+            .read = readCachedDouble,
             .write = writeCurrent
         };
     UA_Server_addDataSourceVariableNode(
@@ -816,6 +2996,135 @@ int main(int argc, char *argv[])
             CurrentSetpointDataSource,
             NULL);
 
+    // the last voltage setpoint acknowledged by the device and the time of the acknowledge
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US","applied voltage setpoint [V]");
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","VoltageApplied");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_DataSource VoltageAppliedDataSource = (UA_DataSource)
+        {
+            .handle = setpoints+SETPOINT_VOLTAGE,
+            .read = readSetpointApplied,
+            .write = 0
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            SetPointFolder,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, "VoltageApplied"),
+            UA_NODEID_NULL,
+            attr,
+            VoltageAppliedDataSource,
+            NULL);
+
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US","time when the voltage setpoint was applied");
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","VoltageAppliedTime");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_DataSource VoltageAppliedTimeDataSource = (UA_DataSource)
+        {
+            .handle = setpoints+SETPOINT_VOLTAGE,
+            .read = readSetpointAppliedTime,
+            .write = 0
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            SetPointFolder,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, "VoltageAppliedTime"),
+            UA_NODEID_NULL,
+            attr,
+            VoltageAppliedTimeDataSource,
+            NULL);
+
+    // the last current setpoint acknowledged by the device and the time of the acknowledge
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US","applied current setpoint [A]");
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","CurrentApplied");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_DataSource CurrentAppliedDataSource = (UA_DataSource)
+        {
+            .handle = setpoints+SETPOINT_CURRENT,
+            .read = readSetpointApplied,
+            .write = 0
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            SetPointFolder,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, "CurrentApplied"),
+            UA_NODEID_NULL,
+            attr,
+            CurrentAppliedDataSource,
+            NULL);
+
+    UA_VariableAttributes_init(&attr);
+    attr.description = UA_LOCALIZEDTEXT("en_US","time when the current setpoint was applied");
+    attr.displayName = UA_LOCALIZEDTEXT("en_US","CurrentAppliedTime");
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ;
+    UA_DataSource CurrentAppliedTimeDataSource = (UA_DataSource)
+        {
+            .handle = setpoints+SETPOINT_CURRENT,
+            .read = readSetpointAppliedTime,
+            .write = 0
+        };
+    UA_Server_addDataSourceVariableNode(
+            server,
+            UA_NODEID_NUMERIC(1, 0),
+            SetPointFolder,
+            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+            UA_QUALIFIEDNAME(1, "CurrentAppliedTime"),
+            UA_NODEID_NULL,
+            attr,
+            CurrentAppliedTimeDataSource,
+            NULL);
+
+    // the current setpoint can be scheduled for a given time
+    // the requested and the actual time of the last scheduled value applied
+    UA_Argument scheduleArgs[2];
+    UA_Argument_init(&scheduleArgs[0]);
+    scheduleArgs[0].name = UA_STRING("Value");
+    scheduleArgs[0].description = UA_LOCALIZEDTEXT("en_US","current setpoint [A]");
+    scheduleArgs[0].dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+    scheduleArgs[0].valueRank = -1;
+    UA_Argument_init(&scheduleArgs[1]);
+    scheduleArgs[1].name = UA_STRING("Time");
+    scheduleArgs[1].description = UA_LOCALIZEDTEXT("en_US","time to apply the setpoint");
+    scheduleArgs[1].dataType = UA_TYPES[UA_TYPES_DATETIME].typeId;
+    scheduleArgs[1].valueRank = -1;
+    UA_MethodAttributes schedule_attr;
+    UA_MethodAttributes_init(&schedule_attr);
+    schedule_attr.description = UA_LOCALIZEDTEXT("en_US","apply a current setpoint at a given time");
+    schedule_attr.displayName = UA_LOCALIZEDTEXT("en_US","ScheduleCurrent");
+    schedule_attr.executable = true;
+    schedule_attr.userExecutable = true;
+    UA_Server_addMethodNode(server,
+                            UA_NODEID_NUMERIC(1, 0),
+                            SetPointFolder,
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                            UA_QUALIFIEDNAME(1, "ScheduleCurrent"),
+                            schedule_attr,
+                            scheduleCurrentMethod,
+                            NULL,
+                            2, scheduleArgs,
+                            0, NULL,
+                            NULL);
+    addDataSourceVariable(SetPointFolder, "ScheduledTime",
+        "requested time of the last scheduled current setpoint applied",
+        setpoints+SETPOINT_CURRENT, readSetpointScheduledTime, NULL);
+    addDataSourceVariable(SetPointFolder, "ScheduledSentTime",
+        "time when the last scheduled current setpoint was sent to the device",
+        setpoints+SETPOINT_CURRENT, readSetpointScheduledSent, NULL);
+    addDataSourceVariable(SetPointFolder, "ScheduledSkew",
+        "ScheduledSentTime - ScheduledTime [us]",
+        setpoints+SETPOINT_CURRENT, readSetpointScheduledSkew, NULL);
+    addDataSourceVariable(SetPointFolder, "ScheduledPending",
+        "number of scheduled setpoints not yet applied",
+        &scheduleQueue, readQueueDepth, NULL);
+
     /**************************
     Parameters
     |   define OPCUA variables for configuration registers
@@ -825,7 +3134,6 @@ int main(int argc, char *argv[])
     UA_ObjectAttributes_init(&object_attr);
     object_attr.description = UA_LOCALIZEDTEXT("en_US","parameter settings");
     object_attr.displayName = UA_LOCALIZEDTEXT("en_US","Registers");
-    UA_NodeId RegistersFolder;
     UA_Server_addObjectNode(server,                                        // UA_Server *server
                             UA_NODEID_NUMERIC(1, 0),                       // UA_NodeId requestedNewNodeId
                             UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),  // UA_NodeId parentNodeId
@@ -834,82 +3142,387 @@ int main(int argc, char *argv[])
                             UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),     // UA_NodeId typeDefinition
                             object_attr,                                   // UA_ObjectAttributes attr
                             NULL,                                          // UA_InstantiationCallback *instantiationCallback
-                            &RegistersFolder);                             // UA_NodeId *outNewNodeId
+                            &registersFolder);                             // UA_NodeId *outNewNodeId
+
+    // the registers are created the same way as by a reload, starting from an empty set
+    if (applyRegisters(registerConfigs, configCount) < 0)
+        Die("OpcUaServer : Failed to allocate the register table\n");
+    printf("OpcUaServer : %u registers\n", registerCount);
+
+    // the whole parameter set at once
+    addDataSourceVariable(registersFolder, "AllRegisters", "all registers in the order of RegisterNumbers",
+                          NULL, readAllRegisters, NULL);
+    addDataSourceVariable(registersFolder, "RegisterNumbers", "the numbers of the configured registers",
+                          NULL, readRegisterNumbers, NULL);
+    addDataSourceVariable(registersFolder, "Refresh", "writing true reads all registers from the device",
+                          NULL, readFalse, writeRegisterRefresh);
+    addDataSourceVariable(registersFolder, "ModificationCount", "number of changes of register values",
+                          NULL, readRegisterModifications, NULL);
+
+    UA_Argument regArgs[2];
+    UA_Argument_init(&regArgs[0]);
+    regArgs[0].name = UA_STRING("Numbers");
+    regArgs[0].description = UA_LOCALIZEDTEXT("en_US","register numbers");
+    regArgs[0].dataType = UA_TYPES[UA_TYPES_UINT32].typeId;
+    regArgs[0].valueRank = 1;
+    UA_Argument_init(&regArgs[1]);
+    regArgs[1].name = UA_STRING("Values");
+    regArgs[1].description = UA_LOCALIZEDTEXT("en_US","register values");
+    regArgs[1].dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+    regArgs[1].valueRank = 1;
+    UA_Argument ackArg;
+    UA_Argument_init(&ackArg);
+    ackArg.name = UA_STRING("Acknowledged");
+    ackArg.description = UA_LOCALIZEDTEXT("en_US","the device acknowledged the write");
+    ackArg.dataType = UA_TYPES[UA_TYPES_BOOLEAN].typeId;
+    ackArg.valueRank = 1;
+    UA_MethodAttributes method_attr;
+    UA_MethodAttributes_init(&method_attr);
+    method_attr.description = UA_LOCALIZEDTEXT("en_US","write a set of registers in one pipelined exchange");
+    method_attr.displayName = UA_LOCALIZEDTEXT("en_US","WriteRegisters");
+    method_attr.executable = true;
+    method_attr.userExecutable = true;
+    UA_Server_addMethodNode(server,
+                            UA_NODEID_NUMERIC(1, 0),
+                            registersFolder,
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                            UA_QUALIFIEDNAME(1, "WriteRegisters"),
+                            method_attr,
+                            writeRegistersMethod,
+                            NULL,
+                            2, regArgs,
+                            1, &ackArg,
+                            NULL);
 
-    // here we store the register numbers
-    unsigned short RegNr[maxreg];
-    // these are structs for acessing the data
-    UA_DataSource RegDS[maxreg];
-    int loopindex=0;
-    for (xmlNode *currNode = parametersNode->children; currNode; currNode = currNode->next)
-        if (currNode->type == XML_ELEMENT_NODE)
-            if (! strcmp(currNode->name, "register"))
+    /**************************
+    Diagnostics
+    |   one folder per latency histogram (durations in us)
+    |   the event counters
+    |   the request queues to the device I/O thread
+    **************************/
+
+    UA_ObjectAttributes_init(&object_attr);
+    object_attr.description = UA_LOCALIZEDTEXT("en_US","server diagnostics");
+    object_attr.displayName = UA_LOCALIZEDTEXT("en_US","Diagnostics");
+    UA_NodeId DiagnosticsFolder;
+    UA_Server_addObjectNode(server,                                        // UA_Server *server
+                            UA_NODEID_NUMERIC(1, 0),                       // UA_NodeId requestedNewNodeId
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),  // UA_NodeId parentNodeId
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),      // UA_NodeId referenceTypeId
+                            UA_QUALIFIEDNAME(1, "Diagnostics"),            // UA_QualifiedName browseName
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),     // UA_NodeId typeDefinition
+                            object_attr,                                   // UA_ObjectAttributes attr
+                            NULL,                                          // UA_InstantiationCallback *instantiationCallback
+                            &DiagnosticsFolder);                           // UA_NodeId *outNewNodeId
+
+    for (int i=0; i<DIAG_HISTOGRAMS; i++)
+    {
+        DiagHistogram *h = diagHistograms+i;
+        UA_ObjectAttributes_init(&object_attr);
+        object_attr.description = UA_LOCALIZEDTEXT("en_US","latency histogram");
+        object_attr.displayName = UA_LOCALIZEDTEXT("en_US",h->name);
+        UA_NodeId HistogramFolder;
+        UA_Server_addObjectNode(server,
+                                UA_NODEID_NUMERIC(1, 0),
+                                DiagnosticsFolder,
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                UA_QUALIFIEDNAME(1, h->name),
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),
+                                object_attr,
+                                NULL,
+                                &HistogramFolder);
+        addDataSourceVariable(HistogramFolder, "Count", "number of recorded durations", h, readDiagCount, NULL);
+        addDataSourceVariable(HistogramFolder, "Mean", "mean duration [us]", h, readDiagMean, NULL);
+        addDataSourceVariable(HistogramFolder, "P99", "99th percentile of the durations [us]", h, readDiagP99, NULL);
+        addDataSourceVariable(HistogramFolder, "Max", "longest duration [us]", h, readDiagMax, NULL);
+        addDataSourceVariable(HistogramFolder, "Histogram",
+            "counts per bucket, bucket k holds durations from 2^k to 2^(k+1) us", h, readDiagBuckets, NULL);
+    }
+    for (int i=0; i<DIAG_COUNTERS; i++)
+        addDataSourceVariable(DiagnosticsFolder, (char *)diagCounterNames[i], "event counter",
+            diagCounters+i, readDiagCounter, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "CacheHitRate", "fraction of the reads served from the cache",
+        NULL, readCacheHitRate, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "UaQueueDepth", "outstanding device requests of the OPC UA server",
+        &uaQueue, readQueueDepth, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "UaQueueMaxDepth", "largest number of outstanding device requests of the OPC UA server",
+        &uaQueue, readQueueMaxDepth, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "UdpQueueDepth", "outstanding device requests of the UDP server",
+        &udpQueue, readQueueDepth, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "UdpQueueMaxDepth", "largest number of outstanding device requests of the UDP server",
+        &udpQueue, readQueueMaxDepth, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "PoolInUse", "values of the scalar pool in flight",
+        NULL, readPoolInUse, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "PoolMaxInUse", "largest number of values of the scalar pool in flight",
+        NULL, readPoolMaxInUse, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "BufferPoolInUse", "network buffers of the pool in use",
+        NULL, readBufferPoolInUse, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "BufferPoolMaxInUse", "largest number of network buffers of the pool in use",
+        NULL, readBufferPoolMaxInUse, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "StartupTime", "time from the program start until the endpoint was listening [ms]",
+        &startupListenTime, readDouble, NULL);
+    addDataSourceVariable(DiagnosticsFolder, "FirstReadbackTime", "time from the program start until the first readbacks were obtained [ms]",
+        &startupReadbackTime, readDouble, NULL);
+    if (traceRecords != 0)
+    {
+        UA_Argument traceArg;
+        UA_Argument_init(&traceArg);
+        traceArg.name = UA_STRING("Records");
+        traceArg.description = UA_LOCALIZEDTEXT("en_US","number of trace records written");
+        traceArg.dataType = UA_TYPES[UA_TYPES_UINT32].typeId;
+        traceArg.valueRank = -1;
+        UA_MethodAttributes trace_attr;
+        UA_MethodAttributes_init(&trace_attr);
+        trace_attr.description = UA_LOCALIZEDTEXT("en_US","write the event trace to the configured file");
+        trace_attr.displayName = UA_LOCALIZEDTEXT("en_US","DumpTrace");
+        trace_attr.executable = true;
+        trace_attr.userExecutable = true;
+        UA_Server_addMethodNode(server,
+                                UA_NODEID_NUMERIC(1, 0),
+                                DiagnosticsFolder,
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                UA_QUALIFIEDNAME(1, "DumpTrace"),
+                                trace_attr,
+                                dumpTraceMethod,
+                                NULL,
+                                0, NULL,
+                                1, &traceArg,
+                                NULL);
+    }
+
+    /**************************
+    Capture
+    |   the waveform capture buffer (only if configured)
+    **************************/
+
+    // the signal numbers for the handles of the array variables
+    static int captureSignals[CAPTURE_SIGNALS] = { CAPTURE_CURRENT, CAPTURE_VOLTAGE, CAPTURE_TIME };
+    if (captureDepth != 0)
+    {
+        UA_ObjectAttributes_init(&object_attr);
+        object_attr.description = UA_LOCALIZEDTEXT("en_US","waveform capture");
+        object_attr.displayName = UA_LOCALIZEDTEXT("en_US","Capture");
+        UA_NodeId CaptureFolder;
+        UA_Server_addObjectNode(server,                                        // UA_Server *server
+                                UA_NODEID_NUMERIC(1, 0),                       // UA_NodeId requestedNewNodeId
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),  // UA_NodeId parentNodeId
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),      // UA_NodeId referenceTypeId
+                                UA_QUALIFIEDNAME(1, "Capture"),                // UA_QualifiedName browseName
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),     // UA_NodeId typeDefinition
+                                object_attr,                                   // UA_ObjectAttributes attr
+                                NULL,                                          // UA_InstantiationCallback *instantiationCallback
+                                &CaptureFolder);                               // UA_NodeId *outNewNodeId
+        addDataSourceVariable(CaptureFolder, "Current", "captured current readbacks [A], oldest first",
+            captureSignals+CAPTURE_CURRENT, readCaptureSignal, NULL);
+        addDataSourceVariable(CaptureFolder, "Voltage", "captured voltage readbacks [V], oldest first",
+            captureSignals+CAPTURE_VOLTAGE, readCaptureSignal, NULL);
+        addDataSourceVariable(CaptureFolder, "Time", "times of the captured samples, oldest first",
+            captureSignals+CAPTURE_TIME, readCaptureSignal, NULL);
+        addDataSourceVariable(CaptureFolder, "Count", "number of captured samples",
+            NULL, readCaptureCount, NULL);
+        addDataSourceVariable(CaptureFolder, "State", "0 armed, 1 recording after trigger, 2 frozen",
+            NULL, readCaptureState, NULL);
+        addDataSourceVariable(CaptureFolder, "Trigger", "writing true triggers the capture",
+            NULL, readFalse, writeCaptureTrigger);
+        addDataSourceVariable(CaptureFolder, "Arm", "writing true clears the buffer and restarts the capture",
+            NULL, readFalse, writeCaptureArm);
+        addDataSourceVariable(CaptureFolder, "TriggerTime", "time of the last trigger",
+            NULL, readCaptureTriggerTime, NULL);
+        addDataSourceVariable(CaptureFolder, "Overruns", "samples missed because the device was too slow",
+            NULL, readCaptureOverruns, NULL);
+    }
+
+    /**************************
+    Ramp
+    |   the table and the control of the ramp playback
+    **************************/
+
+    static int rampColumns[RAMP_COLUMNS] = { RAMP_TIME, RAMP_CURRENT };
+    UA_ObjectAttributes_init(&object_attr);
+    object_attr.description = UA_LOCALIZEDTEXT("en_US","current ramp playback");
+    object_attr.displayName = UA_LOCALIZEDTEXT("en_US","Ramp");
+    UA_NodeId RampFolder;
+    UA_Server_addObjectNode(server,                                        // UA_Server *server
+                            UA_NODEID_NUMERIC(1, 0),                       // UA_NodeId requestedNewNodeId
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),  // UA_NodeId parentNodeId
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),      // UA_NodeId referenceTypeId
+                            UA_QUALIFIEDNAME(1, "Ramp"),                   // UA_QualifiedName browseName
+                            UA_NODEID_NUMERIC(0, UA_NS0ID_FOLDERTYPE),     // UA_NodeId typeDefinition
+                            object_attr,                                   // UA_ObjectAttributes attr
+                            NULL,                                          // UA_InstantiationCallback *instantiationCallback
+                            &RampFolder);                                  // UA_NodeId *outNewNodeId
+    addDataSourceVariable(RampFolder, "Time", "times of the ramp points [s] relative to the start",
+        rampColumns+RAMP_TIME, readRampColumn, writeRampColumn);
+    addDataSourceVariable(RampFolder, "Current", "currents of the ramp points [A]",
+        rampColumns+RAMP_CURRENT, readRampColumn, writeRampColumn);
+    addDataSourceVariable(RampFolder, "Rate", "setpoint update rate during the ramp [Hz]",
+        NULL, readRampRate, writeRampRate);
+    addDataSourceVariable(RampFolder, "Start", "writing true starts the ramp",
+        NULL, readFalse, writeRampStart);
+    addDataSourceVariable(RampFolder, "Abort", "writing true aborts the ramp",
+        NULL, readFalse, writeRampAbort);
+    addDataSourceVariable(RampFolder, "State", "0 idle, 1 running, 2 done, 3 aborted",
+        NULL, readRampState, NULL);
+    addDataSourceVariable(RampFolder, "Elapsed", "time since the start of the ramp [s]",
+        NULL, readRampElapsed, NULL);
+    addDataSourceVariable(RampFolder, "Skipped", "steps skipped because the device was too slow",
+        NULL, readRampSkipped, NULL);
+
+    /**************************
+    History
+    |   the compressed readback history (only if configured)
+    **************************/
+
+    if (historyMemory != 0)
+    {
+        // the store is allocated before the first poll is posted
+        if (HistoryInit(historyMemory) != 0)
+            Die("OpcUaServer : Failed to allocate the readback history\n");
+        UA_NodeId HistoryFolder = addFolder(UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+            "History", "compressed readback history");
+        addDataSourceVariable(HistoryFolder, "Count", "number of samples in the history",
+            NULL, readHistoryCount, NULL);
+        addDataSourceVariable(HistoryFolder, "OldestTime", "time of the oldest sample",
+            NULL, readHistoryOldest, NULL);
+        addDataSourceVariable(HistoryFolder, "Bytes", "memory used by the samples [bytes]",
+            NULL, readHistoryBytes, NULL);
+        UA_Argument rangeArgs[3];
+        UA_Argument_init(&rangeArgs[0]);
+        rangeArgs[0].name = UA_STRING("StartTime");
+        rangeArgs[0].description = UA_LOCALIZEDTEXT("en_US","time of the first sample");
+        rangeArgs[0].dataType = UA_TYPES[UA_TYPES_DATETIME].typeId;
+        rangeArgs[0].valueRank = -1;
+        UA_Argument_init(&rangeArgs[1]);
+        rangeArgs[1].name = UA_STRING("EndTime");
+        rangeArgs[1].description = UA_LOCALIZEDTEXT("en_US","time of the last sample");
+        rangeArgs[1].dataType = UA_TYPES[UA_TYPES_DATETIME].typeId;
+        rangeArgs[1].valueRank = -1;
+        UA_Argument_init(&rangeArgs[2]);
+        rangeArgs[2].name = UA_STRING("MaxValues");
+        rangeArgs[2].description = UA_LOCALIZEDTEXT("en_US","maximum number of samples, 0 for all");
+        rangeArgs[2].dataType = UA_TYPES[UA_TYPES_UINT32].typeId;
+        rangeArgs[2].valueRank = -1;
+        UA_Argument sampleArgs[4];
+        UA_Argument_init(&sampleArgs[0]);
+        sampleArgs[0].name = UA_STRING("Time");
+        sampleArgs[0].description = UA_LOCALIZEDTEXT("en_US","times of the samples");
+        sampleArgs[0].dataType = UA_TYPES[UA_TYPES_DATETIME].typeId;
+        sampleArgs[0].valueRank = 1;
+        UA_Argument_init(&sampleArgs[1]);
+        sampleArgs[1].name = UA_STRING("Current");
+        sampleArgs[1].description = UA_LOCALIZEDTEXT("en_US","current readbacks [A]");
+        sampleArgs[1].dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+        sampleArgs[1].valueRank = 1;
+        UA_Argument_init(&sampleArgs[2]);
+        sampleArgs[2].name = UA_STRING("Voltage");
+        sampleArgs[2].description = UA_LOCALIZEDTEXT("en_US","voltage readbacks [V]");
+        sampleArgs[2].dataType = UA_TYPES[UA_TYPES_DOUBLE].typeId;
+        sampleArgs[2].valueRank = 1;
+        UA_Argument_init(&sampleArgs[3]);
+        sampleArgs[3].name = UA_STRING("Status");
+        sampleArgs[3].description = UA_LOCALIZEDTEXT("en_US","device status words");
+        sampleArgs[3].dataType = UA_TYPES[UA_TYPES_UINT32].typeId;
+        sampleArgs[3].valueRank = 1;
+        UA_MethodAttributes_init(&method_attr);
+        method_attr.description = UA_LOCALIZEDTEXT("en_US","read the samples of a time interval, oldest first");
+        method_attr.displayName = UA_LOCALIZEDTEXT("en_US","ReadHistory");
+        method_attr.executable = true;
+        method_attr.userExecutable = true;
+        UA_Server_addMethodNode(server,
+                                UA_NODEID_NUMERIC(1, 0),
+                                HistoryFolder,
+                                UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                UA_QUALIFIEDNAME(1, "ReadHistory"),
+                                method_attr,
+                                readHistoryMethod,
+                                NULL,
+                                3, rangeArgs,
+                                4, sampleArgs,
+                                NULL);
+    }
+
+    /**************************
+    Units
+    |   the additional power supplies of the gateway (only if configured)
+    **************************/
+
+    if (gatewayCount != 0)
+    {
+        // the units get the registers configured at startup
+        RegisterEntry *entries = malloc(configCount*sizeof(RegisterEntry) + 1);
+        if (entries == NULL)
+            Die("OpcUaServer : Failed to allocate the register table\n");
+        for (UA_UInt32 i=0; i<configCount; i++)
+            entries[i] = registerConfigs[i].entry;
+        if (GatewayStart(gatewayUnits, gatewayCount, entries, configCount, gatewayInterval, gatewayRefresh) != 0)
+            Die("OpcUaServer : Failed to start the gateway\n");
+        free(entries);
+        gatewayStatusBits = malloc(gatewayCount*statusBitCount*sizeof(GatewayStatusBit) + 1);
+        if (gatewayStatusBits == NULL)
+            Die("OpcUaServer : Failed to allocate the status bits of the units\n");
+        UA_NodeId UnitsFolder = addFolder(UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+            "Units", "power supplies connected through the gateway");
+        for (UA_UInt32 i=0; i<gatewayCount; i++) {
+            addGatewayUnit(UnitsFolder, i, registerConfigs, configCount);
+            printf("OpcUaServer : Unit=%s %s:%u\n", gatewayUnits[i].name, gatewayUnits[i].host, gatewayUnits[i].port);
+        }
+    }
+    free(registerConfigs);
+
+    startupPhase("address space", NULL);
+
+    //***********************************
+    // start polling the device
+    //***********************************
+    // the server does not wait for the device, the first poll is posted at once
+    // and the clients see BadWaitingForInitialData until the answers have arrived
+    // (the registers are read by the poll when the device link comes up)
+    pollDevice(server, NULL);
+    schedulePoll(pollInterval);
+    // pending setpoints are sent whenever the flush job comes along
+    if (setpointCoalescing) {
+        UA_Job flushJob = (UA_Job)
             {
-                // set the variable attributes as they are read from the config file
-                UA_VariableAttributes_init(&attr);
-                // first the register number
-                unsigned short regNumber;
-                xmlChar *numberProp = xmlGetProp(currNode,"number");
-                buflen = xmlStrPrintf(buf, 80, "%s", numberProp);
-                if (buflen == 0)
-                    Die("OpcUaServer : Failed to read XML <register> number property\n");
-                buf[buflen] = '\0';         // string termination
-                if (sscanf(buf,"%d",&regNumber)<1)
-                    Die("OpcUaServer : Failed to interpret <register> number property\n");
-                RegNr[loopindex] = regNumber;
-                // second the node name
-                char nodeName[80];
-                xmlChar *nameProp = xmlGetProp(currNode,"name");
-                buflen = xmlStrPrintf(buf, 80, "%s", nameProp);
-                if (buflen == 0)
-                    Die("OpcUaServer : Failed to read XML <register> name property\n");
-                buf[buflen] = '\0';         // string termination
-                strcpy(nodeName,buf);
-                printf("OpcUaServer : Register=%d %s\n", regNumber, nodeName);
-                attr.displayName = UA_LOCALIZEDTEXT("en_US",nodeName);
-                // thirdd the node description
-                xmlChar *descProp = xmlGetProp(currNode,"description");
-                buflen = xmlStrPrintf(buf, 80, "%s", descProp);
-                if (buflen == 0)
-                    Die("OpcUaServer : Failed to read XML <register> description property\n");
-                buf[buflen] = '\0';         // string termination
-                attr.description = UA_LOCALIZEDTEXT("en_US",buf);
-                attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
-                // get at pointer to the datasource storage
-                UA_DataSource *ds = RegDS+loopindex;
-                // the handle points to the register number
-                ds->handle = RegNr+loopindex;
-                // we have special routines for reading/writing registers
-                ds->read = readRegister;
-                ds->write = writeRegister;
-                UA_Server_addDataSourceVariableNode(
-                        server,
-                        UA_NODEID_NUMERIC(1, 0),
-                        RegistersFolder,
-                        UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
-                        UA_QUALIFIEDNAME(1, nodeName),
-                        UA_NODEID_NULL,
-                        attr,
-                        *ds,
-                        NULL);
-                loopindex++;
-                if (loopindex>=maxreg)
-                    Die("OpcUaServer : too many registers\n");
+                .type = UA_JOBTYPE_METHODCALL,
+                .job.methodCall = { .method = flushSetpoints, .data = NULL }
             };
-
-    // done with the XML document
-    xmlFreeDoc(doc);
-    xmlCleanupParser();
+        UA_Server_addRepeatedJob(server, flushJob, setpointFlushInterval, NULL);
+    }
+    scheduleRefresh(registerRefreshInterval);
+
+    // the UDP server answers from the device until the cache has been filled
+    if (udpPortNumber != 0)
+        if (UdpServerStart(udpPortNumber, udpMaxAge, logger) != 0)
+            Die("OpcUaServer : Failed to start the UDP server\n");
+    if (multicastGroup[0] != '\0')
+        if (UdpPublisherStart(multicastGroup, multicastPort, multicastInterval, multicastTtl,
+                multicastInterface[0] != '\0' ? multicastInterface : NULL, logger) != 0)
+            Die("OpcUaServer : Failed to start the multicast publisher\n");
+    if (RampInit() != 0)
+        Die("OpcUaServer : Failed to start the ramp playback\n");
+    if (captureDepth != 0)
+        if (CaptureStart(captureRate, captureDepth, captureMode, captureTrigger, capturePosttrigger) != 0)
+            Die("OpcUaServer : Failed to start the waveform capture\n");
 
     // run the server (forever unless stopped with ctrl-C)
-    UA_StatusCode retval = UA_Server_run(server, &running);
+    UA_StatusCode retval = runServer(server);
 
     // the server has stopped running
     UA_LOG_INFO(logger, UA_LOGCATEGORY_SERVER, "server stopped running.");
+    RampExit();
+    CaptureStop();
+    GatewayStop();
+    UdpPublisherStop();
+    UdpServerStop();
+    DeviceStop();
+    HistoryExit();
     UA_Server_delete(server);
+    free(gatewayStatusBits);
     nl.deleteMembers(&nl);
-
-    close(sock);
+    BufferPoolExit();
+    TraceExit();
+    // the XML parser is kept for reloads until the end
+    xmlCleanupParser();
 
     printf("OpcUaServer : graceful exit\n");
     return 0;
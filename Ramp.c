@@ -0,0 +1,226 @@
+/** @file Ramp.c
+ *
+ *  Playback of current ramps uploaded as a table
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "Ramp.h"
+#include "Capture.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+#include "SetpointQueue.h"
+
+static pthread_t rampThread;
+static volatile int rampThreadRunning = 0;
+static sem_t startSem;                  // posted by RampStart()
+
+// the table, protected by rampLock
+static pthread_mutex_t rampLock = PTHREAD_MUTEX_INITIALIZER;
+static UA_Double table[RAMP_COLUMNS][RAMP_MAXPOINTS];
+static size_t tableLength[RAMP_COLUMNS] = { 0, 0 };
+static UA_Double rampRate = 100.0;
+static UA_UInt32 state = RAMP_IDLE;
+static UA_DateTime startTime = 0;       // monotonic
+static UA_DateTime endTime = 0;         // monotonic, 0 while running
+static UA_UInt64 skipped = 0;
+
+// abort requests are seen by the playback thread without taking the lock
+static volatile int abortRequested = 0;
+
+// the schedule is computed in 64 bit, long has only 32 bit on the target
+static void addNanoseconds(struct timespec *t, int64_t ns) {
+    int64_t nsec = t->tv_nsec + ns;
+    t->tv_sec += nsec / 1000000000;
+    t->tv_nsec = nsec % 1000000000;
+}
+
+// play the table (playback thread)
+// the table is not modified while the state is RAMP_RUNNING
+static void play() {
+    const UA_Double *times = table[RAMP_TIME];
+    const UA_Double *currents = table[RAMP_CURRENT];
+    size_t n = tableLength[RAMP_TIME];
+    double last = times[n-1];
+    int64_t period = (int64_t)(1e9/rampRate);
+    size_t segment = 0;                 // times[segment] <= t < times[segment+1]
+    struct timespec start, next;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    next = start;
+    for (unsigned long step = 0; !abortRequested; step++) {
+        // the final step is placed exactly onto the last point
+        double t = step/rampRate;
+        if (t > last)
+            t = last;
+        while (segment+1 < n && times[segment+1] <= t)
+            segment++;
+        double current;
+        if (t <= times[0])
+            current = currents[0];
+        else if (segment+1 >= n)
+            current = currents[n-1];
+        else
+            current = currents[segment] + (currents[segment+1]-currents[segment])
+                * (t-times[segment]) / (times[segment+1]-times[segment]);
+        if (SetpointPost(&rampQueue, setpoints+SETPOINT_CURRENT, current) != UA_STATUSCODE_GOOD)
+            __atomic_fetch_add(&skipped, 1, __ATOMIC_RELAXED);
+        if (t >= last)
+            break;
+        addNanoseconds(&next, period);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t late = (int64_t)(now.tv_sec-next.tv_sec)*1000000000 + (now.tv_nsec-next.tv_nsec);
+        if (late > 0) {
+            // the steps already due are skipped, the schedule is kept
+            int64_t behind = late/period + 1;
+            __atomic_fetch_add(&skipped, behind, __ATOMIC_RELAXED);
+            step += behind;
+            addNanoseconds(&next, behind*period);
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    pthread_mutex_lock(&rampLock);
+    state = abortRequested ? RAMP_ABORTED : RAMP_DONE;
+    endTime = UA_DateTime_nowMonotonic();
+    pthread_mutex_unlock(&rampLock);
+}
+
+static void *rampLoop(void *arg) {
+    while (rampThreadRunning) {
+        // the timeout lets the thread check for termination
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        addNanoseconds(&deadline, 200000000L);
+        if (sem_timedwait(&startSem, &deadline) != 0)
+            continue;
+        play();
+    }
+    return NULL;
+}
+
+int RampInit() {
+    sem_init(&startSem, 0, 0);
+    rampThreadRunning = 1;
+    if (pthread_create(&rampThread, NULL, rampLoop, NULL) != 0) {
+        rampThreadRunning = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void RampExit() {
+    if (!rampThreadRunning)
+        return;
+    abortRequested = 1;
+    rampThreadRunning = 0;
+    pthread_join(rampThread, NULL);
+}
+
+UA_StatusCode RampLoad(int column, const UA_Double *values, size_t count) {
+    if (count > RAMP_MAXPOINTS)
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    pthread_mutex_lock(&rampLock);
+    if (state == RAMP_RUNNING)
+        retval = UA_STATUSCODE_BADINVALIDSTATE;
+    else {
+        memcpy(table[column], values, count*sizeof(UA_Double));
+        tableLength[column] = count;
+    }
+    pthread_mutex_unlock(&rampLock);
+    return retval;
+}
+
+UA_StatusCode RampRead(int column, const UA_NumericRange *range, UA_Variant *value) {
+    size_t first, count;
+    pthread_mutex_lock(&rampLock);
+    UA_StatusCode retval = CaptureRange(range, tableLength[column], &first, &count);
+    if (retval == UA_STATUSCODE_GOOD)
+        retval = UA_Variant_setArrayCopy(value, table[column]+first, count, &UA_TYPES[UA_TYPES_DOUBLE]);
+    pthread_mutex_unlock(&rampLock);
+    return retval;
+}
+
+UA_StatusCode RampSetRate(UA_Double rate) {
+    if (!(rate >= RAMP_MINRATE && rate <= RAMP_MAXRATE))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    pthread_mutex_lock(&rampLock);
+    if (state == RAMP_RUNNING)
+        retval = UA_STATUSCODE_BADINVALIDSTATE;
+    else
+        rampRate = rate;
+    pthread_mutex_unlock(&rampLock);
+    return retval;
+}
+
+UA_Double RampGetRate() {
+    pthread_mutex_lock(&rampLock);
+    UA_Double rate = rampRate;
+    pthread_mutex_unlock(&rampLock);
+    return rate;
+}
+
+// check the table (called with the lock held)
+static UA_StatusCode checkTable() {
+    size_t n = tableLength[RAMP_TIME];
+    if (n == 0 || tableLength[RAMP_CURRENT] != n)
+        return UA_STATUSCODE_BADINVALIDARGUMENT;
+    char cmd[FASTPS_CMDSIZE];
+    for (size_t i=0; i<n; i++) {
+        if (!isfinite(table[RAMP_TIME][i]) || table[RAMP_TIME][i] < 0.0)
+            return UA_STATUSCODE_BADINVALIDARGUMENT;
+        if (i > 0 && table[RAMP_TIME][i] <= table[RAMP_TIME][i-1])
+            return UA_STATUSCODE_BADINVALIDARGUMENT;
+        // every interpolated value lies between two points which can be sent
+        if (!FastPsFormatSetpoint(cmd, "MWI", table[RAMP_CURRENT][i]))
+            return UA_STATUSCODE_BADOUTOFRANGE;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode RampStart() {
+    pthread_mutex_lock(&rampLock);
+    UA_StatusCode retval = state == RAMP_RUNNING ? UA_STATUSCODE_BADINVALIDSTATE : checkTable();
+    if (retval == UA_STATUSCODE_GOOD) {
+        state = RAMP_RUNNING;
+        startTime = UA_DateTime_nowMonotonic();
+        endTime = 0;
+        abortRequested = 0;
+        __atomic_store_n(&skipped, 0, __ATOMIC_RELAXED);
+        sem_post(&startSem);
+    }
+    pthread_mutex_unlock(&rampLock);
+    return retval;
+}
+
+void RampAbort() {
+    abortRequested = 1;
+}
+
+UA_UInt32 RampState() {
+    pthread_mutex_lock(&rampLock);
+    UA_UInt32 s = state;
+    pthread_mutex_unlock(&rampLock);
+    return s;
+}
+
+UA_Double RampElapsed() {
+    pthread_mutex_lock(&rampLock);
+    UA_DateTime end = endTime != 0 ? endTime : UA_DateTime_nowMonotonic();
+    UA_Double elapsed = startTime != 0 ? (UA_Double)(end-startTime) / (1000.0*UA_MSEC_TO_DATETIME) : 0.0;
+    pthread_mutex_unlock(&rampLock);
+    return elapsed;
+}
+
+UA_UInt64 RampSkipped() {
+    return __atomic_load_n(&skipped, __ATOMIC_RELAXED);
+}
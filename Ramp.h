@@ -0,0 +1,80 @@
+/** @file Ramp.h
+ *
+ *  Playback of current ramps uploaded as a table
+ *
+ *  A client uploads a table of points (time [s] relative to the start, current [A])
+ *  and an update rate [Hz] in one go. After the start, a playback thread computes
+ *  the current on a fixed schedule by linear interpolation between the points and
+ *  sends it to the device through its own request queue. Before the first point
+ *  its current is held, after the last point has been sent the ramp is done.
+ *  Steps which cannot be queued because the device is too slow are skipped and counted.
+ *
+ *  The table can only be changed while no ramp is running. Setpoints written
+ *  by other clients during a ramp are overwritten by the next step.
+ *  The table is shared by the OPC UA and the playback threads,
+ *  all functions take care of the locking.
+ */
+
+#ifndef RAMP_H
+#define RAMP_H
+
+#include "open62541.h"
+
+#define RAMP_MAXPOINTS 10000        // maximum number of points in the table
+#define RAMP_MAXRATE 10000.0        // maximum update rate [Hz]
+#define RAMP_MINRATE 0.001          // minimum update rate [Hz]
+
+// the state of the playback
+enum {
+    RAMP_IDLE,                  // never started
+    RAMP_RUNNING,
+    RAMP_DONE,                  // the last point has been sent
+    RAMP_ABORTED
+};
+
+// the columns of the table
+enum {
+    RAMP_TIME,
+    RAMP_CURRENT,
+    RAMP_COLUMNS
+};
+
+// start the playback thread
+// return 0 on success
+int RampInit();
+
+// stop the playback thread (a running ramp is aborted)
+void RampExit();
+
+// replace one column of the table
+// return UA_STATUSCODE_BADINVALIDSTATE while a ramp is running,
+// UA_STATUSCODE_BADOUTOFRANGE if there are too many points
+UA_StatusCode RampLoad(int column, const UA_Double *values, size_t count);
+
+// copy the selected slice of a column into a new variant
+UA_StatusCode RampRead(int column, const UA_NumericRange *range, UA_Variant *value);
+
+// set the update rate [Hz]
+// UA_STATUSCODE_BADOUTOFRANGE outside RAMP_MINRATE ... RAMP_MAXRATE
+UA_StatusCode RampSetRate(UA_Double rate);
+UA_Double RampGetRate();
+
+// check the table and start the playback
+// return UA_STATUSCODE_BADINVALIDSTATE while a ramp is running,
+// UA_STATUSCODE_BADINVALIDARGUMENT if the columns differ in length, are empty
+// or the times are not increasing, UA_STATUSCODE_BADOUTOFRANGE for invalid currents
+UA_StatusCode RampStart();
+
+// abort a running ramp (the last setpoint sent stays active)
+void RampAbort();
+
+// the state of the playback (RAMP_IDLE, ...)
+UA_UInt32 RampState();
+
+// the time since the start of the current or last ramp [s]
+UA_Double RampElapsed();
+
+// the number of steps skipped because the device queue was full
+UA_UInt64 RampSkipped();
+
+#endif
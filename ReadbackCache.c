@@ -0,0 +1,157 @@
+/** @file ReadbackCache.c
+ *
+ *  Cache of the device readbacks
+ */
+
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ReadbackCache.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+#include "Diagnostics.h"
+#include "History.h"
+
+#define NOVALUE { 0.0, 0, 0, UA_STATUSCODE_BADWAITINGFORINITIALDATA }
+
+CacheEntry cache[CACHE_SIZE] = {
+    [CACHE_CURRENT]         = { "Current",         "MRI\r\n",   "#MRI:", false, 0.0, 0.0, NOVALUE, NOVALUE },
+    [CACHE_VOLTAGE]         = { "Voltage",         "MRV\r\n",   "#MRV:", false, 0.0, 0.0, NOVALUE, NOVALUE },
+    [CACHE_CURRENTSETPOINT] = { "CurrentSetpoint", "MWI:?\r\n", "#MWI:", false, 0.0, 0.0, NOVALUE, NOVALUE },
+    [CACHE_VOLTAGESETPOINT] = { "VoltageSetpoint", "MWV:?\r\n", "#MWV:", false, 0.0, 0.0, NOVALUE, NOVALUE },
+    [CACHE_STATUS]          = { "DeviceStatus",    "MST\r\n",   "#MST:", true,  0.0, 0.0, NOVALUE, NOVALUE }
+};
+
+UA_UInt32 pollInterval = POLL_DEFAULT_INTERVAL;
+
+// protects the cache entries against concurrent access from the OPC UA and the UDP server threads
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+CacheEntry *CacheFind(const char *name) {
+    for (int i=0; i<CACHE_SIZE; i++)
+        if (!strcmp(cache[i].name, name))
+            return cache+i;
+    return NULL;
+}
+
+void CacheUpdate(CacheEntry *entry, UA_Double value, UA_DateTime timestamp) {
+    pthread_mutex_lock(&cacheLock);
+    entry->sample.value = value;
+    entry->sample.timestamp = timestamp;
+    entry->sample.status = UA_STATUSCODE_GOOD;
+    entry->reported = entry->sample;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+void CacheSetDeadband(CacheEntry *entry, UA_Double absolute, UA_Double percent) {
+    pthread_mutex_lock(&cacheLock);
+    entry->deadbandAbsolute = absolute;
+    entry->deadbandPercent = percent;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+CacheValue CacheReported(const CacheEntry *entry) {
+    pthread_mutex_lock(&cacheLock);
+    CacheValue v = entry->reported;
+    pthread_mutex_unlock(&cacheLock);
+    return v;
+}
+
+CacheValue CacheSample(const CacheEntry *entry) {
+    pthread_mutex_lock(&cacheLock);
+    CacheValue v = entry->sample;
+    pthread_mutex_unlock(&cacheLock);
+    return v;
+}
+
+void CacheSnapshot(CacheValue sample[CACHE_SIZE]) {
+    pthread_mutex_lock(&cacheLock);
+    for (int i=0; i<CACHE_SIZE; i++)
+        sample[i] = cache[i].sample;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+// decide whether the last sample has to be reported to the clients
+static int exceedsDeadband(const CacheEntry *entry) {
+    const CacheValue *s = &entry->sample;
+    const CacheValue *r = &entry->reported;
+    if (s->status != r->status)
+        return 1;
+    if (entry->isWord)
+        return s->word != r->word;
+    double change = fabs(s->value - r->value);
+    // without any deadband every change is reported
+    if (change == 0.0)
+        return 0;
+    if (change <= entry->deadbandAbsolute)
+        return 0;
+    if (change <= 0.01 * entry->deadbandPercent * fabs(r->value))
+        return 0;
+    return 1;
+}
+
+// interpret the answer of the device to the request of a cache entry
+// the setpoints can only be read if the output is on, otherwise #NAK:13 is answered
+// in that case (and for any other invalid answer) the last valid value is kept
+static void parseCacheEntry(CacheEntry *entry, const char *reply, UA_DateTime now) {
+    int result;
+    if (entry->isWord)
+        result = FastPsParseWord(reply,entry->prefix,&entry->sample.word);
+    else
+        result = FastPsParseDouble(reply,entry->prefix,&entry->sample.value);
+    // refused commands are counted by the I/O thread
+    if (result!=1 && !FastPsIsNak(reply))
+        DiagCount(DIAG_MALFORMEDREPLIES);
+    if (result==1) {
+        entry->sample.timestamp = now;
+        entry->sample.status = UA_STATUSCODE_GOOD;
+    } else if (entry->sample.timestamp != 0)
+        entry->sample.status = UA_STATUSCODE_UNCERTAINLASTUSABLEVALUE;
+    if (exceedsDeadband(entry))
+        entry->reported = entry->sample;
+}
+
+// without connection to the device the last value is kept with uncertain quality
+// values never obtained are reported as communication error
+static void linkDown(CacheEntry *entry) {
+    if (entry->sample.timestamp != 0)
+        entry->sample.status = UA_STATUSCODE_UNCERTAINLASTUSABLEVALUE;
+    else
+        entry->sample.status = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+    if (exceedsDeadband(entry))
+        entry->reported = entry->sample;
+}
+
+// evaluate the answers to a poll request (run by the I/O thread)
+// the lock is only held for the parsing, not for the device round-trip
+// samples with valid readbacks are appended to the history
+static void pollDone(DeviceRequest *request) {
+    UA_DateTime now = UA_DateTime_now();
+    pthread_mutex_lock(&cacheLock);
+    for (int i=0; i<CACHE_SIZE; i++)
+        if (request->failed)
+            linkDown(cache+i);
+        else
+            parseCacheEntry(cache+i, request->batch.reply[i], now);
+    int complete = cache[CACHE_CURRENT].sample.timestamp == now
+                && cache[CACHE_VOLTAGE].sample.timestamp == now
+                && cache[CACHE_STATUS].sample.timestamp == now;
+    UA_Double current = cache[CACHE_CURRENT].sample.value;
+    UA_Double voltage = cache[CACHE_VOLTAGE].sample.value;
+    UA_UInt32 status = cache[CACHE_STATUS].sample.word;
+    pthread_mutex_unlock(&cacheLock);
+    if (complete)
+        HistoryAppend(now, current, voltage, status);
+}
+
+DeviceRequest *CachePoll(DeviceQueue *queue) {
+    DeviceRequest *request = DeviceRequestNew(queue);
+    if (request == NULL)
+        return NULL;
+    for (int i=0; i<CACHE_SIZE; i++)
+        TcpQueueAdd(&request->batch, cache[i].command);
+    request->done = pollDone;
+    DeviceRequestPost(queue, request);
+    return request;
+}
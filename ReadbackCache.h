@@ -0,0 +1,95 @@
+/** @file ReadbackCache.h
+ *
+ *  Cache of the device readbacks
+ *
+ *  The readback values are sampled periodically by CachePoll()
+ *  which is posted by a repeated job of the OPC UA server.
+ *  The answers are evaluated by the device I/O thread.
+ *  All read callbacks are served from this cache, so an OPC UA read
+ *  never has to wait for the device, no matter how many clients are polling.
+ *
+ *  Every entry holds the last sample obtained from the device and the value
+ *  reported to the clients. The reported value is only updated when the sample
+ *  differs from it by more than the deadband configured for the variable
+ *  (or when the quality changes). Monitored items sampling an unchanged
+ *  reported value see identical data values and generate no notifications.
+ *
+ *  Every poll with valid current, voltage and status readbacks
+ *  is also appended to the readback history (see History.h).
+ *
+ *  While the connection to the device is down, the values are kept with
+ *  UncertainLastUsableValue status (BadCommunicationError if never obtained).
+ *  The first poll after a reconnect resynchronizes the cache.
+ *
+ *  The cache is shared by the OPC UA, the UDP server and the device I/O threads.
+ *  The values must only be accessed through the functions below
+ *  which take care of the locking.
+ */
+
+#ifndef READBACKCACHE_H
+#define READBACKCACHE_H
+
+#include "open62541.h"
+#include "DeviceLink.h"
+
+// a value together with its quality
+typedef struct {
+    UA_Double value;            // floating point value
+    UA_UInt32 word;             // status word
+    UA_DateTime timestamp;      // time when the value was obtained, 0 if never
+    UA_StatusCode status;       // quality of the value
+} CacheValue;
+
+typedef struct {
+    char *name;                 // name of the variable (used in the configuration file)
+    char *command;              // request string sent to the device
+    char *prefix;               // expected start of the answer
+    UA_Boolean isWord;          // answer is a hexadecimal word instead of a floating point value
+    UA_Double deadbandAbsolute; // minimum change of the value to be reported
+    UA_Double deadbandPercent;  // minimum change relative to the reported value [%]
+    CacheValue sample;          // the last sample obtained from the device
+    CacheValue reported;        // the value presented to the clients
+} CacheEntry;
+
+enum {
+    CACHE_CURRENT,
+    CACHE_VOLTAGE,
+    CACHE_CURRENTSETPOINT,
+    CACHE_VOLTAGESETPOINT,
+    CACHE_STATUS,
+    CACHE_SIZE
+};
+
+extern CacheEntry cache[CACHE_SIZE];
+
+#define POLL_DEFAULT_INTERVAL 100
+
+// the poll interval in ms - can be modified in the configuration file
+extern UA_UInt32 pollInterval;
+
+// find a cache entry by its variable name, NULL if not existing
+CacheEntry *CacheFind(const char *name);
+
+// store a new valid value in a cache entry (e.g. an acknowledged setpoint)
+// the value is reported immediately, independent of the deadband
+void CacheUpdate(CacheEntry *entry, UA_Double value, UA_DateTime timestamp);
+
+// change the deadband of an entry (while the poll is running)
+void CacheSetDeadband(CacheEntry *entry, UA_Double absolute, UA_Double percent);
+
+// a copy of the value presented to the OPC UA clients
+CacheValue CacheReported(const CacheEntry *entry);
+
+// a copy of the last sample obtained from the device
+CacheValue CacheSample(const CacheEntry *entry);
+
+// a consistent copy of the last samples of all entries
+void CacheSnapshot(CacheValue sample[CACHE_SIZE]);
+
+// sample all cached values from the device
+// all requests are sent to the device in one batch posted to the given queue,
+// the cache is updated by the I/O thread when the answers have arrived
+// return the posted request (for DeviceRequestWait()), NULL if the queue is full
+DeviceRequest *CachePoll(DeviceQueue *queue);
+
+#endif
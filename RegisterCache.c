@@ -0,0 +1,248 @@
+/** @file RegisterCache.c
+ *
+ *  Cache of the configuration registers
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "RegisterCache.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+#include "Diagnostics.h"
+
+static RegisterEntry *table = NULL;
+UA_UInt32 registerCount = 0;
+
+UA_UInt32 registerRefreshInterval = REGISTER_DEFAULT_REFRESH;
+
+// protects the values against concurrent access from the OPC UA and the I/O threads
+static pthread_mutex_t registerLock = PTHREAD_MUTEX_INITIALIZER;
+static UA_UInt64 modifications = 0;
+
+// the next register to be read by RegisterRefresh()
+static UA_UInt32 refreshNext = 0;
+
+int RegisterReplace(const RegisterEntry *entries, UA_UInt32 count) {
+    RegisterEntry *replaced = malloc((count ? count : 1)*sizeof(RegisterEntry));
+    if (replaced == NULL)
+        return -1;
+    pthread_mutex_lock(&registerLock);
+    for (UA_UInt32 i=0; i<count; i++) {
+        replaced[i] = entries[i];
+        replaced[i].value = (CacheValue){ 0.0, 0, 0, UA_STATUSCODE_BADWAITINGFORINITIALDATA };
+        int old = RegisterFind(entries[i].number);
+        if (old >= 0)
+            replaced[i].value = table[old].value;
+    }
+    free(table);
+    table = replaced;
+    registerCount = count;
+    refreshNext = 0;
+    pthread_mutex_unlock(&registerLock);
+    return 0;
+}
+
+int RegisterFind(UA_UInt32 number) {
+    for (UA_UInt32 i=0; i<registerCount; i++)
+        if (table[i].number == number)
+            return i;
+    return -1;
+}
+
+const RegisterEntry *RegisterInfo(int index) {
+    return table+index;
+}
+
+UA_UInt32 RegisterNumber(int index) {
+    return table[index].number;
+}
+
+CacheValue RegisterGet(int index) {
+    pthread_mutex_lock(&registerLock);
+    CacheValue value = table[index].value;
+    pthread_mutex_unlock(&registerLock);
+    return value;
+}
+
+// store a valid value (called with the lock held)
+static void storeValue(RegisterEntry *entry, UA_Double value, UA_DateTime timestamp) {
+    if (entry->value.timestamp != 0 && entry->value.value != value)
+        modifications++;
+    entry->value.value = value;
+    entry->value.timestamp = timestamp;
+    entry->value.status = UA_STATUSCODE_GOOD;
+}
+
+// the last value is kept with uncertain quality if the register could not be read
+// (called with the lock held)
+static void readFailed(RegisterEntry *entry) {
+    if (entry->value.timestamp != 0)
+        entry->value.status = UA_STATUSCODE_UNCERTAINLASTUSABLEVALUE;
+    else
+        entry->value.status = UA_STATUSCODE_BADCOMMUNICATIONERROR;
+}
+
+// evaluate the answer to a MRG command (called with the lock held)
+static void readDone(RegisterEntry *entry, const char *reply, UA_DateTime now) {
+    double value;
+    if (FastPsParseRegister(reply, entry->number, &value))
+        storeValue(entry, value, now);
+    else {
+        if (reply[0] != '\0' && !FastPsIsNak(reply))
+            DiagCount(DIAG_MALFORMEDREPLIES);
+        readFailed(entry);
+    }
+}
+
+void RegisterUpdate(size_t first, size_t count) {
+    size_t n = 0;
+    for (size_t i=first; i<first+count; i++)
+        if (table[i].policy == REGISTER_NOCACHE)
+            n++;
+    if (n == 0)
+        return;
+    int *index = malloc(n*sizeof(int));
+    char (*commands)[BUFSIZE] = malloc(n*BUFSIZE);
+    char (*replies)[BUFSIZE] = malloc(n*BUFSIZE);
+    if (index == NULL || commands == NULL || replies == NULL) {
+        free(index);
+        free(commands);
+        free(replies);
+        return;
+    }
+    n = 0;
+    for (size_t i=first; i<first+count; i++)
+        if (table[i].policy == REGISTER_NOCACHE) {
+            index[n] = i;
+            FastPsFormatRegisterRead(commands[n++], table[i].number);
+        }
+    DeviceExchange(&uaQueue, commands, replies, n);
+    UA_DateTime now = UA_DateTime_now();
+    pthread_mutex_lock(&registerLock);
+    for (size_t k=0; k<n; k++)
+        readDone(table+index[k], replies[k], now);
+    pthread_mutex_unlock(&registerLock);
+    free(index);
+    free(commands);
+    free(replies);
+}
+
+void RegisterStoreReply(int index, const char *reply) {
+    UA_DateTime now = UA_DateTime_now();
+    pthread_mutex_lock(&registerLock);
+    readDone(table+index, reply, now);
+    pthread_mutex_unlock(&registerLock);
+}
+
+UA_StatusCode RegisterCheck(int index, UA_Double value) {
+    const RegisterEntry *entry = table+index;
+    if (!(value >= entry->min && value <= entry->max))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    if (entry->type == REGISTER_INT && value != floor(value))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    return UA_STATUSCODE_GOOD;
+}
+
+int RegisterWritten(int index, const char *cmd, const char *reply) {
+    if (!FastPsIsAck(reply))
+        return 0;
+    // the value as sent to the device (behind "MWG:nn:"),
+    // so a later refresh reads back the same value
+    double value = strtod(strchr(cmd+4, ':')+1, NULL);
+    pthread_mutex_lock(&registerLock);
+    storeValue(table+index, value, UA_DateTime_now());
+    pthread_mutex_unlock(&registerLock);
+    return 1;
+}
+
+UA_UInt64 RegisterModifications() {
+    pthread_mutex_lock(&registerLock);
+    UA_UInt64 count = modifications;
+    pthread_mutex_unlock(&registerLock);
+    return count;
+}
+
+// evaluate the answers to a refresh batch (run by the I/O thread)
+// request->data holds the indices of the registers in the batch
+static void refreshDone(DeviceRequest *request) {
+    const int *index = request->data;
+    UA_DateTime now = UA_DateTime_now();
+    pthread_mutex_lock(&registerLock);
+    for (unsigned int i=0; i<request->batch.length; i++)
+        if (request->failed)
+            readFailed(table+index[i]);
+        else
+            readDone(table+index[i], request->batch.reply[i], now);
+    pthread_mutex_unlock(&registerLock);
+    free(request->data);
+}
+
+// the registers with other policies are only read until a value has been obtained
+static int needsRefresh(const RegisterEntry *entry) {
+    if (entry->policy == REGISTER_REFRESH)
+        return 1;
+    pthread_mutex_lock(&registerLock);
+    int never = entry->value.timestamp == 0;
+    pthread_mutex_unlock(&registerLock);
+    return never;
+}
+
+DeviceRequest *RegisterRefresh() {
+    DeviceRequest *last = NULL;
+    char cmd[FASTPS_CMDSIZE];
+    while (refreshNext < registerCount) {
+        if (!needsRefresh(table+refreshNext)) {
+            refreshNext++;
+            continue;
+        }
+        int *index = malloc(MAXQUEUE*sizeof(int));
+        if (index == NULL)
+            return last;
+        DeviceRequest *request = DeviceRequestNew(&uaQueue);
+        if (request == NULL) {
+            free(index);
+            return last;
+        }
+        for (; refreshNext < registerCount && request->batch.length < MAXQUEUE; refreshNext++)
+            if (needsRefresh(table+refreshNext)) {
+                index[request->batch.length] = refreshNext;
+                FastPsFormatRegisterRead(cmd, table[refreshNext].number);
+                TcpQueueAdd(&request->batch, cmd);
+            }
+        request->data = index;
+        request->done = refreshDone;
+        DeviceRequestPost(&uaQueue, request);
+        last = request;
+    }
+    // the next call starts a new pass
+    refreshNext = 0;
+    return last;
+}
+
+// evaluate the answer to a register write (run by the I/O thread)
+// request->result is the index of the register
+static void writeDone(DeviceRequest *request) {
+    printf("MWG response : %s\n", request->batch.reply[0]);
+    if (!request->failed)
+        RegisterWritten(request->result, request->batch.command[0], request->batch.reply[0]);
+}
+
+UA_StatusCode RegisterWrite(int index, UA_Double value, char *cmd) {
+    UA_StatusCode retval = RegisterCheck(index, value);
+    if (retval != UA_STATUSCODE_GOOD)
+        return retval;
+    if (FastPsFormatRegisterWrite(cmd, table[index].number, value) == 0)
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    DeviceRequest *request = DeviceRequestNew(&uaQueue);
+    if (request == NULL)
+        return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+    TcpQueueAdd(&request->batch, cmd);
+    request->result = index;
+    request->done = writeDone;
+    DeviceRequestPost(&uaQueue, request);
+    return UA_STATUSCODE_GOOD;
+}
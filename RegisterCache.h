@@ -0,0 +1,124 @@
+/** @file RegisterCache.h
+ *
+ *  Cache of the configuration registers
+ *
+ *  The configuration registers (slew rates, PID terms, ...) only change
+ *  when they are written, so all OPC UA reads of registers are served
+ *  from this cache and put no load on the device.
+ *
+ *  The cache is filled at startup with one pipelined burst of MRG commands
+ *  and refreshed on a slow schedule (<parameters refresh="60000">) or on demand,
+ *  which also picks up changes made by other means than this server.
+ *  Every write acknowledged by the device is stored immediately (write-through).
+ *  A modification counter is incremented whenever a known register value changes,
+ *  so a client can detect changes of the configuration with a single read.
+ *
+ *  While the device cannot be read, the values are kept with
+ *  UncertainLastUsableValue status (BadCommunicationError if never obtained).
+ *
+ *  Every register has a cache policy. Static registers are only read at startup,
+ *  uncached registers are read from the device on every access (e.g. registers
+ *  changed by the device itself). Writes outside the configured limits
+ *  and non-integral values for integer registers are refused.
+ *
+ *  The registers are kept in one contiguous table on the heap, which is
+ *  replaced as a whole when the configuration is (re-)loaded. They are addressed
+ *  by their index in the table (the order of the configuration file),
+ *  which is used as the handle of the OPC UA nodes.
+ *  The cache is shared by the OPC UA and the device I/O threads,
+ *  all functions take care of the locking. The device is accessed
+ *  through the request queue of the OPC UA thread.
+ */
+
+#ifndef REGISTERCACHE_H
+#define REGISTERCACHE_H
+
+#include "open62541.h"
+#include "DeviceLink.h"
+#include "ReadbackCache.h"
+
+// the value types
+enum {
+    REGISTER_DOUBLE,
+    REGISTER_INT
+};
+
+// the cache policies
+enum {
+    REGISTER_REFRESH,           // served from the cache, refreshed periodically
+    REGISTER_STATIC,            // served from the cache, only read at startup
+    REGISTER_NOCACHE            // read from the device on every access
+};
+
+typedef struct {
+    UA_UInt32 number;           // the register number used with MRG/MWG
+    int type;                   // REGISTER_DOUBLE or REGISTER_INT
+    char unit[16];              // engineering unit, empty if none
+    UA_Double min;              // the limits for writes
+    UA_Double max;
+    int policy;                 // REGISTER_REFRESH, ...
+    CacheValue value;           // the last value obtained from the device
+} RegisterEntry;
+
+#define REGISTER_DEFAULT_REFRESH 60000
+
+// the number of registers in the table
+extern UA_UInt32 registerCount;
+
+// the refresh interval in ms, 0 disables the background refresh
+// can be modified in the configuration file
+extern UA_UInt32 registerRefreshInterval;
+
+// replace the table by a new set of registers (the values of the entries are ignored)
+// registers with a number already in the table keep their cached value
+// no request of the OPC UA queue may be outstanding (see DeviceQueueFlush())
+// return 0 on success, -1 if out of memory (the table is unchanged)
+int RegisterReplace(const RegisterEntry *entries, UA_UInt32 count);
+
+// the index of a register number, -1 if not in the table
+int RegisterFind(UA_UInt32 number);
+
+// the configuration of a register (valid until the next RegisterReplace())
+const RegisterEntry *RegisterInfo(int index);
+
+// the register number of an index
+UA_UInt32 RegisterNumber(int index);
+
+// a copy of the cached value
+CacheValue RegisterGet(int index);
+
+// read the uncached registers among count registers starting at first from the device
+// (waits for the answers)
+void RegisterUpdate(size_t first, size_t count);
+
+// evaluate the answer to a MRG command for a register sent by other means
+// than the functions of the cache (e.g. together with other commands)
+void RegisterStoreReply(int index, const char *reply);
+
+// check a value to be written
+// return UA_STATUSCODE_BADOUTOFRANGE if it is not acceptable for the register
+UA_StatusCode RegisterCheck(int index, UA_Double value);
+
+// evaluate the reply to a MWG command sent for a register
+// the value sent is stored if the device acknowledged the write
+// return 1 if acknowledged
+int RegisterWritten(int index, const char *cmd, const char *reply);
+
+// the number of changes of known register values since the start
+UA_UInt64 RegisterModifications();
+
+// read the registers with REGISTER_REFRESH policy from the device
+// (and all others not read successfully so far)
+// the requests are posted in batches of up to MAXQUEUE commands,
+// the cache is updated by the I/O thread when the answers have arrived.
+// If the queue fills up, the next call continues with the remaining registers.
+// return the last posted request (for DeviceRequestWait()), NULL if none was posted
+DeviceRequest *RegisterRefresh();
+
+// write a register, the cache is updated when the device acknowledges the write
+// the command sent is copied into cmd (for logging)
+// return UA_STATUSCODE_BADOUTOFRANGE if the value cannot be sent,
+// UA_STATUSCODE_BADRESOURCEUNAVAILABLE if the queue is full
+UA_StatusCode RegisterWrite(int index, UA_Double value, char *cmd);
+
+#endif
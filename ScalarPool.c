@@ -0,0 +1,125 @@
+/** @file ScalarPool.c
+ *
+ *  Fixed-size pool for the scalar values returned by the DataSource reads
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ScalarPool.h"
+#include "Diagnostics.h"
+
+typedef union Slot {
+    union Slot *next;                   // while in the free list
+    UA_Double value;                    // for the alignment
+    char bytes[SCALARPOOL_SLOTSIZE];
+} Slot;
+
+static Slot slots[SCALARPOOL_SLOTS];
+
+// the free slots, protected by poolLock
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static Slot *freeList = NULL;
+static UA_UInt32 inUse = 0;
+static UA_UInt32 maxInUse = 0;
+
+// set by the allocator, the library has been compiled with the redirection
+static volatile int redirected = 0;
+static int enabled = 0;
+
+static int inPool(const void *ptr) {
+    return (const Slot *)ptr >= slots && (const Slot *)ptr < slots+SCALARPOOL_SLOTS;
+}
+
+static void releaseSlot(Slot *slot) {
+    pthread_mutex_lock(&poolLock);
+    slot->next = freeList;
+    freeList = slot;
+    inUse--;
+    pthread_mutex_unlock(&poolLock);
+}
+
+void *ScalarPoolMalloc(size_t size) {
+    redirected = 1;
+    DiagCount(DIAG_HEAPALLOCS);
+    return malloc(size);
+}
+
+void *ScalarPoolCalloc(size_t num, size_t size) {
+    redirected = 1;
+    DiagCount(DIAG_HEAPALLOCS);
+    return calloc(num, size);
+}
+
+void *ScalarPoolRealloc(void *ptr, size_t size) {
+    redirected = 1;
+    DiagCount(DIAG_HEAPALLOCS);
+    if (!inPool(ptr))
+        return realloc(ptr, size);
+    // not done by the library for scalars, but the value must move to the heap
+    void *moved = malloc(size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, size < SCALARPOOL_SLOTSIZE ? size : SCALARPOOL_SLOTSIZE);
+        releaseSlot(ptr);
+    }
+    return moved;
+}
+
+void ScalarPoolFree(void *ptr) {
+    if (inPool(ptr))
+        releaseSlot(ptr);
+    else
+        free(ptr);
+}
+
+int ScalarPoolInit() {
+    // any allocation of the library shows whether it uses the allocator above
+    void *probe = UA_Array_new(1, &UA_TYPES[UA_TYPES_BYTE]);
+    UA_Array_delete(probe, 1, &UA_TYPES[UA_TYPES_BYTE]);
+    if (!redirected)
+        return 0;
+    pthread_mutex_lock(&poolLock);
+    for (int i=0; i<SCALARPOOL_SLOTS; i++) {
+        slots[i].next = freeList;
+        freeList = slots+i;
+    }
+    pthread_mutex_unlock(&poolLock);
+    enabled = 1;
+    return 1;
+}
+
+UA_StatusCode ScalarPoolSet(UA_Variant *v, const void *p, const UA_DataType *type) {
+    if (!enabled || !type->fixedSize || type->memSize > SCALARPOOL_SLOTSIZE)
+        return UA_Variant_setScalarCopy(v, p, type);
+    pthread_mutex_lock(&poolLock);
+    Slot *slot = freeList;
+    if (slot != NULL) {
+        freeList = slot->next;
+        if (++inUse > maxInUse)
+            maxInUse = inUse;
+    }
+    pthread_mutex_unlock(&poolLock);
+    if (slot == NULL) {
+        DiagCount(DIAG_POOLEXHAUSTED);
+        return UA_Variant_setScalarCopy(v, p, type);
+    }
+    DiagCount(DIAG_POOLALLOCS);
+    memcpy(slot, p, type->memSize);
+    UA_Variant_setScalar(v, slot, type);
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_UInt32 ScalarPoolInUse() {
+    pthread_mutex_lock(&poolLock);
+    UA_UInt32 n = inUse;
+    pthread_mutex_unlock(&poolLock);
+    return n;
+}
+
+UA_UInt32 ScalarPoolMaxInUse() {
+    pthread_mutex_lock(&poolLock);
+    UA_UInt32 n = maxInUse;
+    pthread_mutex_unlock(&poolLock);
+    return n;
+}
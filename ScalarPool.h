@@ -0,0 +1,61 @@
+/** @file ScalarPool.h
+ *
+ *  Fixed-size pool for the scalar values returned by the DataSource reads
+ *
+ *  Every value returned by a read callback has to be owned by the variant,
+ *  the library frees it after the response has been sent or the sample of a
+ *  monitored item has been published. Instead of a heap allocation for every
+ *  read, the scalars are taken from a pool of fixed-size slots in static memory.
+ *
+ *  The library is compiled with its allocator redirected to this pool,
+ *  so a slot is returned to the pool when the library frees the value:
+ *  - $CC -std=c99 -DSCALARPOOL_ALLOCATOR -include ScalarPool.h -c open62541.c
+ *  All allocations of the library are counted (Diagnostics/HeapAllocations).
+ *  Without the redirection the pool is disabled and the values are allocated
+ *  from the heap as before. If the pool is exhausted, the heap is used as well
+ *  (Diagnostics/PoolExhausted).
+ *
+ *  Slots are only taken by the OPC UA server thread, they can be freed by any thread.
+ */
+
+#ifndef SCALARPOOL_H
+#define SCALARPOOL_H
+
+#include <stddef.h>
+
+// the allocator of the library
+void *ScalarPoolMalloc(size_t size);
+void *ScalarPoolCalloc(size_t num, size_t size);
+void *ScalarPoolRealloc(void *ptr, size_t size);
+void ScalarPoolFree(void *ptr);
+
+#ifdef SCALARPOOL_ALLOCATOR
+
+// included ahead of open62541.c, which must not see anything else
+#define UA_malloc(size) ScalarPoolMalloc(size)
+#define UA_calloc(num, size) ScalarPoolCalloc(num, size)
+#define UA_realloc(ptr, size) ScalarPoolRealloc(ptr, size)
+#define UA_free(ptr) ScalarPoolFree(ptr)
+
+#else
+
+#include "open62541.h"
+
+#define SCALARPOOL_SLOTS 1024       // number of values in flight at the same time
+#define SCALARPOOL_SLOTSIZE 16      // largest scalar type served from the pool
+
+// enable the pool if the library has been compiled with the redirected allocator
+// return 1 if the pool is used
+int ScalarPoolInit();
+
+// set a variant to a copy of a scalar, like UA_Variant_setScalarCopy()
+// the storage is taken from the pool for all types without pointers
+UA_StatusCode ScalarPoolSet(UA_Variant *v, const void *p, const UA_DataType *type);
+
+// the number of slots currently in use and the largest number so far
+UA_UInt32 ScalarPoolInUse();
+UA_UInt32 ScalarPoolMaxInUse();
+
+#endif
+
+#endif
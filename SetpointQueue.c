@@ -0,0 +1,182 @@
+/** @file SetpointQueue.c
+ *
+ *  Writing of the current and voltage setpoints to the device
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "SetpointQueue.h"
+#include "DeviceLink.h"
+#include "FastPsProtocol.h"
+#include "Capture.h"
+
+Setpoint setpoints[SETPOINT_SIZE] = {
+    [SETPOINT_CURRENT] = { "MWI", cache+CACHE_CURRENTSETPOINT, false, 0.0, 0.0, 0, 0, 0 },
+    [SETPOINT_VOLTAGE] = { "MWV", cache+CACHE_VOLTAGESETPOINT, false, 0.0, 0.0, 0, 0, 0 }
+};
+
+UA_Boolean setpointCoalescing = false;
+UA_UInt32 setpointFlushInterval = 5;
+
+// protects the pending and applied values
+static pthread_mutex_t setpointLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the time of the last scheduled setpoint (OPC UA thread only)
+static UA_DateTime lastScheduled = 0;
+
+// evaluate the answers to a setpoint request (run by the I/O thread)
+// the setpoint and its value are recovered from the command that was sent,
+// acknowledged values are recorded, the number of others is stored as result
+static void setpointsDone(DeviceRequest *request) {
+    UA_DateTime now = UA_DateTime_now();
+    TcpQueue *batch = &request->batch;
+    request->result = 0;
+    for (unsigned int i=0; i<batch->length; i++) {
+        if (!FastPsIsAck(batch->reply[i])) {
+            printf("setpoint %.3s not acknowledged : %s\n", batch->command[i], batch->reply[i]);
+            request->result++;
+            continue;
+        }
+        for (int j=0; j<SETPOINT_SIZE; j++) {
+            size_t len = strlen(setpoints[j].name);
+            double value;
+            if (strncmp(batch->command[i], setpoints[j].name, len) || batch->command[i][len] != ':')
+                continue;
+            if (!FastPsParseDouble(batch->command[i]+len+1, "", &value))
+                continue;
+            // an acknowledged setpoint is immediately visible in the cache
+            CacheUpdate(setpoints[j].entry, value, now);
+            pthread_mutex_lock(&setpointLock);
+            setpoints[j].appliedValue = value;
+            setpoints[j].appliedTime = now;
+            pthread_mutex_unlock(&setpointLock);
+            // a new setpoint may start a ramp worth capturing
+            CaptureSetpointChanged();
+        }
+    }
+}
+
+// evaluate the answer to a scheduled setpoint, the setpoint is passed as data
+static void scheduledDone(DeviceRequest *request) {
+    setpointsDone(request);
+    if (request->failed || request->result != 0) {
+        printf("scheduled setpoint %.3s not applied\n", request->batch.command[0]);
+        return;
+    }
+    Setpoint *sp = request->data;
+    pthread_mutex_lock(&setpointLock);
+    sp->scheduledTime = request->time;
+    sp->scheduledSent = request->sent;
+    pthread_mutex_unlock(&setpointLock);
+}
+
+// post the selected setpoints in one batch
+// return the request, NULL if the queue is full
+static DeviceRequest *sendSetpoints(DeviceQueue *queue,
+        const UA_Boolean send[SETPOINT_SIZE], const UA_Double values[SETPOINT_SIZE]) {
+    char cmd[FASTPS_CMDSIZE];
+    DeviceRequest *request = DeviceRequestNew(queue);
+    if (request == NULL)
+        return NULL;
+    for (int i=0; i<SETPOINT_SIZE; i++)
+        if (send[i] && FastPsFormatSetpoint(cmd, setpoints[i].name, values[i]))
+            TcpQueueAdd(&request->batch, cmd);
+    request->done = setpointsDone;
+    DeviceRequestPost(queue, request);
+    return request;
+}
+
+UA_StatusCode SetpointSchedule(Setpoint *sp, UA_Double value, UA_DateTime time) {
+    char cmd[FASTPS_CMDSIZE];
+    if (!FastPsFormatSetpoint(cmd, sp->name, value))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    if (time > UA_DateTime_now() + SETPOINT_SCHEDULE_MAX*UA_SEC_TO_DATETIME)
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    // the I/O thread sends the scheduled requests in the order of the queue
+    if (DeviceQueueDepth(&scheduleQueue) > 0 && time < lastScheduled)
+        return UA_STATUSCODE_BADINVALIDARGUMENT;
+    DeviceRequest *request = DeviceRequestNew(&scheduleQueue);
+    if (request == NULL)
+        return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+    TcpQueueAdd(&request->batch, cmd);
+    request->done = scheduledDone;
+    request->data = sp;
+    request->time = time;
+    DeviceRequestPost(&scheduleQueue, request);
+    lastScheduled = time;
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode SetpointPost(DeviceQueue *queue, Setpoint *sp, UA_Double value) {
+    char cmd[FASTPS_CMDSIZE];
+    if (!FastPsFormatSetpoint(cmd, sp->name, value))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    UA_Boolean send[SETPOINT_SIZE] = { false };
+    UA_Double values[SETPOINT_SIZE] = { 0.0 };
+    send[sp-setpoints] = true;
+    values[sp-setpoints] = value;
+    if (sendSetpoints(queue, send, values) == NULL)
+        return UA_STATUSCODE_BADRESOURCEUNAVAILABLE;
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode SetpointWrite(Setpoint *sp, UA_Double value) {
+    char cmd[FASTPS_CMDSIZE];
+    if (!FastPsFormatSetpoint(cmd, sp->name, value))
+        return UA_STATUSCODE_BADOUTOFRANGE;
+    if (setpointCoalescing) {
+        pthread_mutex_lock(&setpointLock);
+        sp->pendingValue = value;
+        sp->pending = true;
+        pthread_mutex_unlock(&setpointLock);
+        return UA_STATUSCODE_GOOD;
+    }
+    return SetpointPost(&uaQueue, sp, value);
+}
+
+void SetpointFlush() {
+    UA_Boolean send[SETPOINT_SIZE];
+    UA_Double values[SETPOINT_SIZE];
+    int count = 0;
+    // take the pending values, writes arriving later become pending again
+    pthread_mutex_lock(&setpointLock);
+    for (int i=0; i<SETPOINT_SIZE; i++) {
+        send[i] = setpoints[i].pending;
+        values[i] = setpoints[i].pendingValue;
+        if (send[i])
+            count++;
+    }
+    pthread_mutex_unlock(&setpointLock);
+    if (count == 0)
+        return;
+    if (sendSetpoints(&uaQueue, send, values) == NULL)
+        return;             // still pending, try again with the next flush
+    pthread_mutex_lock(&setpointLock);
+    for (int i=0; i<SETPOINT_SIZE; i++)
+        if (send[i] && setpoints[i].pendingValue == values[i])
+            setpoints[i].pending = false;
+    pthread_mutex_unlock(&setpointLock);
+}
+
+int SetpointWriteAll(const UA_Double values[SETPOINT_SIZE]) {
+    UA_Boolean send[SETPOINT_SIZE];
+    pthread_mutex_lock(&setpointLock);
+    for (int i=0; i<SETPOINT_SIZE; i++) {
+        send[i] = true;
+        setpoints[i].pending = false;
+    }
+    pthread_mutex_unlock(&setpointLock);
+    DeviceRequest *request = sendSetpoints(&udpQueue, send, values);
+    if (request == NULL || !DeviceRequestWait(&udpQueue, request, DEVICE_TIMEOUT))
+        return SETPOINT_SIZE;
+    return request->result + (SETPOINT_SIZE - request->batch.length);
+}
+
+Setpoint SetpointGet(const Setpoint *sp) {
+    pthread_mutex_lock(&setpointLock);
+    Setpoint copy = *sp;
+    pthread_mutex_unlock(&setpointLock);
+    return copy;
+}
@@ -0,0 +1,89 @@
+/** @file SetpointQueue.h
+ *
+ *  Writing of the current and voltage setpoints to the device
+ *
+ *  Without coalescing every setpoint write is sent to the device immediately.
+ *  With coalescing enabled (configuration file) a written value is only stored
+ *  as pending and the write returns at once. SetpointFlush() is run as a repeated
+ *  job of the OPC UA server and sends the pending values of all setpoints in one batch.
+ *  Values written in the meantime replace the pending one (last write wins),
+ *  so a client writing faster than the device link can follow does not make
+ *  the server lag behind.
+ *
+ *  The writes of the OPC UA server are posted to the device I/O thread without
+ *  waiting. The answers of the device are evaluated by the I/O thread:
+ *  every value acknowledged by the device is recorded as applied together with
+ *  the time of the acknowledge and is immediately visible in the readback cache.
+ *
+ *  A setpoint can also be scheduled for a given time, e.g. to change a group of
+ *  supplies together. The command is formatted at once and prepositioned
+ *  in the schedule queue of the I/O thread, which sends it at the requested time.
+ *  The requested time and the time the command was actually sent are recorded,
+ *  so the achieved skew can be measured.
+ *  The setpoints are shared by the OPC UA, the UDP server and the I/O threads,
+ *  all functions take care of the locking.
+ */
+
+#ifndef SETPOINTQUEUE_H
+#define SETPOINTQUEUE_H
+
+#include "open62541.h"
+#include "ReadbackCache.h"
+
+typedef struct {
+    char *name;                 // the device command, e.g. "MWI"
+    CacheEntry *entry;          // cache entry of the setpoint readback
+    UA_Boolean pending;         // a value is waiting to be sent
+    UA_Double pendingValue;     // the newest value not yet sent
+    UA_Double appliedValue;     // the last value acknowledged by the device
+    UA_DateTime appliedTime;    // time of the acknowledge, 0 if never
+    UA_DateTime scheduledTime;  // requested time of the last scheduled value applied, 0 if never
+    UA_DateTime scheduledSent;  // time its command was sent to the device
+} Setpoint;
+
+enum {
+    SETPOINT_CURRENT,
+    SETPOINT_VOLTAGE,
+    SETPOINT_SIZE
+};
+
+extern Setpoint setpoints[SETPOINT_SIZE];
+
+// coalescing of setpoint writes - can be enabled in the configuration file
+extern UA_Boolean setpointCoalescing;
+// the interval of the flush job in ms
+extern UA_UInt32 setpointFlushInterval;
+
+#define SETPOINT_SCHEDULE_MAX 60    // maximum time [s] a setpoint can be scheduled ahead
+
+// write a setpoint, either immediately or as pending value (coalescing)
+// (OPC UA thread only)
+// return UA_STATUSCODE_BADOUTOFRANGE if the value cannot be sent to the device,
+// UA_STATUSCODE_BADRESOURCEUNAVAILABLE if the device queue is full
+UA_StatusCode SetpointWrite(Setpoint *sp, UA_Double value);
+
+// send a setpoint to the device at once through the given queue, bypassing the coalescing
+// (the queue must belong to the calling thread)
+// return UA_STATUSCODE_BADOUTOFRANGE if the value cannot be sent to the device,
+// UA_STATUSCODE_BADRESOURCEUNAVAILABLE if the device queue is full
+UA_StatusCode SetpointPost(DeviceQueue *queue, Setpoint *sp, UA_Double value);
+
+// send a setpoint to the device at the given time (OPC UA thread only)
+// times in the past are sent at once, the times must not decrease while values are scheduled
+// return UA_STATUSCODE_BADOUTOFRANGE if the value cannot be sent to the device
+// or the time is too far ahead, UA_STATUSCODE_BADINVALIDARGUMENT if the time
+// is before one already scheduled, UA_STATUSCODE_BADRESOURCEUNAVAILABLE if the queue is full
+UA_StatusCode SetpointSchedule(Setpoint *sp, UA_Double value, UA_DateTime time);
+
+// send all pending setpoints to the device (OPC UA thread only)
+void SetpointFlush();
+
+// write all setpoints in one batch and wait for the answers (UDP server thread only)
+// pending values are discarded
+// return the number of values not acknowledged by the device
+int SetpointWriteAll(const UA_Double values[SETPOINT_SIZE]);
+
+// a copy of the state of a setpoint
+Setpoint SetpointGet(const Setpoint *sp);
+
+#endif
@@ -0,0 +1,139 @@
+/** @file Trace.c
+ *
+ *  Binary event trace of the hot paths for offline profiling
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Trace.h"
+
+typedef struct {
+    char name[TRACE_NAMESIZE];
+    UA_UInt64 head;                     // number of records written (by the owner thread only)
+    TraceRecord *records;
+} TraceRing;
+
+static TraceRing rings[TRACE_THREADS];
+static TraceRecord *storage = NULL;     // the records of all rings
+static UA_UInt32 ringSize = 0;          // a power of 2
+static UA_UInt32 ringsTaken = 0;        // may grow beyond TRACE_THREADS
+
+// the ring of the calling thread, NULL until the first event
+static __thread TraceRing *ownRing = NULL;
+static __thread int untraced = 0;       // all rings were taken
+
+int TraceInit(UA_UInt32 records) {
+    if (records == 0)
+        return 0;
+    ringSize = 1;
+    while (ringSize < records)
+        ringSize <<= 1;
+    storage = calloc((size_t)TRACE_THREADS*ringSize, sizeof(TraceRecord));
+    if (storage == NULL)
+        return -1;
+    for (int i=0; i<TRACE_THREADS; i++) {
+        snprintf(rings[i].name, TRACE_NAMESIZE, "thread %d", i);
+        rings[i].head = 0;
+        rings[i].records = storage + (size_t)i*ringSize;
+    }
+    return 0;
+}
+
+void TraceExit() {
+    free(storage);
+    storage = NULL;
+}
+
+static TraceRing *threadRing() {
+    if (ownRing == NULL && !untraced) {
+        UA_UInt32 index = __atomic_fetch_add(&ringsTaken, 1, __ATOMIC_RELAXED);
+        if (index < TRACE_THREADS)
+            ownRing = rings+index;
+        else
+            untraced = 1;
+    }
+    return ownRing;
+}
+
+void TraceThread(const char *name) {
+    if (storage == NULL)
+        return;
+    TraceRing *ring = threadRing();
+    if (ring != NULL) {
+        strncpy(ring->name, name, TRACE_NAMESIZE-1);
+        ring->name[TRACE_NAMESIZE-1] = '\0';
+    }
+}
+
+void TraceEvent(int event, int type, UA_DateTime start, UA_DateTime end, UA_UInt32 status, UA_UInt32 arg) {
+    if (storage == NULL)
+        return;
+    TraceRing *ring = threadRing();
+    if (ring == NULL)
+        return;
+    UA_UInt64 head = ring->head;
+    TraceRecord *r = ring->records + (head & (ringSize-1));
+    r->start = start;
+    r->duration = end > start ? (end-start)/UA_USEC_TO_DATETIME : 0;
+    r->status = status;
+    r->arg = arg;
+    r->event = event;
+    r->type = type;
+    r->thread = ring - rings;
+    r->reserved = 0;
+    // the record is complete before it is published
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+int TraceDump(const char *path) {
+    if (storage == NULL)
+        return -1;
+    TraceRecord *copy = malloc(ringSize*sizeof(TraceRecord));
+    FILE *f = fopen(path, "wb");
+    if (copy == NULL || f == NULL) {
+        free(copy);
+        if (f != NULL)
+            fclose(f);
+        return -1;
+    }
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.wallClock = UA_DateTime_now();
+    header.monotonic = UA_DateTime_nowMonotonic();
+    for (int i=0; i<TRACE_THREADS; i++)
+        memcpy(header.threadNames[i], rings[i].name, TRACE_NAMESIZE);
+    // the record count is filled in at the end
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    UA_UInt32 count = 0;
+    UA_UInt32 taken = __atomic_load_n(&ringsTaken, __ATOMIC_RELAXED);
+    for (UA_UInt32 i=0; i<taken && i<TRACE_THREADS && ok; i++) {
+        TraceRing *ring = rings+i;
+        // copy the ring while its thread keeps writing
+        UA_UInt64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        UA_UInt64 first = head > ringSize ? head-ringSize : 0;
+        for (UA_UInt64 k=first; k<head; k++)
+            copy[k-first] = ring->records[k & (ringSize-1)];
+        // records the thread may have overwritten during the copy are dropped
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        UA_UInt64 now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        UA_UInt64 valid = now >= ringSize ? now-ringSize+1 : 0;
+        if (valid < first)
+            valid = first;
+        if (valid < head) {
+            ok = fwrite(copy+(valid-first), sizeof(TraceRecord), head-valid, f) == head-valid;
+            count += head-valid;
+        }
+    }
+    header.recordCount = count;
+    if (ok)
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = 0;
+    free(copy);
+    return ok ? (int)count : -1;
+}
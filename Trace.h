@@ -0,0 +1,87 @@
+/** @file Trace.h
+ *
+ *  Binary event trace of the hot paths for offline profiling
+ *
+ *  Every duration recorded in the latency histograms (see Diagnostics.h)
+ *  is also appended to the trace as a record of fixed size: the start time,
+ *  the duration, the event (device command, DataSource read, UDP batch,
+ *  server loop iteration), the command type and a status code. Unlike the log,
+ *  the trace is cheap enough to be always on, so after a glitch of a feedback loop
+ *  the last few thousand events before it can be reconstructed.
+ *
+ *  Every thread writes to its own ring of records, taken with its first event.
+ *  The ring is only written by its thread and published with an atomic
+ *  store of the write position, so no locking is needed. The oldest records
+ *  are overwritten when the ring is full.
+ *
+ *  The trace is written to a file on SIGUSR1 or by the method
+ *  Diagnostics/DumpTrace(), both executed by the server loop. The file
+ *  holds a TraceFileHeader followed by the records of all threads
+ *  (in the native byte order). bench/TraceConvert.c converts it to
+ *  the Chrome trace format (chrome://tracing, Perfetto) or to CSV.
+ *
+ *  Configured by <trace records="4096" file="/tmp/opcua.trace"/> (optional),
+ *  records is the size of each ring, 0 disables the trace.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "open62541.h"
+
+#define TRACE_MAGIC 0x52545046          // "FPTR"
+#define TRACE_VERSION 1
+#define TRACE_THREADS 16                // maximum number of threads traced
+#define TRACE_NAMESIZE 16
+#define TRACE_DEFAULT_RECORDS 1024      // records per thread (rounded up to a power of 2)
+#define TRACE_DEFAULT_FILE "/tmp/opcua.trace"
+
+// the events
+enum {
+    TRACE_DEVICE,           // a device command (type is the DIAG_MRI ... DIAG_OTHER histogram)
+    TRACE_DATASOURCE,       // a DataSource read callback
+    TRACE_UDP,              // a batch of UDP requests (arg is the number of packets)
+    TRACE_UALOOP,           // an iteration of the server loop without the network wait
+    TRACE_EVENTS
+};
+
+typedef struct {
+    int64_t start;          // start of the event (UA_DateTime_nowMonotonic()) [100 ns]
+    uint32_t duration;      // [us]
+    uint32_t status;        // OPC UA status code
+    uint32_t arg;           // depending on the event
+    uint16_t event;         // TRACE_...
+    uint16_t type;
+    uint32_t thread;        // index of the thread ring
+    uint32_t reserved;
+} TraceRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;    // sizeof(TraceRecord)
+    uint32_t recordCount;   // number of records following the header
+    int64_t wallClock;      // UA_DateTime_now() at the time of the dump
+    int64_t monotonic;      // UA_DateTime_nowMonotonic() at the same time
+    char threadNames[TRACE_THREADS][TRACE_NAMESIZE];
+} TraceFileHeader;
+
+// allocate a ring of the given number of records for every thread
+// return 0 on success (also for 0 records, the trace is then disabled)
+int TraceInit(UA_UInt32 records);
+
+// free the rings (only when all threads have stopped)
+void TraceExit();
+
+// name the ring of the calling thread (shown by the converter)
+void TraceThread(const char *name);
+
+// append a record to the ring of the calling thread
+void TraceEvent(int event, int type, UA_DateTime start, UA_DateTime end, UA_UInt32 status, UA_UInt32 arg);
+
+// write all records to a file
+// return the number of records written, -1 on failure
+int TraceDump(const char *path);
+
+#endif
@@ -0,0 +1,606 @@
+/** @file UdpServer.c
+ *
+ *  UDP server for fast control loops (port 16665)
+ */
+
+#define _GNU_SOURCE             // for recvmmsg(), sendmmsg() and clock_nanosleep()
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "UdpServer.h"
+#include "ReadbackCache.h"
+#include "SetpointQueue.h"
+#include "Diagnostics.h"
+#include "Trace.h"
+#include "DeviceLink.h"
+
+static int udpSock = -1;
+static pthread_t udpThread;
+static volatile int udpRunning = 0;
+static UA_DateTime udpMaxAge;           // maximum age of the cached readbacks [100 ns]
+static UA_Logger udpLogger;
+
+// the readbacks used for the reply
+static const int readbacks[] = { CACHE_CURRENT, CACHE_VOLTAGE, CACHE_STATUS };
+
+// conversion between the integer packet fields [uA, uV] and the device values [A, V]
+static int64_t toMicro(double value) {
+    if (!(fabs(value) < 9e12))
+        return 0;
+    return (int64_t)llround(1e6*value);
+}
+
+// a request decoded from either frame format
+typedef struct {
+    int extended;               // extended frame format
+    uint16_t flags;             // UDP_FLAG_...
+    uint32_t sequence;
+    int64_t clientTime;
+    int64_t current;            // setpoints [uA, uV]
+    int64_t voltage;
+    uint32_t interval;          // subscription [us, ms]
+    uint32_t lease;
+    uint32_t nonce;             // subscription, returned with UDP_FLAG_CHALLENGE
+} UdpRequest;
+
+// buffers of a batch of received and sent packets
+static char rxbuf[UDP_BATCH][64];
+static char txbuf[UDP_BATCH][UDP_EXTREPLYSIZE+CACHE_SIZE*UDP_STATUSENTRYSIZE+UDP_NONCESIZE];
+static struct sockaddr_in clients[UDP_BATCH];
+static struct iovec rxiov[UDP_BATCH], txiov[UDP_BATCH];
+static struct mmsghdr rxmsg[UDP_BATCH], txmsg[UDP_BATCH];
+
+// write the requested setpoints to the device in one batch
+// return 0 if all setpoints were acknowledged
+static int applySetpoints(int64_t current, int64_t voltage) {
+    UA_Double values[SETPOINT_SIZE];
+    values[SETPOINT_CURRENT] = 1e-6*current;
+    values[SETPOINT_VOLTAGE] = 1e-6*voltage;
+    return SetpointWriteAll(values) != 0;
+}
+
+// check whether all readbacks needed for a reply are not older than maxAge [100 ns]
+static int isFresh(const CacheValue sample[CACHE_SIZE], UA_DateTime maxAge) {
+    UA_DateTime limit = UA_DateTime_now() - maxAge;
+    for (unsigned int i=0; i<sizeof(readbacks)/sizeof(readbacks[0]); i++)
+        if (sample[readbacks[i]].timestamp < limit)
+            return 0;
+    return 1;
+}
+
+// decode a request packet, return 0 if it is to be ignored
+static int parseRequest(const char *p, int length, UdpRequest *req) {
+    uint32_t signature, flag;
+    uint16_t version;
+    if (length < 8)
+        return 0;
+    memcpy(&signature, p, 4);
+    if (signature != UDP_SIGNATURE)
+        return 0;
+    if (length == UDP_REQUESTSIZE) {
+        memcpy(&flag, p+4, 4);
+        memcpy(&req->current, p+8, 8);
+        memcpy(&req->voltage, p+16, 8);
+        req->extended = 0;
+        req->flags = (flag != 0) ? UDP_FLAG_SETPOINT : 0;
+        return 1;
+    }
+    if (length == UDP_EXTREQUESTSIZE) {
+        memcpy(&version, p+4, 2);
+        if (version != UDP_VERSION)
+            return 0;
+        memcpy(&req->flags, p+6, 2);
+        memcpy(&req->sequence, p+8, 4);
+        memcpy(&req->clientTime, p+16, 8);
+        memcpy(&req->current, p+24, 8);
+        memcpy(&req->voltage, p+32, 8);
+        req->extended = 1;
+        req->flags &= (UDP_FLAG_SETPOINT | UDP_FLAG_STATUS);
+        return 1;
+    }
+    if (length == UDP_SUBSCRIBESIZE) {
+        memcpy(&version, p+4, 2);
+        if (version != UDP_VERSION)
+            return 0;
+        memcpy(&req->flags, p+6, 2);
+        if (!(req->flags & UDP_FLAG_SUBSCRIBE))
+            return 0;
+        memcpy(&req->sequence, p+8, 4);
+        memcpy(&req->interval, p+12, 4);
+        memcpy(&req->clientTime, p+16, 8);
+        memcpy(&req->lease, p+24, 4);
+        memcpy(&req->nonce, p+28, 4);
+        req->current = req->voltage = 0;
+        req->extended = 1;
+        req->flags &= (UDP_FLAG_SUBSCRIBE | UDP_FLAG_STATUS);
+        return 1;
+    }
+    return 0;
+}
+
+// encode the reply to a request, return its size
+static int formatReply(const UdpRequest *req, const CacheValue sample[CACHE_SIZE], char *p) {
+    uint32_t status = sample[CACHE_STATUS].word;
+    int64_t values[4] = {
+        toMicro(sample[CACHE_CURRENTSETPOINT].value),
+        toMicro(sample[CACHE_VOLTAGESETPOINT].value),
+        toMicro(sample[CACHE_CURRENT].value),
+        toMicro(sample[CACHE_VOLTAGE].value) };
+    if (!req->extended) {
+        memcpy(p, &status, 4);
+        memcpy(p+4, values, sizeof(values));
+        return UDP_REPLYSIZE;
+    }
+    uint32_t signature = UDP_SIGNATURE;
+    uint16_t version = UDP_VERSION;
+    int64_t serverTime = sample[CACHE_CURRENT].timestamp;
+    memcpy(p, &signature, 4);
+    memcpy(p+4, &version, 2);
+    memcpy(p+6, &req->flags, 2);
+    memcpy(p+8, &req->sequence, 4);
+    memcpy(p+12, &status, 4);
+    memcpy(p+16, &req->clientTime, 8);
+    memcpy(p+24, &serverTime, 8);
+    memcpy(p+32, values, sizeof(values));
+    char *q = p+UDP_EXTREPLYSIZE;
+    uint32_t reserved = 0;
+    if (req->flags & UDP_FLAG_STATUS)
+        for (int i=0; i<CACHE_SIZE; i++, q+=UDP_STATUSENTRYSIZE) {
+            uint32_t code = sample[i].status;
+            int64_t timestamp = sample[i].timestamp;
+            memcpy(q, &code, 4);
+            memcpy(q+4, &reserved, 4);
+            memcpy(q+8, &timestamp, 8);
+        }
+    if (req->flags & UDP_FLAG_CHALLENGE) {
+        memcpy(q, &req->nonce, 4);
+        memcpy(q+4, &reserved, 4);
+        q += UDP_NONCESIZE;
+    }
+    return q-p;
+}
+
+/***********************************/
+/* streaming subscriptions         */
+/***********************************/
+
+typedef struct {
+    int active;
+    int confirmed;              // the nonce has been returned, frames are streamed
+    uint32_t nonce;             // required in every subscribe frame of the client
+    struct sockaddr_in client;
+    uint16_t flags;             // UDP_FLAG_STATUS if the status block was requested
+    uint32_t sequence;          // number of frames sent
+    int64_t interval;           // [ns]
+    int64_t next;               // time of the next frame [ns, CLOCK_MONOTONIC]
+    int64_t expires;            // end of the lease [ns, CLOCK_MONOTONIC]
+} UdpSubscription;
+
+static UdpSubscription subscriptions[UDP_SUBSCRIPTIONS];
+static pthread_mutex_t subLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t subChanged;       // a subscription was added (uses CLOCK_MONOTONIC)
+static pthread_t streamThread;
+static volatile int streamRunning = 0;
+static int randomFd = -1;               // /dev/urandom for the nonces
+
+static int64_t monotonicNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec*1000000000L + now.tv_nsec;
+}
+
+// a new nonce (never 0, which is sent by a client without one)
+// return 0 if no random number could be obtained
+static int newNonce(uint32_t *nonce) {
+    do {
+        if (read(randomFd, nonce, sizeof(*nonce)) != sizeof(*nonce))
+            return 0;
+    } while (*nonce == 0);
+    return 1;
+}
+
+// register, renew or cancel the subscription of a client
+// a frame without the nonce of the client is answered with a challenge (req is modified)
+// return 0 on success, -1 if it was rejected
+static int subscribe(const struct sockaddr_in *client, UdpRequest *req) {
+    if (req->interval != 0 && (req->interval < UDP_MININTERVAL || req->lease == 0 || req->lease > UDP_MAXLEASE))
+        return -1;
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client->sin_addr, addr, sizeof(addr));
+    int64_t now = monotonicNow();
+    pthread_mutex_lock(&subLock);
+    UdpSubscription *sub = NULL;
+    UdpSubscription *unused = NULL;
+    UdpSubscription *unconfirmed = NULL;
+    for (int i=0; i<UDP_SUBSCRIPTIONS; i++) {
+        if (!subscriptions[i].active) {
+            if (unused == NULL)
+                unused = subscriptions+i;
+        } else if (subscriptions[i].client.sin_addr.s_addr == client->sin_addr.s_addr
+                && subscriptions[i].client.sin_port == client->sin_port)
+            sub = subscriptions+i;
+        else if (!subscriptions[i].confirmed && unconfirmed == NULL)
+            unconfirmed = subscriptions+i;
+    }
+    // the source address has not yet been shown to receive the replies
+    if (sub == NULL || req->nonce != sub->nonce) {
+        if (sub == NULL && req->interval != 0) {
+            // a slot waiting for its nonce may be taken over
+            sub = unused != NULL ? unused : unconfirmed;
+            if (sub == NULL || !newNonce(&sub->nonce)) {
+                pthread_mutex_unlock(&subLock);
+                return -1;
+            }
+            sub->client = *client;
+            sub->confirmed = 0;
+            sub->expires = now + (int64_t)UDP_CHALLENGETIME * 1000000;
+            sub->active = 1;
+        }
+        if (sub != NULL) {
+            req->flags |= UDP_FLAG_CHALLENGE;
+            req->nonce = sub->nonce;
+        }
+        pthread_mutex_unlock(&subLock);
+        return 0;
+    }
+    if (req->interval == 0) {
+        sub->active = 0;
+        if (sub->confirmed)
+            UA_LOG_INFO(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : subscription of %s:%d cancelled",
+                addr, ntohs(client->sin_port));
+        pthread_mutex_unlock(&subLock);
+        return 0;
+    }
+    if (!sub->confirmed) {
+        sub->confirmed = 1;
+        sub->sequence = 0;
+        sub->next = now;
+        UA_LOG_INFO(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : %s:%d subscribed every %u us",
+            addr, ntohs(client->sin_port), req->interval);
+    }
+    sub->flags = req->flags & UDP_FLAG_STATUS;
+    sub->interval = (int64_t)req->interval * 1000;
+    sub->expires = now + (int64_t)req->lease * 1000000;
+    if (sub->next > now + sub->interval)
+        sub->next = now + sub->interval;
+    pthread_cond_signal(&subChanged);
+    pthread_mutex_unlock(&subLock);
+    return 0;
+}
+
+static void *udpStreamThread(void *arg) {
+    static char frame[UDP_SUBSCRIPTIONS][UDP_EXTREPLYSIZE+CACHE_SIZE*UDP_STATUSENTRYSIZE];
+    static struct sockaddr_in to[UDP_SUBSCRIPTIONS];
+    static struct iovec iov[UDP_SUBSCRIPTIONS];
+    static struct mmsghdr msg[UDP_SUBSCRIPTIONS];
+    UdpRequest stream[UDP_SUBSCRIPTIONS];
+    pthread_mutex_lock(&subLock);
+    while (streamRunning) {
+        // collect the frames that are due, drop the expired subscriptions
+        int64_t now = monotonicNow();
+        int64_t wake = now + 200000000L;        // check for termination every 200 ms
+        int64_t maxAge = INT64_MAX;
+        int due = 0;
+        for (int i=0; i<UDP_SUBSCRIPTIONS; i++) {
+            UdpSubscription *sub = subscriptions+i;
+            if (!sub->active)
+                continue;
+            if (sub->expires <= now) {
+                // unanswered challenges expire silently (the address may be forged)
+                if (sub->confirmed) {
+                    char addr[INET_ADDRSTRLEN];
+                    inet_ntop(AF_INET, &sub->client.sin_addr, addr, sizeof(addr));
+                    UA_LOG_INFO(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : subscription of %s:%d expired",
+                        addr, ntohs(sub->client.sin_port));
+                }
+                sub->active = 0;
+                continue;
+            }
+            if (!sub->confirmed) {
+                if (sub->expires < wake)
+                    wake = sub->expires;
+                continue;
+            }
+            if (sub->next <= now) {
+                memset(stream+due, 0, sizeof(UdpRequest));
+                stream[due].extended = 1;
+                stream[due].flags = sub->flags | UDP_FLAG_STREAMED;
+                stream[due].sequence = ++sub->sequence;
+                to[due] = sub->client;
+                if (sub->interval < maxAge)
+                    maxAge = sub->interval;
+                due++;
+                // the next frame on a fixed schedule, frames already late are skipped
+                sub->next += sub->interval;
+                if (sub->next <= now)
+                    sub->next = now + sub->interval;
+            }
+            if (sub->next < wake)
+                wake = sub->next;
+            if (sub->expires < wake)
+                wake = sub->expires;
+        }
+        if (due == 0) {
+            struct timespec t = { wake / 1000000000L, wake % 1000000000L };
+            pthread_cond_timedwait(&subChanged, &subLock, &t);
+            continue;
+        }
+        pthread_mutex_unlock(&subLock);
+        // all frames due are sent from the same sample
+        CacheValue sample[CACHE_SIZE];
+        CacheSnapshot(sample);
+        if (!isFresh(sample, maxAge / 100)) {
+            DeviceRequest *poll = CachePoll(&streamQueue);
+            if (poll != NULL)
+                DeviceRequestWait(&streamQueue, poll, DEVICE_TIMEOUT);
+            CacheSnapshot(sample);
+        }
+        UA_DateTime sent = UA_DateTime_now();
+        for (int i=0; i<due; i++) {
+            stream[i].clientTime = sent;
+            iov[i].iov_base = frame[i];
+            iov[i].iov_len = formatReply(stream+i, sample, frame[i]);
+            memset(&msg[i].msg_hdr, 0, sizeof(struct msghdr));
+            msg[i].msg_hdr.msg_iov = iov+i;
+            msg[i].msg_hdr.msg_iovlen = 1;
+            msg[i].msg_hdr.msg_name = to+i;
+            msg[i].msg_hdr.msg_namelen = sizeof(to[i]);
+        }
+        int n = sendmmsg(udpSock, msg, due, 0);
+        for (int i=0; i<n; i++)
+            DiagCount(DIAG_STREAMEDFRAMES);
+        pthread_mutex_lock(&subLock);
+    }
+    pthread_mutex_unlock(&subLock);
+    return NULL;
+}
+
+// handle a batch of received packets and send all replies at once
+static void handleBatch(int count) {
+    UA_DateTime start = UA_DateTime_nowMonotonic();
+    UdpRequest req[UDP_BATCH];
+    int valid[UDP_BATCH];
+    int any = 0;
+    int last = -1;              // the request with the setpoints to be applied
+    for (int i=0; i<count; i++) {
+        valid[i] = parseRequest(rxbuf[i], rxmsg[i].msg_len, req+i);
+        if (valid[i]) {
+            any = 1;
+            if (req[i].flags & UDP_FLAG_SETPOINT)
+                last = i;
+            if ((req[i].flags & UDP_FLAG_SUBSCRIBE) && subscribe(clients+i, req+i) != 0)
+                req[i].flags |= UDP_FLAG_REJECTED;
+        }
+    }
+    if (!any)
+        return;
+    // back-to-back setpoints are coalesced, only the last one is written
+    if (last >= 0) {
+        for (int i=0; i<last; i++)
+            if (valid[i] && (req[i].flags & UDP_FLAG_SETPOINT))
+                req[i].flags |= UDP_FLAG_SUPERSEDED;
+        if (applySetpoints(req[last].current, req[last].voltage))
+            req[last].flags |= UDP_FLAG_REJECTED;
+    }
+    CacheValue sample[CACHE_SIZE];
+    CacheSnapshot(sample);
+    // only stale readbacks make a device round-trip necessary
+    if (isFresh(sample, udpMaxAge))
+        DiagCount(DIAG_CACHEHITS);
+    else {
+        DiagCount(DIAG_CACHEMISSES);
+        DeviceRequest *poll = CachePoll(&udpQueue);
+        if (poll != NULL)
+            DeviceRequestWait(&udpQueue, poll, DEVICE_TIMEOUT);
+        CacheSnapshot(sample);
+    }
+    int replies = 0;
+    for (int i=0; i<count; i++)
+        if (valid[i]) {
+            txiov[replies].iov_base = txbuf[replies];
+            txiov[replies].iov_len = formatReply(req+i, sample, txbuf[replies]);
+            memset(&txmsg[replies].msg_hdr, 0, sizeof(struct msghdr));
+            txmsg[replies].msg_hdr.msg_iov = txiov+replies;
+            txmsg[replies].msg_hdr.msg_iovlen = 1;
+            txmsg[replies].msg_hdr.msg_name = clients+i;
+            txmsg[replies].msg_hdr.msg_namelen = rxmsg[i].msg_hdr.msg_namelen;
+            replies++;
+        }
+    sendmmsg(udpSock, txmsg, replies, 0);
+    DiagRecordStatus(DIAG_UDPREPLY, start,
+        (last >= 0 && (req[last].flags & UDP_FLAG_REJECTED)) ? UA_STATUSCODE_BADDEVICEFAILURE : UA_STATUSCODE_GOOD,
+        count);
+}
+
+static void *udpServerThread(void *arg) {
+    TraceThread("udp");
+    while (udpRunning) {
+        for (int i=0; i<UDP_BATCH; i++) {
+            rxiov[i].iov_base = rxbuf[i];
+            rxiov[i].iov_len = sizeof(rxbuf[i]);
+            memset(&rxmsg[i].msg_hdr, 0, sizeof(struct msghdr));
+            rxmsg[i].msg_hdr.msg_iov = rxiov+i;
+            rxmsg[i].msg_hdr.msg_iovlen = 1;
+            rxmsg[i].msg_hdr.msg_name = clients+i;
+            rxmsg[i].msg_hdr.msg_namelen = sizeof(clients[i]);
+        }
+        // block until the first packet arrives, then take all packets already waiting
+        // the receive timeout lets the thread check for termination
+        int n = recvmmsg(udpSock, rxmsg, UDP_BATCH, MSG_WAITFORONE, NULL);
+        if (n > 0)
+            handleBatch(n);
+    }
+    return NULL;
+}
+
+int UdpServerStart(unsigned short port, UA_UInt32 maxAge, UA_Logger logger) {
+    udpLogger = logger;
+    udpMaxAge = (UA_DateTime)maxAge * UA_MSEC_TO_DATETIME;
+    if ((udpSock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        UA_LOG_ERROR(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : failed to create socket");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(udpSock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        UA_LOG_ERROR(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : failed to bind port %d", port);
+        close(udpSock);
+        return -1;
+    }
+    struct timeval timeout = { 0, 200000 };
+    setsockopt(udpSock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if ((randomFd = open("/dev/urandom", O_RDONLY)) < 0) {
+        UA_LOG_ERROR(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : failed to open /dev/urandom");
+        close(udpSock);
+        return -1;
+    }
+    // the lease and schedule times of the subscriptions are monotonic
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&subChanged, &attr);
+    pthread_condattr_destroy(&attr);
+    memset(subscriptions, 0, sizeof(subscriptions));
+    streamRunning = 1;
+    if (pthread_create(&streamThread, NULL, udpStreamThread, NULL) != 0) {
+        UA_LOG_ERROR(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : failed to start the streaming thread");
+        streamRunning = 0;
+        close(randomFd);
+        close(udpSock);
+        return -1;
+    }
+    udpRunning = 1;
+    if (pthread_create(&udpThread, NULL, udpServerThread, NULL) != 0) {
+        UA_LOG_ERROR(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP : failed to start the server thread");
+        udpRunning = 0;
+        pthread_mutex_lock(&subLock);
+        streamRunning = 0;
+        pthread_cond_signal(&subChanged);
+        pthread_mutex_unlock(&subLock);
+        pthread_join(streamThread, NULL);
+        close(randomFd);
+        close(udpSock);
+        return -1;
+    }
+    UA_LOG_INFO(udpLogger, UA_LOGCATEGORY_NETWORK, "UDP server listening on port %d", port);
+    return 0;
+}
+
+void UdpServerStop() {
+    if (!udpRunning)
+        return;
+    udpRunning = 0;
+    pthread_join(udpThread, NULL);
+    pthread_mutex_lock(&subLock);
+    streamRunning = 0;
+    pthread_cond_signal(&subChanged);
+    pthread_mutex_unlock(&subLock);
+    pthread_join(streamThread, NULL);
+    close(randomFd);
+    close(udpSock);
+}
+
+/***********************************/
+/* multicast publisher             */
+/***********************************/
+
+static int pubSock = -1;
+static pthread_t pubThread;
+static volatile int pubRunning = 0;
+static struct sockaddr_in pubGroup;
+static int64_t pubPeriod;               // [ns] (long has only 32 bit on the target)
+
+static void *udpPublisherThread(void *arg) {
+    char frame[UDP_EXTREPLYSIZE+CACHE_SIZE*UDP_STATUSENTRYSIZE];
+    UdpRequest pub = { .extended = 1, .flags = UDP_FLAG_STATUS | UDP_FLAG_PUBLISHED };
+    UA_DateTime maxAge = pubPeriod / 100;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (pubRunning) {
+        CacheValue sample[CACHE_SIZE];
+        CacheSnapshot(sample);
+        // the device is only sampled if nobody else did within the interval
+        if (!isFresh(sample, maxAge)) {
+            DeviceRequest *poll = CachePoll(&publishQueue);
+            if (poll != NULL)
+                DeviceRequestWait(&publishQueue, poll, DEVICE_TIMEOUT);
+            CacheSnapshot(sample);
+        }
+        pub.sequence++;
+        pub.clientTime = UA_DateTime_now();
+        int length = formatReply(&pub, sample, frame);
+        if (sendto(pubSock, frame, length, 0, (struct sockaddr *)&pubGroup, sizeof(pubGroup)) == length)
+            DiagCount(DIAG_PUBLISHEDFRAMES);
+        // the next frame on a fixed schedule, frames already late are skipped
+        int64_t nsec = next.tv_nsec + pubPeriod;
+        next.tv_sec += nsec / 1000000000;
+        next.tv_nsec = nsec % 1000000000;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((int64_t)(now.tv_sec-next.tv_sec)*1000000000 + (now.tv_nsec-next.tv_nsec) > 0)
+            next = now;
+        else
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+int UdpPublisherStart(const char *group, unsigned short port, UA_UInt32 interval,
+        int ttl, const char *iface, UA_Logger logger) {
+    if (interval == 0)
+        return -1;
+    memset(&pubGroup, 0, sizeof(pubGroup));
+    pubGroup.sin_family = AF_INET;
+    pubGroup.sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &pubGroup.sin_addr) != 1 || !IN_MULTICAST(ntohl(pubGroup.sin_addr.s_addr))) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_NETWORK, "UDP : %s is no multicast group", group);
+        return -1;
+    }
+    if ((pubSock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_NETWORK, "UDP : failed to create the publisher socket");
+        return -1;
+    }
+    unsigned char mttl = ttl;
+    setsockopt(pubSock, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl));
+    if (iface != NULL) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, iface, &addr) != 1
+                || setsockopt(pubSock, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr)) != 0) {
+            UA_LOG_ERROR(logger, UA_LOGCATEGORY_NETWORK, "UDP : failed to use interface %s for multicast", iface);
+            close(pubSock);
+            return -1;
+        }
+    }
+    pubPeriod = (int64_t)interval * 1000000;
+    pubRunning = 1;
+    if (pthread_create(&pubThread, NULL, udpPublisherThread, NULL) != 0) {
+        UA_LOG_ERROR(logger, UA_LOGCATEGORY_NETWORK, "UDP : failed to start the publisher thread");
+        pubRunning = 0;
+        close(pubSock);
+        return -1;
+    }
+    UA_LOG_INFO(logger, UA_LOGCATEGORY_NETWORK, "UDP publishing to %s:%d every %u ms", group, port, interval);
+    return 0;
+}
+
+void UdpPublisherStop() {
+    if (!pubRunning)
+        return;
+    pubRunning = 0;
+    pthread_join(pubThread, NULL);
+    close(pubSock);
+}
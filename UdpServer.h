@@ -0,0 +1,150 @@
+/** @file UdpServer.h
+ *
+ *  UDP server for fast control loops (port 16665)
+ *
+ *  The server receives packets with the following content:
+ *  - UInt32 : signature word 0x4C556543 which is checked for the packet to be accepted
+ *  - UInt32 : must be different from 0 to indicate that setpoints should be modified
+ *  - Int64 : current setpoint in uA
+ *  - Int64 : voltage setpoint in uV
+ *
+ *  Every received packet showing the correct signature is answered with another packet showing:
+ *  - UInt32 : device status word
+ *  - Int64 : current setpoint in uA
+ *  - Int64 : voltage setpoint in uV
+ *  - Int64 : current readback in uA
+ *  - Int64 : voltage readback in uV
+ *
+ *  In addition an extended frame format is accepted, recognized by its size
+ *  of UDP_EXTREQUESTSIZE bytes and the version field following the signature:
+ *  - UInt32 : signature word 0x4C556543
+ *  - UInt16 : frame version UDP_VERSION
+ *  - UInt16 : flags (UDP_FLAG_SETPOINT, UDP_FLAG_STATUS)
+ *  - UInt32 : sequence number (returned unchanged)
+ *  - UInt32 : reserved, should be 0
+ *  - Int64 : client timestamp (returned unchanged)
+ *  - Int64 : current setpoint in uA
+ *  - Int64 : voltage setpoint in uV
+ *
+ *  It is answered with an extended reply:
+ *  - UInt32 : signature word 0x4C556543
+ *  - UInt16 : frame version UDP_VERSION
+ *  - UInt16 : flags of the request, UDP_FLAG_SUPERSEDED and UDP_FLAG_REJECTED are added
+ *  - UInt32 : sequence number of the request
+ *  - UInt32 : device status word
+ *  - Int64 : client timestamp of the request
+ *  - Int64 : server timestamp of the readbacks (OPC UA DateTime, 100 ns since 1601)
+ *  - Int64 : current setpoint in uA
+ *  - Int64 : voltage setpoint in uV
+ *  - Int64 : current readback in uA
+ *  - Int64 : voltage readback in uV
+ *  If UDP_FLAG_STATUS was requested, a status block with one entry per cached
+ *  variable follows (current, voltage, current setpoint, voltage setpoint, status word):
+ *  - UInt32 : OPC UA status code of the sample
+ *  - UInt32 : reserved
+ *  - Int64 : timestamp of the sample (0 if never sampled)
+ *
+ *  All fields are packed without padding in the native byte order
+ *  of the device (little endian on the ARM CPU of the FAST-PS).
+ *
+ *  The server runs in its own thread. It shares the device link and the
+ *  readback cache with the OPC UA server. All packets waiting at the socket are
+ *  received with one system call and answered with another one. Within such a batch
+ *  only the last requested setpoint is written to the device (in a single batch
+ *  of MWI/MWV commands), earlier requests are marked as superseded in an extended reply.
+ *  A request is answered from the cache as long as the readbacks are not older
+ *  than the configured maximum age, only older readbacks are sampled from the
+ *  device before answering.
+ *
+ *  Optionally a publisher thread sends the readbacks to a multicast group
+ *  on a fixed schedule, so any number of consumers receive the same frame
+ *  without putting load on the device or the server. The frame is an extended
+ *  reply with the status block and UDP_FLAG_PUBLISHED set. The sequence number
+ *  counts the published frames, the client timestamp field holds the time of sending.
+ *  The readbacks are sampled from the device (through a queue of the publisher)
+ *  only if the cache is older than the publish interval.
+ *
+ *  A client can also subscribe to a stream of readbacks sent to its own address,
+ *  so a fast control loop does not have to send a request for every sample.
+ *  The subscribe frame is recognized by its size of UDP_SUBSCRIBESIZE bytes:
+ *  - UInt32 : signature word 0x4C556543
+ *  - UInt16 : frame version UDP_VERSION
+ *  - UInt16 : flags, UDP_FLAG_SUBSCRIBE and optionally UDP_FLAG_STATUS
+ *  - UInt32 : sequence number (returned unchanged)
+ *  - UInt32 : interval between the frames in us, 0 cancels the subscription
+ *  - Int64 : client timestamp (returned unchanged)
+ *  - UInt32 : lease time in ms
+ *  - UInt32 : nonce of the server, 0 in the first frame
+ *
+ *  It is answered immediately with an extended reply, UDP_FLAG_REJECTED is added
+ *  if the interval or the lease is out of range or all UDP_SUBSCRIPTIONS are in use.
+ *  As the source address of a datagram can be forged, nothing is streamed
+ *  before the subscriber has shown that it receives the replies: the reply to
+ *  a subscribe frame without the right nonce has UDP_FLAG_CHALLENGE added
+ *  and is followed (behind the status block, if any) by
+ *  - UInt32 : nonce
+ *  - UInt32 : reserved
+ *  The subscriber has to send the subscribe frame again with this nonce within
+ *  UDP_CHALLENGETIME. All further subscribe frames of the address (renewals,
+ *  cancellation) have to carry the same nonce, otherwise they are only answered
+ *  with the challenge again.
+ *  Then until the lease expires a streaming thread sends an extended reply
+ *  with UDP_FLAG_STREAMED set (and the status block if requested) to the address
+ *  the subscription was received from every interval. The sequence number counts
+ *  the frames of the subscription, the client timestamp field holds the time of sending.
+ *  Sending the subscribe frame again from the same address renews the lease
+ *  (and changes the interval) without restarting the sequence.
+ *  The readbacks are sampled from the device (through a queue of the streaming thread)
+ *  only if the cache is older than the interval.
+ */
+
+#ifndef UDPSERVER_H
+#define UDPSERVER_H
+
+#include "open62541.h"
+
+#define UDP_SIGNATURE 0x4C556543
+#define UDP_REQUESTSIZE 24      // size of a request packet
+#define UDP_REPLYSIZE 36        // size of a reply packet
+
+#define UDP_VERSION 1           // version of the extended frame format
+#define UDP_EXTREQUESTSIZE 40   // size of an extended request packet
+#define UDP_EXTREPLYSIZE 64     // size of an extended reply packet without status block
+#define UDP_STATUSENTRYSIZE 16  // size of one status block entry
+#define UDP_SUBSCRIBESIZE 32    // size of a subscribe packet
+#define UDP_NONCESIZE 8         // size of the nonce following a challenge reply
+
+#define UDP_FLAG_SETPOINT   0x0001  // the setpoints of the request should be applied
+#define UDP_FLAG_STATUS     0x0002  // the status block is requested
+#define UDP_FLAG_SUBSCRIBE  0x0004  // (subscribe) the readbacks should be streamed to the client
+#define UDP_FLAG_CHALLENGE  0x0800  // (subscribe reply) the nonce follows, the subscribe frame has to be repeated with it
+#define UDP_FLAG_STREAMED   0x1000  // (stream) the frame was sent to a subscriber
+#define UDP_FLAG_PUBLISHED  0x2000  // (publication) the frame was sent to the multicast group
+#define UDP_FLAG_REJECTED   0x4000  // (reply) a setpoint was not acknowledged by the device
+#define UDP_FLAG_SUPERSEDED 0x8000  // (reply) the setpoints were replaced by a later request
+
+#define UDP_BATCH 16            // maximum number of packets handled with one system call
+
+#define UDP_SUBSCRIPTIONS 16    // maximum number of streaming subscriptions
+#define UDP_MININTERVAL 100     // shortest streaming interval [us]
+#define UDP_MAXLEASE 60000      // longest lease of a subscription [ms]
+#define UDP_CHALLENGETIME 1000  // time a new subscription waits for the nonce [ms]
+
+// open the UDP port and start the server and streaming threads
+// maxAge is the maximum age of cached readbacks [ms] used for a reply
+// return 0 on success, -1 if the server could not be started
+int UdpServerStart(unsigned short port, UA_UInt32 maxAge, UA_Logger logger);
+
+// stop the server and streaming threads and close the port
+void UdpServerStop();
+
+// start the publisher thread sending the readbacks to a multicast group every interval [ms]
+// ttl is the multicast time-to-live, iface the address of the sending interface (NULL for the default)
+// return 0 on success, -1 if the publisher could not be started
+int UdpPublisherStart(const char *group, unsigned short port, UA_UInt32 interval,
+    int ttl, const char *iface, UA_Logger logger);
+
+// stop the publisher thread
+void UdpPublisherStop();
+
+#endif
@@ -0,0 +1,362 @@
+/** @file LoadTest.c
+ *
+ *  Load generator for the OPC UA and the UDP server
+ *
+ *  Opens a number of OPC UA sessions reading SetPoint/Current back-to-back.
+ *  Every n-th request of a session is a write of SetPoint/CurrentSetpoint instead.
+ *  Additional sessions subscribe to SetPoint/Current and SetPoint/Voltage
+ *  and count the notifications. UDP clients hammer the UDP server with
+ *  legacy frames, each waiting for the reply before sending the next packet.
+ *
+ *  For every type of request the throughput and the p50/p99/p99.9 round-trip
+ *  latencies are reported. If the process id of the server is given, the CPU
+ *  time used by the server during the test is divided by the number of requests.
+ *
+ *  The server has to be running, typically against the simulated device (MockFastPs.c).
+ *
+ *  Build and run (on the development host)
+ *  - $CC -std=c99 -O2 -I.. -o loadtest LoadTest.c ../open62541.c -lpthread -lm
+ *  - ./loadtest [-s sessions] [-w write_every] [-m subscriptions] [-u udp_clients]
+ *               [-t seconds] [-h host] [-o opcua_port] [-p udp_port] [-P server_pid]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "open62541.h"
+
+#define UDP_SIGNATURE 0x4C556543
+
+static int sessions = 4;
+static int writeEvery = 0;      // 0 : no writes
+static int subscriptions = 0;
+static int udpClients = 0;
+static int duration = 10;
+static const char *host = "127.0.0.1";
+static unsigned short opcuaPort = 16664;
+static unsigned short udpPort = 16665;
+static int serverPid = 0;
+
+static volatile int running = 1;
+
+// latencies [us] of one type of request
+typedef struct {
+    const char *name;
+    pthread_mutex_t lock;
+    size_t count, size;
+    double *latency;
+    unsigned long errors;
+} Samples;
+
+static Samples reads  = { "read",  PTHREAD_MUTEX_INITIALIZER };
+static Samples writes = { "write", PTHREAD_MUTEX_INITIALIZER };
+static Samples udp    = { "udp",   PTHREAD_MUTEX_INITIALIZER };
+static unsigned long notifications = 0;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// merge the latencies recorded by one thread
+static void addSamples(Samples *s, const double *latency, size_t count, unsigned long errors) {
+    pthread_mutex_lock(&s->lock);
+    if (s->count+count > s->size) {
+        s->size = 2*(s->count+count);
+        s->latency = realloc(s->latency, s->size*sizeof(double));
+    }
+    memcpy(s->latency+s->count, latency, count*sizeof(double));
+    s->count += count;
+    s->errors += errors;
+    pthread_mutex_unlock(&s->lock);
+}
+
+// a growing buffer of latencies local to a thread
+typedef struct {
+    size_t count, size;
+    double *latency;
+    unsigned long errors;
+} Local;
+
+static void record(Local *l, double latency) {
+    if (l->count == l->size) {
+        l->size = l->size ? 2*l->size : 4096;
+        l->latency = realloc(l->latency, l->size*sizeof(double));
+    }
+    l->latency[l->count++] = latency;
+}
+
+/***********************************/
+/* OPC UA sessions                 */
+/***********************************/
+
+// find a node by its browse path starting at the objects folder, e.g. "SetPoint/Current"
+static int resolve(UA_Client *client, const char *path, UA_NodeId *node) {
+    char buf[256];
+    UA_NodeId current = UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER);
+    strncpy(buf, path, sizeof(buf)-1);
+    buf[sizeof(buf)-1] = '\0';
+    char *save;
+    for (char *name = strtok_r(buf, "/", &save); name; name = strtok_r(NULL, "/", &save)) {
+        UA_BrowseRequest request;
+        UA_BrowseRequest_init(&request);
+        request.nodesToBrowse = UA_BrowseDescription_new();
+        request.nodesToBrowseSize = 1;
+        request.nodesToBrowse[0].nodeId = current;
+        request.nodesToBrowse[0].resultMask = UA_BROWSERESULTMASK_BROWSENAME;
+        UA_BrowseResponse response = UA_Client_Service_browse(client, request);
+        int found = 0;
+        for (size_t i=0; i<response.resultsSize; i++)
+            for (size_t j=0; j<response.results[i].referencesSize; j++) {
+                UA_ReferenceDescription *ref = response.results[i].references+j;
+                if (ref->browseName.name.length == strlen(name)
+                        && !memcmp(ref->browseName.name.data, name, strlen(name))) {
+                    UA_NodeId_copy(&ref->nodeId.nodeId, &current);
+                    found = 1;
+                }
+            }
+        UA_BrowseRequest_deleteMembers(&request);
+        UA_BrowseResponse_deleteMembers(&response);
+        if (!found)
+            return 0;
+    }
+    *node = current;
+    return 1;
+}
+
+static UA_Client *connectClient() {
+    char url[80];
+    snprintf(url, sizeof(url), "opc.tcp://%s:%u", host, opcuaPort);
+    UA_ClientConfig config = UA_ClientConfig_standard;
+    config.logger = NULL;
+    UA_Client *client = UA_Client_new(config);
+    if (UA_Client_connect(client, url) != UA_STATUSCODE_GOOD) {
+        UA_Client_delete(client);
+        return NULL;
+    }
+    return client;
+}
+
+static void *sessionThread(void *arg) {
+    Local r = { 0 }, w = { 0 };
+    UA_NodeId currentNode, setpointNode;
+    UA_Client *client = connectClient();
+    if (client == NULL || !resolve(client, "SetPoint/Current", &currentNode)
+            || !resolve(client, "SetPoint/CurrentSetpoint", &setpointNode)) {
+        fprintf(stderr, "loadtest : session failed to connect\n");
+        return NULL;
+    }
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    UA_ReadValueId item;
+    UA_ReadValueId_init(&item);
+    item.nodeId = currentNode;
+    item.attributeId = UA_ATTRIBUTEID_VALUE;
+    request.nodesToRead = &item;
+    request.nodesToReadSize = 1;
+    unsigned long n = 0;
+    while (running) {
+        n++;
+        double t0 = now();
+        if (writeEvery > 0 && n % writeEvery == 0) {
+            // alternate between two setpoints, so every write changes the value
+            UA_Double value = (n/writeEvery) % 2 ? 1.0 : 1.5;
+            UA_Variant v;
+            UA_Variant_init(&v);
+            UA_Variant_setScalar(&v, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+            if (UA_Client_writeValueAttribute(client, setpointNode, &v) == UA_STATUSCODE_GOOD)
+                record(&w, 1e6*(now()-t0));
+            else
+                w.errors++;
+        } else {
+            UA_ReadResponse response = UA_Client_Service_read(client, request);
+            if (response.responseHeader.serviceResult == UA_STATUSCODE_GOOD && response.resultsSize == 1
+                    && response.results[0].hasValue)
+                record(&r, 1e6*(now()-t0));
+            else
+                r.errors++;
+            UA_ReadResponse_deleteMembers(&response);
+        }
+    }
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+    addSamples(&reads, r.latency, r.count, r.errors);
+    addSamples(&writes, w.latency, w.count, w.errors);
+    free(r.latency);
+    free(w.latency);
+    return NULL;
+}
+
+static void notify(UA_UInt32 handle, UA_DataValue *value, void *context) {
+    (*(unsigned long *)context)++;
+}
+
+static void *subscriptionThread(void *arg) {
+    unsigned long count = 0;
+    UA_NodeId currentNode, voltageNode;
+    UA_Client *client = connectClient();
+    if (client == NULL || !resolve(client, "SetPoint/Current", &currentNode)
+            || !resolve(client, "SetPoint/Voltage", &voltageNode)) {
+        fprintf(stderr, "loadtest : subscription failed to connect\n");
+        return NULL;
+    }
+    UA_SubscriptionSettings settings = UA_SubscriptionSettings_standard;
+    settings.requestedPublishingInterval = 100;
+    UA_UInt32 subId, monId;
+    UA_Client_Subscriptions_new(client, settings, &subId);
+    UA_Client_Subscriptions_addMonitoredItem(client, subId, currentNode, UA_ATTRIBUTEID_VALUE, notify, &count, &monId);
+    UA_Client_Subscriptions_addMonitoredItem(client, subId, voltageNode, UA_ATTRIBUTEID_VALUE, notify, &count, &monId);
+    while (running)
+        UA_Client_Subscriptions_manuallySendPublishRequest(client);
+    UA_Client_Subscriptions_remove(client, subId);
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+    __atomic_fetch_add(&notifications, count, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/***********************************/
+/* UDP clients                     */
+/***********************************/
+
+static void *udpThread(void *arg) {
+    Local u = { 0 };
+    int s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct timeval timeout = { 0, 200000 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(host);
+    addr.sin_port = htons(udpPort);
+    connect(s, (struct sockaddr *)&addr, sizeof(addr));
+    // signature, no setpoints, 1.5 A, 2 V (native byte order like the server)
+    unsigned char request[24];
+    uint32_t sig = UDP_SIGNATURE, flag = 0;
+    int64_t current = 1500000, voltage = 2000000;
+    memcpy(request, &sig, 4);
+    memcpy(request+4, &flag, 4);
+    memcpy(request+8, &current, 8);
+    memcpy(request+16, &voltage, 8);
+    unsigned char reply[128];
+    while (running) {
+        double t0 = now();
+        if (send(s, request, sizeof(request), 0) != sizeof(request) || recv(s, reply, sizeof(reply), 0) != 36)
+            u.errors++;
+        else
+            record(&u, 1e6*(now()-t0));
+    }
+    close(s);
+    addSamples(&udp, u.latency, u.count, u.errors);
+    free(u.latency);
+    return NULL;
+}
+
+/***********************************/
+/* evaluation                      */
+/***********************************/
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const Samples *s, double fraction) {
+    size_t i = (size_t)(fraction * s->count);
+    if (i >= s->count)
+        i = s->count-1;
+    return s->latency[i];
+}
+
+static void report(Samples *s, double elapsed) {
+    if (s->count == 0 && s->errors == 0)
+        return;
+    if (s->count == 0) {
+        printf("%-6s %10lu errors\n", s->name, s->errors);
+        return;
+    }
+    qsort(s->latency, s->count, sizeof(double), compare);
+    printf("%-6s %10zu %10.0f %9.1f %9.1f %9.1f %9.1f %8lu\n", s->name, s->count, s->count/elapsed,
+        percentile(s, 0.5), percentile(s, 0.99), percentile(s, 0.999), s->latency[s->count-1], s->errors);
+}
+
+// CPU time (user + system) used by a process [s]
+static double cpuTime(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1.0;
+    unsigned long utime = 0, stime = 0;
+    // skip pid, comm (may contain blanks) and the fields up to utime/stime (14/15)
+    int c;
+    while ((c = fgetc(f)) != EOF && c != ')')
+        ;
+    if (fscanf(f, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        utime = stime = 0;
+    fclose(f);
+    return (double)(utime+stime) / sysconf(_SC_CLK_TCK);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:m:u:t:h:o:p:P:")) != -1)
+        switch (opt) {
+            case 's': sessions = atoi(optarg); break;
+            case 'w': writeEvery = atoi(optarg); break;
+            case 'm': subscriptions = atoi(optarg); break;
+            case 'u': udpClients = atoi(optarg); break;
+            case 't': duration = atoi(optarg); break;
+            case 'h': host = optarg; break;
+            case 'o': opcuaPort = atoi(optarg); break;
+            case 'p': udpPort = atoi(optarg); break;
+            case 'P': serverPid = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-s sessions] [-w write_every] [-m subscriptions] [-u udp_clients]\n"
+                                "       [-t seconds] [-h host] [-o opcua_port] [-p udp_port] [-P server_pid]\n", argv[0]);
+                return 1;
+        }
+    int nthreads = sessions + subscriptions + udpClients;
+    pthread_t *threads = calloc(nthreads > 0 ? nthreads : 1, sizeof(pthread_t));
+    printf("loadtest : %d sessions (write every %d), %d subscriptions, %d UDP clients, %d s\n",
+        sessions, writeEvery, subscriptions, udpClients, duration);
+    double cpu0 = serverPid ? cpuTime(serverPid) : 0.0;
+    double t0 = now();
+    int k = 0;
+    for (int i=0; i<sessions; i++)
+        pthread_create(threads+k++, NULL, sessionThread, NULL);
+    for (int i=0; i<subscriptions; i++)
+        pthread_create(threads+k++, NULL, subscriptionThread, NULL);
+    for (int i=0; i<udpClients; i++)
+        pthread_create(threads+k++, NULL, udpThread, NULL);
+    sleep(duration);
+    running = 0;
+    for (int i=0; i<k; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = now()-t0;
+    double cpu = serverPid ? cpuTime(serverPid)-cpu0 : 0.0;
+
+    printf("type     requests      req/s   p50[us]   p99[us] p99.9[us]   max[us]   errors\n");
+    report(&reads, elapsed);
+    report(&writes, elapsed);
+    report(&udp, elapsed);
+    if (subscriptions > 0)
+        printf("notify %10lu %10.0f\n", notifications, notifications/elapsed);
+    size_t total = reads.count + writes.count + udp.count;
+    if (serverPid && total > 0)
+        printf("server CPU %.2f s = %.1f us per request (%.0f %% of one core)\n",
+            cpu, 1e6*cpu/total, 100.0*cpu/elapsed);
+    return 0;
+}
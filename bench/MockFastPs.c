@@ -0,0 +1,183 @@
+/** @file MockFastPs.c
+ *
+ *  Simulated FAST-PS device server for off-target tests of the OPC UA server
+ *
+ *  Listens at the TCP/IP port of the device server (10001) and answers the
+ *  commands used by the OPC UA server like a FAST-PS does:
+ *  MON, MOFF, MRESET, MST, MRI, MRV, MWI, MWV, MRG, MWG and UPMODE.
+ *  The setpoints can only be read back with the output on, otherwise
+ *  #NAK:13 is answered. Unknown commands are answered with #NAK:01.
+ *
+ *  Like the device, the commands are executed one after the other. Every answer
+ *  is delayed by the configured latency plus a random jitter (uniformly distributed).
+ *  One client is served at a time, a new connection is accepted when it closes.
+ *
+ *  Build and run (on the development host)
+ *  - $CC -std=c99 -O2 -o mockfastps MockFastPs.c
+ *  - ./mockfastps [-p port] [-l latency_us] [-j jitter_us] [-n noise_A] [-v]
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define NREG 100
+
+static unsigned int latency = 0;        // fixed reply delay [us]
+static unsigned int jitter = 0;         // maximum additional random delay [us]
+static double noise = 0.0;              // amplitude of the current readback noise [A]
+static int verbose = 0;                 // print all setpoint and register writes
+
+// the simulated device state
+static int outputOn = 0;
+static double current = 0.0;
+static double voltage = 0.0;
+static double reg[NREG];
+static int upmodeSFP = 0;
+
+static void delayReply() {
+    unsigned long us = latency;
+    if (jitter > 0)
+        us += (unsigned long)rand() % (jitter+1);
+    if (us == 0)
+        return;
+    struct timespec t = { us/1000000, (us%1000000)*1000 };
+    nanosleep(&t, NULL);
+}
+
+static double readNoise() {
+    return noise * (2.0*rand()/RAND_MAX - 1.0);
+}
+
+// compute the answer to one command line (without termination)
+static const char *execute(const char *cmd, char *answer, size_t size) {
+    unsigned int n;
+    double value;
+    char c;
+    if (verbose && !strncmp(cmd, "MW", 2) && cmd[strlen(cmd)-1] != '?')
+        printf("%s\n", cmd);
+    if (!strcmp(cmd, "MON"))
+        outputOn = 1;
+    else if (!strcmp(cmd, "MOFF"))
+        outputOn = 0;
+    else if (!strcmp(cmd, "MRESET"))
+        ;
+    else if (!strcmp(cmd, "MST"))
+        snprintf(answer, size, "#MST:%08x", outputOn ? 1 : 0);
+    else if (!strcmp(cmd, "MRI"))
+        snprintf(answer, size, "#MRI:%f", outputOn ? current+readNoise() : 0.0);
+    else if (!strcmp(cmd, "MRV"))
+        snprintf(answer, size, "#MRV:%f", outputOn ? voltage : 0.0);
+    else if (!strcmp(cmd, "MWI:?") || !strcmp(cmd, "MWV:?")) {
+        // the setpoints can only be read with the output on
+        if (!outputOn)
+            return "#NAK:13";
+        snprintf(answer, size, "#%.3s:%f", cmd, cmd[2]=='I' ? current : voltage);
+    }
+    else if (sscanf(cmd, "MWI:%lf%c", &value, &c) == 1)
+        current = value;
+    else if (sscanf(cmd, "MWV:%lf%c", &value, &c) == 1)
+        voltage = value;
+    else if (sscanf(cmd, "MRG:%u%c", &n, &c) == 1 && n < NREG)
+        snprintf(answer, size, "#MRG:%u:%f", n, reg[n]);
+    else if (sscanf(cmd, "MWG:%u:%lf%c", &n, &value, &c) == 2 && n < NREG)
+        reg[n] = value;
+    else if (!strcmp(cmd, "UPMODE"))
+        snprintf(answer, size, "#UPMODE:%s", upmodeSFP ? "SFP" : "NORMAL");
+    else if (!strcmp(cmd, "UPMODE:SFP"))
+        upmodeSFP = 1;
+    else if (!strcmp(cmd, "UPMODE:NORMAL"))
+        upmodeSFP = 0;
+    else
+        return "#NAK:01";
+    // commands without readback are acknowledged
+    if (answer[0] == '\0')
+        return "#AK";
+    return answer;
+}
+
+// answer all commands of one client until the connection is closed
+static void serve(int client) {
+    char rx[4096];
+    size_t len = 0;
+    while (1) {
+        ssize_t n = recv(client, rx+len, sizeof(rx)-len, 0);
+        if (n <= 0)
+            return;
+        len += n;
+        char *line = rx;
+        char *end;
+        while ((end = memchr(line, '\n', rx+len-line)) != NULL) {
+            // strip the \r\n termination
+            *end = '\0';
+            if (end > line && end[-1] == '\r')
+                end[-1] = '\0';
+            char buf[80] = "";
+            char answer[84];
+            snprintf(answer, sizeof(answer), "%s\r\n", execute(line, buf, sizeof(buf)));
+            delayReply();
+            if (send(client, answer, strlen(answer), MSG_NOSIGNAL) < 0)
+                return;
+            line = end+1;
+        }
+        // keep a partial line for the next recv()
+        len = rx+len-line;
+        memmove(rx, line, len);
+        if (len == sizeof(rx))
+            len = 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned short port = 10001;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:j:n:v")) != -1)
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'l': latency = atoi(optarg); break;
+            case 'j': jitter = atoi(optarg); break;
+            case 'n': noise = atof(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-l latency_us] [-j jitter_us] [-n noise_A] [-v]\n", argv[0]);
+                return 1;
+        }
+    for (int i=0; i<NREG; i++)
+        reg[i] = 0.5*i;
+    srand(time(NULL));
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int listener = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+        perror("mockfastps");
+        return 1;
+    }
+    printf("mockfastps : port=%u latency=%u us jitter=%u us\n", port, latency, jitter);
+    fflush(stdout);
+    while (1) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+            continue;
+        // the answers are sent immediately like the device does
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        serve(client);
+        close(client);
+        fflush(stdout);
+    }
+    return 0;
+}
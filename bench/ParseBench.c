@@ -0,0 +1,184 @@
+/** @file ParseBench.c
+ *
+ *  Micro-benchmark of the FAST-PS reply parser and command formatter
+ *
+ *  Compares the routines of FastPsProtocol.c with the sscanf()/sprintf()
+ *  calls formerly used in the read/write callbacks. Before timing, both
+ *  paths are run on the same input and any difference is reported.
+ *
+ *  Build and run (on the development host or on the target)
+ *  - $CC -std=c99 -O2 -I.. -o parsebench ParseBench.c ../FastPsProtocol.c
+ *  - ./parsebench [iterations]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FastPsProtocol.h"
+
+static const char *doubleReplies[] = {
+    "#MRI:1.234567", "#MRI:-0.000123", "#MRI:12.500000", "#MRI:0.0",
+    "#MRV:-3.141592", "#MRV:24.999999", "#MWI:0.750000", "#MWV:1.5e-3" };
+static const char *doublePrefixes[] = {
+    "#MRI:", "#MRI:", "#MRI:", "#MRI:",
+    "#MRV:", "#MRV:", "#MWI:", "#MWV:" };
+#define NDOUBLE (sizeof(doubleReplies)/sizeof(doubleReplies[0]))
+
+static const char *wordReplies[] = {
+    "#MST:00000001", "#MST:0000a001", "#MST:ffffffff", "#MST:80000000" };
+#define NWORD (sizeof(wordReplies)/sizeof(wordReplies[0]))
+
+static const double setpoints[] = {
+    0.0, 1.5, -2.25, 0.000001, 12.345678, -0.5, 99.999999, 3.1415926535 };
+#define NSETPOINT (sizeof(setpoints)/sizeof(setpoints[0]))
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// the results are accumulated here so the compiler cannot drop the loops
+static volatile double sink;
+
+static void report(const char *name, double oldTime, double newTime, long n) {
+    printf("%-22s sscanf/sprintf %8.1f ns   FastPs %8.1f ns   speedup %5.1f\n",
+        name, 1e9*oldTime/n, 1e9*newTime/n, oldTime/newTime);
+}
+
+// check that both implementations agree on the test data
+static int verify() {
+    int errors = 0;
+    char oldCmd[80], newCmd[FASTPS_CMDSIZE];
+    for (unsigned int i=0; i<NDOUBLE; i++) {
+        double a = 0.0, b = 0.0;
+        sscanf(doubleReplies[i]+5, "%lf", &a);
+        if (!FastPsParseDouble(doubleReplies[i], doublePrefixes[i], &b) || a!=b) {
+            printf("mismatch parsing %s : %.17g %.17g\n", doubleReplies[i], a, b);
+            errors++;
+        }
+    }
+    for (unsigned int i=0; i<NWORD; i++) {
+        unsigned int a = 0, b = 0;
+        sscanf(wordReplies[i]+5, "%x", &a);
+        if (!FastPsParseWord(wordReplies[i], "#MST:", &b) || a!=b) {
+            printf("mismatch parsing %s : %x %x\n", wordReplies[i], a, b);
+            errors++;
+        }
+    }
+    for (unsigned int i=0; i<NSETPOINT; i++) {
+        sprintf(oldCmd, "MWI:%9.6f\r\n", setpoints[i]);
+        FastPsFormatSetpoint(newCmd, "MWI", setpoints[i]);
+        if (strcmp(oldCmd, newCmd)) {
+            printf("mismatch formatting %.17g : '%s' '%s'\n", setpoints[i], oldCmd, newCmd);
+            errors++;
+        }
+        sprintf(oldCmd, "MWG:%d:%lf\r\n", 43, setpoints[i]);
+        FastPsFormatRegisterWrite(newCmd, 43, setpoints[i]);
+        if (strcmp(oldCmd, newCmd)) {
+            printf("mismatch formatting %.17g : '%s' '%s'\n", setpoints[i], oldCmd, newCmd);
+            errors++;
+        }
+    }
+    double reg = 0.0;
+    if (!FastPsParseRegister("#MRG:43:0.250000", 43, &reg) || reg!=0.25
+            || FastPsParseRegister("#MRG:44:0.250000", 43, &reg)
+            || FastPsParseDouble("#NAK:13", "#MRI:", &reg)) {
+        printf("register/prefix validation failed\n");
+        errors++;
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[]) {
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    if (verify() != 0)
+        return 1;
+    printf("%ld iterations, time per call\n", n);
+
+    double t0, oldTime, newTime, acc = 0.0;
+    char cmd[80];
+
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        double v;
+        sscanf(doubleReplies[i%NDOUBLE]+5, "%lf", &v);
+        acc += v;
+    }
+    oldTime = now()-t0;
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        double v;
+        FastPsParseDouble(doubleReplies[i%NDOUBLE], doublePrefixes[i%NDOUBLE], &v);
+        acc += v;
+    }
+    newTime = now()-t0;
+    report("parse #MRI:/#MRV:/...", oldTime, newTime, n);
+
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        unsigned int w;
+        sscanf(wordReplies[i%NWORD]+5, "%x", &w);
+        acc += w;
+    }
+    oldTime = now()-t0;
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        unsigned int w;
+        FastPsParseWord(wordReplies[i%NWORD], "#MST:", &w);
+        acc += w;
+    }
+    newTime = now()-t0;
+    report("parse #MST: (hex)", oldTime, newTime, n);
+
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        double v;
+        sscanf("#MRG:43:0.250000"+8, "%lf", &v);
+        acc += v;
+    }
+    oldTime = now()-t0;
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        double v;
+        FastPsParseRegister("#MRG:43:0.250000", 43, &v);
+        acc += v;
+    }
+    newTime = now()-t0;
+    report("parse #MRG:nn:", oldTime, newTime, n);
+
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        sprintf(cmd, "MWI:%9.6f\r\n", setpoints[i%NSETPOINT]);
+        acc += cmd[5];
+    }
+    oldTime = now()-t0;
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        FastPsFormatSetpoint(cmd, "MWI", setpoints[i%NSETPOINT]);
+        acc += cmd[5];
+    }
+    newTime = now()-t0;
+    report("format MWI:", oldTime, newTime, n);
+
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        sprintf(cmd, "MWG:%d:%lf\r\n", 40+(int)(i&7), setpoints[i%NSETPOINT]);
+        acc += cmd[5];
+    }
+    oldTime = now()-t0;
+    t0 = now();
+    for (long i=0; i<n; i++) {
+        FastPsFormatRegisterWrite(cmd, 40+(i&7), setpoints[i%NSETPOINT]);
+        acc += cmd[5];
+    }
+    newTime = now()-t0;
+    report("format MWG:nn:", oldTime, newTime, n);
+
+    sink = acc;
+    return 0;
+}
@@ -0,0 +1,116 @@
+/** @file TraceConvert.c
+ *
+ *  Converter of the binary event trace of the server (see Trace.h)
+ *
+ *  Reads a trace file written on SIGUSR1 or by Diagnostics/DumpTrace()
+ *  and prints the records of all threads in the order of their start time,
+ *  either as a Chrome trace (JSON, to be loaded into chrome://tracing
+ *  or ui.perfetto.dev) or as CSV. The times are converted to wall-clock
+ *  time with the reference stored in the file header.
+ *
+ *  Build and run (on the development host)
+ *  - $CC -std=c99 -O2 -I.. -o traceconvert TraceConvert.c
+ *  - ./traceconvert [-c] trace_file > output
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "Trace.h"
+
+static const char *eventNames[TRACE_EVENTS] = { "device", "datasource", "udp", "loop" };
+
+// the device command types in the order of the histograms of Diagnostics.h
+static const char *commandNames[] = { "MRI", "MRV", "MST", "MWI", "MWV", "MRG", "MWG", "other" };
+#define COMMAND_TYPES (sizeof(commandNames)/sizeof(commandNames[0]))
+
+static const char *eventName(const TraceRecord *r) {
+    return r->event < TRACE_EVENTS ? eventNames[r->event] : "unknown";
+}
+
+// the name of a record shown in the trace viewer
+static void recordName(const TraceRecord *r, char *name, size_t size) {
+    if (r->event == TRACE_DEVICE)
+        snprintf(name, size, "%s", r->type < COMMAND_TYPES ? commandNames[r->type] : "unknown");
+    else if (r->event == TRACE_DATASOURCE)
+        snprintf(name, size, "read ns=1;i=%u", r->arg);
+    else if (r->event == TRACE_UDP)
+        snprintf(name, size, "udp batch %u", r->arg);
+    else
+        snprintf(name, size, "%s", eventName(r));
+}
+
+static int byStart(const void *a, const void *b) {
+    const TraceRecord *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+int main(int argc, char *argv[]) {
+    int csv = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c")) != -1)
+        if (opt == 'c')
+            csv = 1;
+        else {
+            fprintf(stderr, "usage: %s [-c] trace_file\n", argv[0]);
+            return 1;
+        }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-c] trace_file\n", argv[0]);
+        return 1;
+    }
+    FILE *f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC
+            || header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s is no trace file of this version\n", argv[optind]);
+        fclose(f);
+        return 1;
+    }
+    TraceRecord *records = malloc((header.recordCount > 0 ? header.recordCount : 1) * sizeof(TraceRecord));
+    if (records == NULL || fread(records, sizeof(TraceRecord), header.recordCount, f) != header.recordCount) {
+        fprintf(stderr, "%s is truncated\n", argv[optind]);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    qsort(records, header.recordCount, sizeof(TraceRecord), byStart);
+    // monotonic [100 ns] to Unix time [us]
+    int64_t offset = header.wallClock - UA_DATETIME_UNIX_EPOCH - header.monotonic;
+    char name[64];
+    if (csv) {
+        printf("time_us,thread,event,name,duration_us,status,arg\n");
+        for (uint32_t i=0; i<header.recordCount; i++) {
+            const TraceRecord *r = records+i;
+            recordName(r, name, sizeof(name));
+            printf("%.1f,%s,%s,%s,%u,0x%08x,%u\n", (r->start + offset) / 10.0,
+                r->thread < TRACE_THREADS ? header.threadNames[r->thread] : "?",
+                eventName(r), name, r->duration, r->status, r->arg);
+        }
+    } else {
+        // the thread names first, then the complete events
+        printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (int t=0; t<TRACE_THREADS; t++)
+            printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%.*s\"}}\n",
+                t > 0 ? "," : "", t, TRACE_NAMESIZE, header.threadNames[t]);
+        for (uint32_t i=0; i<header.recordCount; i++) {
+            const TraceRecord *r = records+i;
+            recordName(r, name, sizeof(name));
+            printf(",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%u,\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"status\":\"0x%08x\",\"arg\":%u}}\n",
+                name, eventName(r), (r->start + offset) / 10.0, r->duration, r->thread, r->status, r->arg);
+        }
+        printf("]}\n");
+    }
+    free(records);
+    return 0;
+}
@@ -20151,6 +20151,9 @@ satisfySignature(const UA_Variant *var, const UA_Argument *arg) {
     }
 
     /* do the array dimensions match? */
+    /* (arguments without array dimensions accept arrays of any length) */
+    if(arg->arrayDimensionsSize == 0)
+        return UA_STATUSCODE_GOOD;
     if(arg->arrayDimensionsSize != varDimsSize)
         return UA_STATUSCODE_BADINVALIDARGUMENT;
     for(size_t i = 0; i < varDimsSize; i++) {
@@ -21349,6 +21352,7 @@ void MonitoredItem_QueuePushDataValue(UA_Server *server, UA_MonitoredItem *monit
         }
         MonitoredItem_queuedValue *queueItem = TAILQ_LAST(&monitoredItem->queue, QueueOfQueueDataValues);
         TAILQ_REMOVE(&monitoredItem->queue, queueItem, listEntry);
+        UA_DataValue_deleteMembers(&queueItem->value);
         UA_free(queueItem);
         monitoredItem->queueSize.current--;
     }